@@ -71,56 +71,56 @@ STATIC long s7plcReadInt64in(int64inRecord *record)
     switch (priv->dtype)
     {
         case menuFtypeCHAR:
-            status = s7plcRead(priv->station, priv->offs,
+            status = s7plcReadPriv(priv,
                 1, &sval8);
             s7plcDebugLog(3, "int64in %s: read 8bit %02x\n",
                 record->name, sval8);
             record->val = sval8;
             break;
         case menuFtypeUCHAR:
-            status = s7plcRead(priv->station, priv->offs,
+            status = s7plcReadPriv(priv,
                 1, &uval8);
             s7plcDebugLog(3, "int64in %s: read 8bit %02x\n",
                 record->name, uval8);
             record->val = uval8;
             break;
         case menuFtypeSHORT:
-            status = s7plcRead(priv->station, priv->offs,
+            status = s7plcReadPriv(priv,
                 2, &sval16);
             s7plcDebugLog(3, "int64in %s: read 16bit %04x\n",
                 record->name, sval16);
             record->val = sval16;
             break;
         case menuFtypeUSHORT:
-            status = s7plcRead(priv->station, priv->offs,
+            status = s7plcReadPriv(priv,
                 2, &uval16);
             s7plcDebugLog(3, "int64in %s: read 16bit %04x\n",
                 record->name, uval16);
             record->val = uval16;
             break;
         case menuFtypeLONG:
-            status = s7plcRead(priv->station, priv->offs,
+            status = s7plcReadPriv(priv,
                 4, &sval32);
             s7plcDebugLog(3, "int64in %s: read 32bit %08x\n",
                 record->name, sval32);
             record->val = sval32;
             break;
         case menuFtypeULONG:
-            status = s7plcRead(priv->station, priv->offs,
+            status = s7plcReadPriv(priv,
                 4, &uval32);
             s7plcDebugLog(3, "int64in %s: read 32bit %08x\n",
                 record->name, uval32);
             record->val = uval32;
             break;
         case menuFtypeINT64:
-            status = s7plcRead(priv->station, priv->offs,
+            status = s7plcReadPriv(priv,
                 8, &sval64);
             s7plcDebugLog(3, "int64in %s: read 64bit %016llx\n",
                 record->name, sval64);
             record->val = sval64;
             break;
         case menuFtypeUINT64:
-            status = s7plcRead(priv->station, priv->offs,
+            status = s7plcReadPriv(priv,
                 8, &uval64);
             s7plcDebugLog(3, "int64in %s: read 64bit "CONV64"\n",
                 record->name, uval64);
@@ -147,6 +147,8 @@ STATIC long s7plcReadInt64in(int64inRecord *record)
     return status;
 }
 
+S7PLC_PROBED(read, s7plcReadInt64in, int64inRecord)
+
 struct devsup s7plcInt64in =
 {
     5,
@@ -154,7 +156,7 @@ struct devsup s7plcInt64in =
     NULL,
     s7plcInitRecordInt64in,
     s7plcGetInIntInfo,
-    s7plcReadInt64in
+    S7PLC_PROBE_FN(s7plcReadInt64in)
 };
 
 epicsExportAddress(dset, s7plcInt64in);
@@ -226,7 +228,7 @@ STATIC long s7plcWriteInt64out(int64outRecord *record)
             rval8 = (epicsUInt8)record->val;
             s7plcDebugLog(2, "int64out %s: write 8bit %02x\n",
                 record->name, rval8);
-            status = s7plcWrite(priv->station, priv->offs,
+            status = s7plcWritePriv(priv,
                 1, &rval8);
             break;
         case menuFtypeSHORT:
@@ -234,7 +236,7 @@ STATIC long s7plcWriteInt64out(int64outRecord *record)
             rval16 = (epicsUInt16)record->val;
             s7plcDebugLog(2, "int64out %s: write 16bit %04x\n",
                 record->name, rval16);
-            status = s7plcWrite(priv->station, priv->offs,
+            status = s7plcWritePriv(priv,
                 2, &rval16);
             break;
         case menuFtypeLONG:
@@ -242,7 +244,7 @@ STATIC long s7plcWriteInt64out(int64outRecord *record)
             rval32 = (epicsUInt32)record->val;
             s7plcDebugLog(2, "int64out %s: write 32bit %08x\n",
                 record->name, rval32);
-            status = s7plcWrite(priv->station, priv->offs,
+            status = s7plcWritePriv(priv,
                 4, &rval32);
             break;
         case menuFtypeINT64:
@@ -250,7 +252,7 @@ STATIC long s7plcWriteInt64out(int64outRecord *record)
             rval64 = record->val;
             s7plcDebugLog(2, "int64out %s: write 64bit "CONV64"\n",
                 record->name, rval64);
-            status = s7plcWrite(priv->station, priv->offs,
+            status = s7plcWritePriv(priv,
                 8, &rval64);
             break;
         default:
@@ -272,6 +274,8 @@ STATIC long s7plcWriteInt64out(int64outRecord *record)
     return status;
 }
 
+S7PLC_PROBED(write, s7plcWriteInt64out, int64outRecord)
+
 struct devsup s7plcInt64out =
 {
     5,
@@ -279,7 +283,7 @@ struct devsup s7plcInt64out =
     NULL,
     s7plcInitRecordInt64out,
     s7plcGetOutIntInfo,
-    s7plcWriteInt64out
+    S7PLC_PROBE_FN(s7plcWriteInt64out)
 };
 
 epicsExportAddress(dset, s7plcInt64out);
@@ -46,6 +46,7 @@ epicsExportAddress(dset, s7plcAddr);
 /* bi for status bit ************************************************/
 
 STATIC long s7plcInitRecordStat(biRecord *);
+STATIC long s7plcGetStatIntInfo(int cmd, dbCommon *record, IOSCANPVT *ppvt);
 STATIC long s7plcReadStat(biRecord *);
 
 struct devsup s7plcStat =
@@ -54,16 +55,74 @@ struct devsup s7plcStat =
     NULL,
     NULL,
     s7plcInitRecordStat,
-    s7plcGetInIntInfo,
+    s7plcGetStatIntInfo,
     s7plcReadStat
 };
 
 epicsExportAddress(dset, s7plcStat);
 
+/* ai and longin for performance counters ***************************/
+
+STATIC long s7plcInitRecordStatsAi(aiRecord *);
+STATIC long s7plcReadStatsAi(aiRecord *);
+STATIC long s7plcInitRecordStatsLongin(longinRecord *);
+STATIC long s7plcReadStatsLongin(longinRecord *);
+
+struct {
+    long      number;
+    DEVSUPFUN report;
+    DEVSUPFUN init;
+    DEVSUPFUN init_record;
+    DEVSUPFUN get_ioint_info;
+    DEVSUPFUN read;
+    DEVSUPFUN special_linconv;
+} s7plcStatsAi =
+{
+    6,
+    NULL,
+    NULL,
+    s7plcInitRecordStatsAi,
+    s7plcGetStatIntInfo,
+    s7plcReadStatsAi,
+    NULL
+};
+
+epicsExportAddress(dset, s7plcStatsAi);
+
+struct devsup s7plcStatsLongin =
+{
+    5,
+    NULL,
+    NULL,
+    s7plcInitRecordStatsLongin,
+    s7plcGetStatIntInfo,
+    s7plcReadStatsLongin
+};
+
+epicsExportAddress(dset, s7plcStatsLongin);
+
+/* waveform for latency histograms **********************************/
+
+STATIC long s7plcInitRecordLatency(waveformRecord *);
+STATIC long s7plcReadLatency(waveformRecord *);
+
+struct devsup s7plcLatencyWaveform =
+{
+    5,
+    NULL,
+    NULL,
+    s7plcInitRecordLatency,
+    NULL,
+    s7plcReadLatency
+};
+
+epicsExportAddress(dset, s7plcLatencyWaveform);
+
 /* bi ***************************************************************/
 
 STATIC long s7plcInitRecordBi(biRecord *);
 STATIC long s7plcReadBi(biRecord *);
+S7PLC_PROBED(read, s7plcReadBi, biRecord)
 
 struct devsup s7plcBi =
 {
@@ -71,8 +130,8 @@ struct devsup s7plcBi =
     NULL,
     NULL,
     s7plcInitRecordBi,
-    s7plcGetInIntInfo,
-    s7plcReadBi
+    s7plcGetBitInIntInfo,
+    S7PLC_PROBE_FN(s7plcReadBi)
 };
 
 epicsExportAddress(dset, s7plcBi);
@@ -81,6 +140,7 @@ epicsExportAddress(dset, s7plcBi);
 
 STATIC long s7plcInitRecordBo(boRecord *);
 STATIC long s7plcWriteBo(boRecord *);
+S7PLC_PROBED(write, s7plcWriteBo, boRecord)
 
 struct devsup s7plcBo =
 {
@@ -89,7 +149,7 @@ struct devsup s7plcBo =
     NULL,
     s7plcInitRecordBo,
     s7plcGetOutIntInfo,
-    s7plcWriteBo
+    S7PLC_PROBE_FN(s7plcWriteBo)
 };
 
 epicsExportAddress(dset, s7plcBo);
@@ -98,6 +158,7 @@ epicsExportAddress(dset, s7plcBo);
 
 STATIC long s7plcInitRecordMbbi(mbbiRecord *);
 STATIC long s7plcReadMbbi(mbbiRecord *);
+S7PLC_PROBED(read, s7plcReadMbbi, mbbiRecord)
 
 struct devsup s7plcMbbi =
 {
@@ -106,7 +167,7 @@ struct devsup s7plcMbbi =
     NULL,
     s7plcInitRecordMbbi,
     s7plcGetInIntInfo,
-    s7plcReadMbbi
+    S7PLC_PROBE_FN(s7plcReadMbbi)
 };
 
 epicsExportAddress(dset, s7plcMbbi);
@@ -115,6 +176,7 @@ epicsExportAddress(dset, s7plcMbbi);
 
 STATIC long s7plcInitRecordMbbo(mbboRecord *);
 STATIC long s7plcWriteMbbo(mbboRecord *);
+S7PLC_PROBED(write, s7plcWriteMbbo, mbboRecord)
 
 struct devsup s7plcMbbo =
 {
@@ -123,7 +185,7 @@ struct devsup s7plcMbbo =
     NULL,
     s7plcInitRecordMbbo,
     s7plcGetOutIntInfo,
-    s7plcWriteMbbo
+    S7PLC_PROBE_FN(s7plcWriteMbbo)
 };
 
 epicsExportAddress(dset, s7plcMbbo);
@@ -132,6 +194,7 @@ epicsExportAddress(dset, s7plcMbbo);
 
 STATIC long s7plcInitRecordMbbiDirect(mbbiDirectRecord *);
 STATIC long s7plcReadMbbiDirect(mbbiDirectRecord *);
+S7PLC_PROBED(read, s7plcReadMbbiDirect, mbbiDirectRecord)
 
 struct devsup s7plcMbbiDirect =
 {
@@ -140,7 +203,7 @@ struct devsup s7plcMbbiDirect =
     NULL,
     s7plcInitRecordMbbiDirect,
     s7plcGetInIntInfo,
-    s7plcReadMbbiDirect
+    S7PLC_PROBE_FN(s7plcReadMbbiDirect)
 };
 
 epicsExportAddress(dset, s7plcMbbiDirect);
@@ -149,6 +212,7 @@ epicsExportAddress(dset, s7plcMbbiDirect);
 
 STATIC long s7plcInitRecordMbboDirect(mbboDirectRecord *);
 STATIC long s7plcWriteMbboDirect(mbboDirectRecord *);
+S7PLC_PROBED(write, s7plcWriteMbboDirect, mbboDirectRecord)
 
 struct devsup s7plcMbboDirect =
 {
@@ -157,7 +221,7 @@ struct devsup s7plcMbboDirect =
     NULL,
     s7plcInitRecordMbboDirect,
     s7plcGetOutIntInfo,
-    s7plcWriteMbboDirect
+    S7PLC_PROBE_FN(s7plcWriteMbboDirect)
 };
 
 epicsExportAddress(dset, s7plcMbboDirect);
@@ -166,6 +230,7 @@ epicsExportAddress(dset, s7plcMbboDirect);
 
 STATIC long s7plcInitRecordLongin(longinRecord *);
 STATIC long s7plcReadLongin(longinRecord *);
+S7PLC_PROBED(read, s7plcReadLongin, longinRecord)
 
 struct devsup s7plcLongin =
 {
@@ -174,7 +239,7 @@ struct devsup s7plcLongin =
     NULL,
     s7plcInitRecordLongin,
     s7plcGetInIntInfo,
-    s7plcReadLongin
+    S7PLC_PROBE_FN(s7plcReadLongin)
 };
 
 epicsExportAddress(dset, s7plcLongin);
@@ -183,6 +248,7 @@ epicsExportAddress(dset, s7plcLongin);
 
 STATIC long s7plcInitRecordLongout(longoutRecord *);
 STATIC long s7plcWriteLongout(longoutRecord *);
+S7PLC_PROBED(write, s7plcWriteLongout, longoutRecord)
 
 struct devsup s7plcLongout =
 {
@@ -191,7 +257,7 @@ struct devsup s7plcLongout =
     NULL,
     s7plcInitRecordLongout,
     s7plcGetOutIntInfo,
-    s7plcWriteLongout
+    S7PLC_PROBE_FN(s7plcWriteLongout)
 };
 
 epicsExportAddress(dset, s7plcLongout);
@@ -200,6 +266,7 @@ epicsExportAddress(dset, s7plcLongout);
 
 STATIC long s7plcInitRecordAi(aiRecord *);
 STATIC long s7plcReadAi(aiRecord *);
+S7PLC_PROBED(read, s7plcReadAi, aiRecord)
 STATIC long s7plcSpecialLinconvAi(aiRecord *, int after);
 
 struct {
@@ -217,7 +284,7 @@ struct {
     NULL,
     s7plcInitRecordAi,
     s7plcGetInIntInfo,
-    s7plcReadAi,
+    S7PLC_PROBE_FN(s7plcReadAi),
     s7plcSpecialLinconvAi
 };
 
@@ -227,6 +294,7 @@ epicsExportAddress(dset, s7plcAi);
 
 STATIC long s7plcInitRecordAo(aoRecord *);
 STATIC long s7plcWriteAo(aoRecord *);
+S7PLC_PROBED(write, s7plcWriteAo, aoRecord)
 STATIC long s7plcSpecialLinconvAo(aoRecord *, int after);
 
 struct {
@@ -244,7 +312,7 @@ struct {
     NULL,
     s7plcInitRecordAo,
     s7plcGetOutIntInfo,
-    s7plcWriteAo,
+    S7PLC_PROBE_FN(s7plcWriteAo),
     s7plcSpecialLinconvAo
 };
 
@@ -254,6 +322,7 @@ epicsExportAddress(dset, s7plcAo);
 
 STATIC long s7plcInitRecordStringin(stringinRecord *);
 STATIC long s7plcReadStringin(stringinRecord *);
+S7PLC_PROBED(read, s7plcReadStringin, stringinRecord)
 
 struct devsup s7plcStringin =
 {
@@ -262,7 +331,7 @@ struct devsup s7plcStringin =
     NULL,
     s7plcInitRecordStringin,
     s7plcGetInIntInfo,
-    s7plcReadStringin
+    S7PLC_PROBE_FN(s7plcReadStringin)
 };
 
 epicsExportAddress(dset, s7plcStringin);
@@ -271,6 +340,7 @@ epicsExportAddress(dset, s7plcStringin);
 
 STATIC long s7plcInitRecordStringout(stringoutRecord *);
 STATIC long s7plcWriteStringout(stringoutRecord *);
+S7PLC_PROBED(write, s7plcWriteStringout, stringoutRecord)
 
 struct devsup s7plcStringout =
 {
@@ -279,7 +349,7 @@ struct devsup s7plcStringout =
     NULL,
     s7plcInitRecordStringout,
     s7plcGetOutIntInfo,
-    s7plcWriteStringout
+    S7PLC_PROBE_FN(s7plcWriteStringout)
 };
 
 epicsExportAddress(dset, s7plcStringout);
@@ -288,6 +358,7 @@ epicsExportAddress(dset, s7plcStringout);
 
 STATIC long s7plcInitRecordWaveform(waveformRecord *);
 STATIC long s7plcReadWaveform(waveformRecord *);
+S7PLC_PROBED(read, s7plcReadWaveform, waveformRecord)
 
 struct devsup s7plcWaveform =
 {
@@ -296,7 +367,7 @@ struct devsup s7plcWaveform =
     NULL,
     s7plcInitRecordWaveform,
     s7plcGetInIntInfo,
-    s7plcReadWaveform
+    S7PLC_PROBE_FN(s7plcReadWaveform)
 };
 
 epicsExportAddress(dset, s7plcWaveform);
@@ -305,6 +376,7 @@ epicsExportAddress(dset, s7plcWaveform);
 
 STATIC long s7plcInitRecordAai(aaiRecord *);
 STATIC long s7plcReadAai(aaiRecord *);
+S7PLC_PROBED(read, s7plcReadAai, aaiRecord)
 
 struct devsup s7plcAai =
 {
@@ -313,7 +385,7 @@ struct devsup s7plcAai =
     NULL,
     s7plcInitRecordAai,
     s7plcGetInIntInfo,
-    s7plcReadAai
+    S7PLC_PROBE_FN(s7plcReadAai)
 };
 
 epicsExportAddress(dset, s7plcAai);
@@ -322,6 +394,7 @@ epicsExportAddress(dset, s7plcAai);
 
 STATIC long s7plcInitRecordAao(aaoRecord *);
 STATIC long s7plcWriteAao(aaoRecord *);
+S7PLC_PROBED(write, s7plcWriteAao, aaoRecord)
 
 struct devsup s7plcAao =
 {
@@ -330,7 +403,7 @@ struct devsup s7plcAao =
     NULL,
     s7plcInitRecordAao,
     s7plcGetInIntInfo,
-    s7plcWriteAao
+    S7PLC_PROBE_FN(s7plcWriteAao)
 };
 
 epicsExportAddress(dset, s7plcAao);
@@ -339,6 +412,7 @@ epicsExportAddress(dset, s7plcAao);
 
 STATIC long s7plcInitRecordCalcout(calcoutRecord *);
 STATIC long s7plcWriteCalcout(calcoutRecord *);
+S7PLC_PROBED(write, s7plcWriteCalcout, calcoutRecord)
 
 struct {
     long number;
@@ -354,7 +428,7 @@ struct {
     NULL,
     s7plcInitRecordCalcout,
     s7plcGetOutIntInfo,
-    s7plcWriteCalcout,
+    S7PLC_PROBE_FN(s7plcWriteCalcout),
     NULL
 };
 
@@ -371,7 +445,23 @@ long s7plcGetInIntInfo(int cmd, dbCommon *record, IOSCANPVT *ppvt)
             "s7plcGetInIntInfo: uninitialized record");
         return -1;
     }
-    *ppvt = s7plcGetInScanPvt(p->station);
+    *ppvt = s7plcGetInScanPvtRange(p->station, p->offs,
+        p->dlen * (p->nelem ? p->nelem : 1), -1);
+    return 0;
+}
+
+/*********  Support for "I/O Intr" for single bit input records ******/
+
+long s7plcGetBitInIntInfo(int cmd, dbCommon *record, IOSCANPVT *ppvt)
+{
+    S7memPrivate_t* p = record->dpvt;
+    if (p == NULL)
+    {
+        recGblRecordError(S_db_badField, record,
+            "s7plcGetBitInIntInfo: uninitialized record");
+        return -1;
+    }
+    *ppvt = s7plcGetInScanPvtRange(p->station, p->offs, p->dlen, p->bit);
     return 0;
 }
 
@@ -390,6 +480,44 @@ long s7plcGetOutIntInfo(int cmd, dbCommon *record, IOSCANPVT *ppvt)
     return 0;
 }
 
+/*********  Scalar input values decoded once per frame *************/
+
+void s7plcInitChannel(S7memPrivate_t *priv, int unsign)
+{
+    switch (priv->dtype)
+    {
+        case menuFtypeCHAR:
+            priv->kind = unsign ? S7PLC_UINT8 : S7PLC_INT8;
+            break;
+        case menuFtypeUCHAR:
+            priv->kind = S7PLC_UINT8;
+            break;
+        case menuFtypeSHORT:
+            priv->kind = unsign ? S7PLC_UINT16 : S7PLC_INT16;
+            break;
+        case menuFtypeUSHORT:
+            priv->kind = S7PLC_UINT16;
+            break;
+        case menuFtypeLONG:
+            priv->kind = unsign ? S7PLC_UINT32 : S7PLC_INT32;
+            break;
+        case menuFtypeULONG:
+            priv->kind = S7PLC_UINT32;
+            break;
+        case menuFtypeFLOAT:
+            priv->kind = S7PLC_FLOAT32;
+            break;
+        case menuFtypeDOUBLE:
+            priv->kind = S7PLC_FLOAT64;
+            break;
+        default:
+            priv->kind = -1;
+            priv->channel = -1;
+            return;
+    }
+    priv->channel = s7plcAddChannel(priv->station, priv->offs, priv->kind);
+}
+
 /***********************************************************************
  *   Routine to parse IO arguments
  *   IO address line format:
@@ -576,6 +704,7 @@ int s7plcIoParse(char* recordName, char *par, S7memPrivate_t *priv)
                     p = 0;
                     break;
                 }
+                /* fall through */
             default:
                 errlogSevPrintf(errlogFatal,
                     "s7plcIoParse %s: unknown parameter '%c'\n",
@@ -666,6 +795,8 @@ int s7plcIoParse(char* recordName, char *par, S7memPrivate_t *priv)
         return status;
     }
 
+    priv->read = s7plcGetReadFunc(priv->station, priv->offs, priv->dlen);
+    priv->write = s7plcGetWriteFunc(priv->station, priv->offs, priv->dlen);
     return 0;
 }
 
@@ -706,8 +837,14 @@ STATIC long s7plcInitRecordAddr(stringoutRecord *record)
 STATIC long s7plcWriteAddr(stringoutRecord *record)
 {
     S7memPrivate_t *priv = (S7memPrivate_t *)record->dpvt;
-    s7plcSetAddr(priv->station, record->val);
-    return 0;
+    int status;
+
+    status = s7plcSetAddr(priv->station, record->val);
+    if (status)
+    {
+        recGblSetSevr(record, WRITE_ALARM, INVALID_ALARM);
+    }
+    return status;
 }
 
 /* bi for status bit ************************************************/
@@ -739,6 +876,20 @@ STATIC long s7plcInitRecordStat(biRecord *record)
 }
 
 
+STATIC long s7plcGetStatIntInfo(int cmd, dbCommon *record, IOSCANPVT *ppvt)
+{
+    S7memPrivate_t* p = record->dpvt;
+    if (p == NULL)
+    {
+        recGblRecordError(S_db_badField, record,
+            "s7plcGetStatIntInfo: uninitialized record");
+        return -1;
+    }
+    /* connection status is updated with every frame */
+    *ppvt = s7plcGetInScanPvt(p->station);
+    return 0;
+}
+
 STATIC long s7plcReadStat(biRecord *record)
 {
     int status;
@@ -769,6 +920,201 @@ STATIC long s7plcReadStat(biRecord *record)
     return 0;
 }
 
+/* ai and longin for performance counters ***************************/
+
+/*
+ * Parses INP "@PLCname/item" of counter and latency records.
+ * Returns the private structure and item, or NULL.
+ */
+STATIC S7memPrivate_t* s7plcParseStats(dbCommon *record, char *par, char **item)
+{
+    S7memPrivate_t *priv;
+    char devName[255];
+    char *p = par;
+    size_t nchar;
+
+    while (!isalnum((unsigned char)*p))
+        if (*p++ == '\0') break;
+    nchar = strcspn(p, "/");
+    if (nchar >= sizeof(devName) || p[nchar] != '/')
+    {
+        errlogSevPrintf(errlogFatal,
+            "s7plcParseStats %s: expect \"PLCname/item\"\n",
+            record->name);
+        return NULL;
+    }
+    strncpy(devName, p, nchar);
+    devName[nchar] = '\0';
+    p += nchar + 1;
+    priv = (S7memPrivate_t *)callocMustSucceed(1, sizeof(S7memPrivate_t),
+        "s7plcParseStats");
+    priv->station = s7plcOpen(devName);
+    if (!priv->station)
+    {
+        errlogSevPrintf(errlogFatal, "s7plcParseStats %s: device not found\n",
+            record->name);
+        free(priv);
+        return NULL;
+    }
+    nchar = strcspn(p, " \t");
+    p[nchar] = '\0';
+    *item = p;
+    return priv;
+}
+
+STATIC long s7plcInitStats(dbCommon *record, char *par)
+{
+    S7memPrivate_t *priv;
+    char *counter;
+
+    priv = s7plcParseStats(record, par, &counter);
+    if (!priv) return S_db_badField;
+    priv->channel = s7plcStatIndex(counter);
+    if (priv->channel < 0)
+    {
+        errlogSevPrintf(errlogFatal, "s7plcInitStats %s: unknown counter %s\n",
+            record->name, counter);
+        free(priv);
+        return S_db_badField;
+    }
+    record->dpvt = priv;
+    return 0;
+}
+
+STATIC long s7plcInitRecordStatsAi(aiRecord *record)
+{
+    if (record->inp.type != INST_IO)
+    {
+        recGblRecordError(S_db_badField, record,
+            "s7plcInitRecordStatsAi: illegal INP field type");
+        return S_db_badField;
+    }
+    return s7plcInitStats((dbCommon *)record, record->inp.value.instio.string);
+}
+
+STATIC long s7plcReadStatsAi(aiRecord *record)
+{
+    S7memPrivate_t *priv = (S7memPrivate_t *)record->dpvt;
+    double value;
+
+    if (!priv)
+    {
+        recGblSetSevr(record, UDF_ALARM, INVALID_ALARM);
+        errlogSevPrintf(errlogFatal,
+            "%s: not initialized\n", record->name);
+        return -1;
+    }
+    s7plcGetStat(priv->station, priv->channel, &value);
+    record->val = value;
+    record->udf = FALSE;
+    return 2; /* don't convert */
+}
+
+STATIC long s7plcInitRecordStatsLongin(longinRecord *record)
+{
+    if (record->inp.type != INST_IO)
+    {
+        recGblRecordError(S_db_badField, record,
+            "s7plcInitRecordStatsLongin: illegal INP field type");
+        return S_db_badField;
+    }
+    return s7plcInitStats((dbCommon *)record, record->inp.value.instio.string);
+}
+
+STATIC long s7plcReadStatsLongin(longinRecord *record)
+{
+    S7memPrivate_t *priv = (S7memPrivate_t *)record->dpvt;
+    double value;
+
+    if (!priv)
+    {
+        recGblSetSevr(record, UDF_ALARM, INVALID_ALARM);
+        errlogSevPrintf(errlogFatal,
+            "%s: not initialized\n", record->name);
+        return -1;
+    }
+    s7plcGetStat(priv->station, priv->channel, &value);
+    /* times are truncated, use ai records for those */
+    record->val = (epicsInt32)(unsigned long)value;
+    return 0;
+}
+
+/* waveform for latency histograms **********************************/
+
+#define S7PLC_LATENCY_IN     0
+#define S7PLC_LATENCY_OUT    1
+#define S7PLC_LATENCY_LIMITS 2
+
+/* INP is "@PLCname/in", "@PLCname/out" or "@PLCname/limits" */
+STATIC long s7plcInitRecordLatency(waveformRecord *record)
+{
+    S7memPrivate_t *priv;
+    char *item;
+
+    if (record->inp.type != INST_IO)
+    {
+        recGblRecordError(S_db_badField, record,
+            "s7plcInitRecordLatency: illegal INP field type");
+        return S_db_badField;
+    }
+    priv = s7plcParseStats((dbCommon *)record,
+        record->inp.value.instio.string, &item);
+    if (!priv) return S_db_badField;
+    if (strcmp(item, "in") == 0)
+        priv->channel = S7PLC_LATENCY_IN;
+    else if (strcmp(item, "out") == 0)
+        priv->channel = S7PLC_LATENCY_OUT;
+    else if (strcmp(item, "limits") == 0)
+        priv->channel = S7PLC_LATENCY_LIMITS;
+    else
+    {
+        errlogSevPrintf(errlogFatal,
+            "s7plcInitRecordLatency %s: unknown histogram %s\n",
+            record->name, item);
+        free(priv);
+        return S_db_badField;
+    }
+    if (priv->channel == S7PLC_LATENCY_LIMITS ?
+        record->ftvl != DBF_DOUBLE :
+        record->ftvl != DBF_LONG && record->ftvl != DBF_ULONG)
+    {
+        errlogSevPrintf(errlogFatal,
+            "s7plcInitRecordLatency %s: illegal FTVL, use %s\n",
+            record->name,
+            priv->channel == S7PLC_LATENCY_LIMITS ? "DOUBLE" : "LONG or ULONG");
+        free(priv);
+        return S_db_badField;
+    }
+    record->dpvt = priv;
+    return 0;
+}
+
+STATIC long s7plcReadLatency(waveformRecord *record)
+{
+    S7memPrivate_t *priv = (S7memPrivate_t *)record->dpvt;
+    unsigned int i, n;
+
+    if (!priv)
+    {
+        recGblSetSevr(record, UDF_ALARM, INVALID_ALARM);
+        errlogSevPrintf(errlogFatal,
+            "%s: not initialized\n", record->name);
+        return -1;
+    }
+    n = record->nelm < S7PLC_LATENCY_BUCKETS ? record->nelm : S7PLC_LATENCY_BUCKETS;
+    if (priv->channel == S7PLC_LATENCY_LIMITS)
+    {
+        /* lower limit of each bucket in seconds */
+        for (i = 0; i < n; i++)
+            ((epicsFloat64 *)record->bptr)[i] = s7plcLatencyLimit(i);
+    }
+    else
+        n = s7plcGetLatency(priv->station, priv->channel == S7PLC_LATENCY_OUT,
+            record->bptr, n);
+    record->nord = n;
+    return 0;
+}
+
 /* bi ***************************************************************/
 
 STATIC long s7plcInitRecordBi(biRecord *record)
@@ -813,6 +1159,7 @@ STATIC long s7plcInitRecordBi(biRecord *record)
             return S_db_badField;
     }
     record->mask = 1 << priv->bit;
+    s7plcInitChannel(priv, TRUE);
     record->dpvt = priv;
     return 0;
 }
@@ -821,9 +1168,7 @@ STATIC long s7plcReadBi(biRecord *record)
 {
     int status;
     S7memPrivate_t *priv = (S7memPrivate_t *)record->dpvt;
-    epicsUInt8 rval8;
-    epicsUInt16 rval16;
-    epicsUInt32 rval32;
+    s7plcValue value;
 #ifdef DBR_INT64
     epicsUInt64 rval64, mask64;
 #endif
@@ -840,32 +1185,20 @@ STATIC long s7plcReadBi(biRecord *record)
     {
         case menuFtypeCHAR:
         case menuFtypeUCHAR:
-            status = s7plcRead(priv->station, priv->offs,
-                1, &rval8);
-            s7plcDebugLog(3, "bi %s: read 8bit %02x\n",
-                record->name, rval8);
-            record->rval = (epicsUInt32)rval8 & record->mask;
-            break;
         case menuFtypeSHORT:
         case menuFtypeUSHORT:
-            status = s7plcRead(priv->station, priv->offs,
-                2, &rval16);
-            s7plcDebugLog(3, "bi %s: read 16bit %04x\n",
-                record->name, rval16);
-            record->rval = (epicsUInt32)rval16 & record->mask;
-            break;
         case menuFtypeLONG:
         case menuFtypeULONG:
-            status = s7plcRead(priv->station, priv->offs,
-                4, &rval32);
-            s7plcDebugLog(3, "bi %s: read 32bit %04x\n",
-                record->name, rval32);
-            record->rval = rval32 & record->mask;
+            status = s7plcReadValue(priv->station, priv->channel,
+                priv->offs, priv->kind, &value);
+            s7plcDebugLog(3, "bi %s: read %dbit %0*x\n",
+                record->name, priv->dlen*8, priv->dlen*2, value.u);
+            record->rval = value.u & record->mask;
             break;
 #ifdef DBR_INT64
         case menuFtypeINT64:
         case menuFtypeUINT64:
-            status = s7plcRead(priv->station, priv->offs,
+            status = s7plcReadPriv(priv,
                 8, &rval64);
             s7plcDebugLog(3, "bi %s: read 64bit "CONV64"\n",
                 record->name, rval64);
@@ -939,6 +1272,7 @@ STATIC long s7plcInitRecordBo(boRecord *record)
             return S_db_badField;
     }
     record->mask = 1 << priv->bit;
+    priv->writeMasked = s7plcGetWriteMaskedFunc(priv->station, priv->offs, priv->dlen);
     record->dpvt = priv;
     return 2; /* preserve whatever is in the VAL field */
 }
@@ -970,7 +1304,7 @@ STATIC long s7plcWriteBo(boRecord *record)
             mask8 = record->mask;
             s7plcDebugLog(2, "bo %s: write 8bit %02x mask %02x\n",
                 record->name, rval8, mask8);
-            status = s7plcWriteMasked(priv->station, priv->offs,
+            status = s7plcWriteMaskedPriv(priv,
                 1, &rval8, &mask8);
             break;
         case menuFtypeSHORT:
@@ -979,7 +1313,7 @@ STATIC long s7plcWriteBo(boRecord *record)
             mask16 = record->mask;
             s7plcDebugLog(2, "bo %s: write 16bit %04x mask %04x\n",
                 record->name, rval16, mask16);
-            status = s7plcWriteMasked(priv->station, priv->offs,
+            status = s7plcWriteMaskedPriv(priv,
                 2, &rval16, &mask16);
             break;
         case menuFtypeLONG:
@@ -988,7 +1322,7 @@ STATIC long s7plcWriteBo(boRecord *record)
             mask32 = record->mask;
             s7plcDebugLog(2, "bo %s: write 32bit %08x mask %08x\n",
                 record->name, rval32, mask32);
-            status = s7plcWriteMasked(priv->station, priv->offs,
+            status = s7plcWriteMaskedPriv(priv,
                 4, &rval32, &mask32);
             break;
 #ifdef DBR_INT64
@@ -999,7 +1333,7 @@ STATIC long s7plcWriteBo(boRecord *record)
             else rval64 = mask64;
             s7plcDebugLog(2, "bo %s: write 64bit "CONV64" mask "CONV64"\n",
                 record->name, rval64, mask64);
-            status = s7plcWriteMasked(priv->station, priv->offs,
+            status = s7plcWriteMaskedPriv(priv,
                 8, &rval64, &mask64);
             break;
 #endif
@@ -1086,7 +1420,7 @@ STATIC long s7plcReadMbbi(mbbiRecord *record)
     {
         case menuFtypeCHAR:
         case menuFtypeUCHAR:
-            status = s7plcRead(priv->station, priv->offs,
+            status = s7plcReadPriv(priv,
                 1, &rval8);
             s7plcDebugLog(3, "mbbi %s: read 8bit %02x\n",
                 record->name, rval8);
@@ -1094,7 +1428,7 @@ STATIC long s7plcReadMbbi(mbbiRecord *record)
             break;
         case menuFtypeSHORT:
         case menuFtypeUSHORT:
-            status = s7plcRead(priv->station, priv->offs,
+            status = s7plcReadPriv(priv,
                 2, &rval16);
             s7plcDebugLog(3, "mbbi %s: read 16bit %04x\n",
                 record->name, rval16);
@@ -1102,7 +1436,7 @@ STATIC long s7plcReadMbbi(mbbiRecord *record)
             break;
         case menuFtypeLONG:
         case menuFtypeULONG:
-            status = s7plcRead(priv->station, priv->offs,
+            status = s7plcReadPriv(priv,
                 4, &rval32);
             s7plcDebugLog(3, "mbbi %s: read 32bit %04x\n",
                 record->name, rval32);
@@ -1168,6 +1502,7 @@ STATIC long s7plcInitRecordMbbo(mbboRecord *record)
                 record->name);
             return S_db_badField;
     }
+    priv->writeMasked = s7plcGetWriteMaskedFunc(priv->station, priv->offs, priv->dlen);
     record->dpvt = priv;
     return 2; /* preserve whatever is in the VAL field */
 }
@@ -1196,7 +1531,7 @@ STATIC long s7plcWriteMbbo(mbboRecord *record)
             mask8 = record->mask;
             s7plcDebugLog(2, "mbbo %s: write 8bit %02x mask %02x\n",
                 record->name, rval8, mask8);
-            status = s7plcWriteMasked(priv->station, priv->offs,
+            status = s7plcWriteMaskedPriv(priv,
                 1, &rval8, &mask8);
             break;
         case menuFtypeSHORT:
@@ -1205,7 +1540,7 @@ STATIC long s7plcWriteMbbo(mbboRecord *record)
             mask16 = record->mask;
             s7plcDebugLog(2, "mbbo %s: write 16bit %04x mask %04x\n",
                 record->name, rval16, mask16);
-            status = s7plcWriteMasked(priv->station, priv->offs,
+            status = s7plcWriteMaskedPriv(priv,
                 2, &rval16, &mask16);
             break;
         case menuFtypeLONG:
@@ -1214,7 +1549,7 @@ STATIC long s7plcWriteMbbo(mbboRecord *record)
             mask32 = record->mask;
             s7plcDebugLog(2, "mbbo %s: write 32bit %08x mask %08x\n",
                 record->name, rval32, mask32);
-            status = s7plcWriteMasked(priv->station, priv->offs,
+            status = s7plcWriteMaskedPriv(priv,
                 4, &rval32, &mask32);
             break;
         default:
@@ -1300,7 +1635,7 @@ STATIC long s7plcReadMbbiDirect(mbbiDirectRecord *record)
     {
         case menuFtypeCHAR:
         case menuFtypeUCHAR:
-            status = s7plcRead(priv->station, priv->offs,
+            status = s7plcReadPriv(priv,
                 1, &rval8);
             s7plcDebugLog(3, "mbbiDirect %s: read 8bit %02x\n",
                 record->name, rval8);
@@ -1308,7 +1643,7 @@ STATIC long s7plcReadMbbiDirect(mbbiDirectRecord *record)
             break;
         case menuFtypeSHORT:
         case menuFtypeUSHORT:
-            status = s7plcRead(priv->station, priv->offs,
+            status = s7plcReadPriv(priv,
                 2, &rval16);
             s7plcDebugLog(3, "mbbiDirect %s: read 16bit %04x\n",
                 record->name, rval16);
@@ -1316,7 +1651,7 @@ STATIC long s7plcReadMbbiDirect(mbbiDirectRecord *record)
             break;
         case menuFtypeLONG:
         case menuFtypeULONG:
-            status = s7plcRead(priv->station, priv->offs,
+            status = s7plcReadPriv(priv,
                 4, &rval32);
             s7plcDebugLog(3, "mbbiDirect %s: read 32bit %08x\n",
                 record->name, rval32);
@@ -1382,6 +1717,7 @@ STATIC long s7plcInitRecordMbboDirect(mbboDirectRecord *record)
                 record->name);
             return S_db_badField;
     }
+    priv->writeMasked = s7plcGetWriteMaskedFunc(priv->station, priv->offs, priv->dlen);
     record->dpvt = priv;
     return 2; /* preserve whatever is in the VAL field */
 }
@@ -1410,7 +1746,7 @@ STATIC long s7plcWriteMbboDirect(mbboDirectRecord *record)
             mask8 = record->mask;
             s7plcDebugLog(2, "mbboDirect %s: write 8bit %02x mask %02x\n",
                 record->name, rval8, mask8);
-            status = s7plcWriteMasked(priv->station, priv->offs,
+            status = s7plcWriteMaskedPriv(priv,
                 1, &rval8, &mask8);
             break;
         case menuFtypeSHORT:
@@ -1419,7 +1755,7 @@ STATIC long s7plcWriteMbboDirect(mbboDirectRecord *record)
             mask16 = record->mask;
             s7plcDebugLog(2, "mbboDirect %s: write 16bit %04x mask %04x\n",
                 record->name, rval16, mask16);
-            status = s7plcWriteMasked(priv->station, priv->offs,
+            status = s7plcWriteMaskedPriv(priv,
                 2, &rval16, &mask16);
             break;
         case menuFtypeLONG:
@@ -1428,7 +1764,7 @@ STATIC long s7plcWriteMbboDirect(mbboDirectRecord *record)
             mask32 = record->mask;
             s7plcDebugLog(2, "mbboDirect %s: write 32bit %08x mask %08x\n",
                 record->name, rval32, mask32);
-            status = s7plcWriteMasked(priv->station, priv->offs,
+            status = s7plcWriteMaskedPriv(priv,
                 4, &rval32, &mask32);
             break;
         default:
@@ -1488,6 +1824,7 @@ STATIC long s7plcInitRecordLongin(longinRecord *record)
                 record->name);
             return S_db_badField;
     }
+    s7plcInitChannel(priv, FALSE);
     record->dpvt = priv;
     return 0;
 }
@@ -1496,12 +1833,7 @@ STATIC long s7plcReadLongin(longinRecord *record)
 {
     int status;
     S7memPrivate_t *priv = (S7memPrivate_t *)record->dpvt;
-    signed char sval8;
-    epicsUInt8 uval8;
-    epicsInt16 sval16;
-    epicsUInt16 uval16;
-    epicsInt32 sval32;
-    epicsUInt32 uval32;
+    s7plcValue value;
 
     if (!priv)
     {
@@ -1511,57 +1843,19 @@ STATIC long s7plcReadLongin(longinRecord *record)
         return -1;
     }
     assert(priv->station);
-    switch (priv->dtype)
+    if (priv->kind < 0)
     {
-        case menuFtypeCHAR:
-            status = s7plcRead(priv->station, priv->offs,
-                1, &sval8);
-            s7plcDebugLog(3, "longin %s: read 8bit %02x\n",
-                record->name, sval8);
-            record->val = sval8;
-            break;
-        case menuFtypeUCHAR:
-            status = s7plcRead(priv->station, priv->offs,
-                1, &uval8);
-            s7plcDebugLog(3, "longin %s: read 8bit %02x\n",
-                record->name, uval8);
-            record->val = uval8;
-            break;
-        case menuFtypeSHORT:
-            status = s7plcRead(priv->station, priv->offs,
-                2, &sval16);
-            s7plcDebugLog(3, "longin %s: read 16bit %04x\n",
-                record->name, sval16);
-            record->val = sval16;
-            break;
-        case menuFtypeUSHORT:
-            status = s7plcRead(priv->station, priv->offs,
-                2, &uval16);
-            s7plcDebugLog(3, "longin %s: read 16bit %04x\n",
-                record->name, uval16);
-            record->val = uval16;
-            break;
-        case menuFtypeLONG:
-            status = s7plcRead(priv->station, priv->offs,
-                4, &sval32);
-            s7plcDebugLog(3, "longin %s: read 32bit %04x\n",
-                record->name, sval32);
-            record->val = sval32;
-            break;
-        case menuFtypeULONG:
-            status = s7plcRead(priv->station, priv->offs,
-                4, &uval32);
-            s7plcDebugLog(3, "longin %s: read 32bit %04x\n",
-                record->name, uval32);
-            record->val = uval32;
-            break;
-        default:
-            recGblSetSevr(record, COMM_ALARM, INVALID_ALARM);
-            errlogSevPrintf(errlogFatal,
-                "%s: unexpected data type requested\n",
-                record->name);
-            return -1;
+        recGblSetSevr(record, COMM_ALARM, INVALID_ALARM);
+        errlogSevPrintf(errlogFatal,
+            "%s: unexpected data type requested\n",
+            record->name);
+        return -1;
     }
+    status = s7plcReadValue(priv->station, priv->channel,
+        priv->offs, priv->kind, &value);
+    s7plcDebugLog(3, "longin %s: read %dbit %0*x\n",
+        record->name, priv->dlen*8, priv->dlen*2, value.u);
+    record->val = value.i;
     if (status == S_dev_noDevice)
     {
         recGblSetSevr(record, COMM_ALARM, INVALID_ALARM);
@@ -1641,7 +1935,7 @@ STATIC long s7plcWriteLongout(longoutRecord *record)
             rval8 = record->val;
             s7plcDebugLog(2, "longout %s: write 8bit %02x\n",
                 record->name, rval8);
-            status = s7plcWrite(priv->station, priv->offs,
+            status = s7plcWritePriv(priv,
                 1, &rval8);
             break;
         case menuFtypeSHORT:
@@ -1649,7 +1943,7 @@ STATIC long s7plcWriteLongout(longoutRecord *record)
             rval16 = record->val;
             s7plcDebugLog(2, "longout %s: write 16bit %04x\n",
                 record->name, rval16);
-            status = s7plcWrite(priv->station, priv->offs,
+            status = s7plcWritePriv(priv,
                 2, &rval16);
             break;
         case menuFtypeLONG:
@@ -1657,7 +1951,7 @@ STATIC long s7plcWriteLongout(longoutRecord *record)
             rval32 = record->val;
             s7plcDebugLog(2, "longout %s: write 32bit %08x\n",
                 record->name, rval32);
-            status = s7plcWrite(priv->station, priv->offs,
+            status = s7plcWritePriv(priv,
                 4, &rval32);
             break;
         default:
@@ -1719,6 +2013,7 @@ STATIC long s7plcInitRecordAi(aiRecord *record)
                 record->name);
             return S_db_badField;
     }
+    s7plcInitChannel(priv, FALSE);
     record->dpvt = priv;
     s7plcSpecialLinconvAi(record, TRUE);
     return 0;
@@ -1728,14 +2023,8 @@ STATIC long s7plcReadAi(aiRecord *record)
 {
     int status, floatval = FALSE;
     S7memPrivate_t *priv = (S7memPrivate_t *)record->dpvt;
-    signed char sval8;
-    unsigned char uval8;
-    epicsInt16 sval16;
-    epicsUInt16 uval16;
-    epicsInt32 sval32;
-    epicsUInt32 uval32;
-    union {epicsFloat32 f; epicsUInt32 i; } val32;
-    union {epicsFloat64 f; epicsUInt64 i; } val64;
+    s7plcValue value;
+    epicsFloat64 fval = 0.0;
 
     if (!priv)
     {
@@ -1744,76 +2033,39 @@ STATIC long s7plcReadAi(aiRecord *record)
         return -1;
     }
     assert(priv->station);
-    switch (priv->dtype)
+    if (priv->kind < 0)
     {
-        case menuFtypeCHAR:
-            status = s7plcRead(priv->station, priv->offs,
-                1, &sval8);
-            s7plcDebugLog(3, "ai %s: read 8bit %02x\n",
-                record->name, sval8);
-            record->rval = sval8;
-            break;
-        case menuFtypeUCHAR:
-            status = s7plcRead(priv->station, priv->offs,
-                1, &uval8);
-            s7plcDebugLog(3, "ai %s: read 8bit %02x\n",
-                record->name, uval8);
-            record->rval = uval8;
-            break;
-        case menuFtypeSHORT:
-            status = s7plcRead(priv->station, priv->offs,
-                2, &sval16);
-            s7plcDebugLog(3, "ai %s: read 16bit %04x\n",
-                record->name, sval16);
-            record->rval = sval16;
-            break;
-        case menuFtypeUSHORT:
-            status = s7plcRead(priv->station, priv->offs,
-                2, &uval16);
-            s7plcDebugLog(3, "ai %s: read 16bit %04x\n",
-                record->name, uval16);
-            record->rval = uval16;
-            break;
-        case menuFtypeLONG:
-            status = s7plcRead(priv->station, priv->offs,
-                4, &sval32);
-            s7plcDebugLog(3, "ai %s: read 32bit %04x\n",
-                record->name, sval32);
-            record->rval = sval32;
-            break;
-        case menuFtypeULONG:
-            status = s7plcRead(priv->station, priv->offs,
-                4, &uval32);
-            s7plcDebugLog(3, "ai %s: read 32bit %04x\n",
-                record->name, uval32);
-            record->rval = uval32;
+        recGblSetSevr(record, COMM_ALARM, INVALID_ALARM);
+        errlogSevPrintf(errlogFatal,
+            "%s: unexpected data type requested\n",
+            record->name);
+        return -1;
+    }
+    status = s7plcReadValue(priv->station, priv->channel,
+        priv->offs, priv->kind, &value);
+    switch (priv->kind)
+    {
+        case S7PLC_UINT32:
+            s7plcDebugLog(3, "ai %s: read 32bit %08x\n",
+                record->name, value.u);
+            record->rval = value.u;
             if (record->linr == 0)
             {
-                val64.f = (epicsFloat64)uval32;
+                fval = (epicsFloat64)value.u;
                 floatval = TRUE;
             }
             break;
-        case menuFtypeFLOAT:
-            status = s7plcRead(priv->station, priv->offs,
-                4, &val32);
-            s7plcDebugLog(3, "ai %s: read 32bit %04x = %g\n",
-                record->name, val32.i, val32.f);
-            val64.f = val32.f;
-            floatval = TRUE;
-            break;
-        case menuFtypeDOUBLE:
-            status = s7plcRead(priv->station, priv->offs,
-                8, &val64);
-            s7plcDebugLog(3, "ai %s: read 64bit "CONV64" = %g\n",
-                record->name, val64.i, val64.f);
+        case S7PLC_FLOAT32:
+        case S7PLC_FLOAT64:
+            s7plcDebugLog(3, "ai %s: read %dbit float %g\n",
+                record->name, priv->dlen*8, value.f);
+            fval = value.f;
             floatval = TRUE;
             break;
         default:
-            recGblSetSevr(record, COMM_ALARM, INVALID_ALARM);
-            errlogSevPrintf(errlogFatal,
-                "%s: unexpected data type requested\n",
-                record->name);
-            return -1;
+            s7plcDebugLog(3, "ai %s: read %dbit %0*x\n",
+                record->name, priv->dlen*8, priv->dlen*2, value.u);
+            record->rval = value.i;
     }
     if (status == S_dev_noDevice)
     {
@@ -1830,14 +2082,14 @@ STATIC long s7plcReadAi(aiRecord *record)
     if (floatval)
     {
         /* emulate scaling */
-        if (record->aslo != 0.0) val64.f *= record->aslo;
-        val64.f += record->aoff;
+        if (record->aslo != 0.0) fval *= record->aslo;
+        fval += record->aoff;
         if (record->udf)
-            record->val = val64.f;
+            record->val = fval;
         else
             /* emulate smoothing */
             record->val = record->val * record->smoo +
-                val64.f * (1.0 - record->smoo);
+                fval * (1.0 - record->smoo);
         record->udf = isnan(record->val);
         return 2;
     }
@@ -1946,7 +2198,7 @@ STATIC long s7plcWriteAo(aoRecord *record)
             rval8 = rval32;
             s7plcDebugLog(2, "ao %s: write 8bit %02x\n",
                 record->name, rval8 & 0xff);
-            status = s7plcWrite(priv->station, priv->offs,
+            status = s7plcWritePriv(priv,
                 1, &rval8);
             break;
         case menuFtypeUCHAR:
@@ -1955,7 +2207,7 @@ STATIC long s7plcWriteAo(aoRecord *record)
             rval8 = rval32;
             s7plcDebugLog(2, "ao %s: write 8bit %02x\n",
                 record->name, rval8 & 0xff);
-            status = s7plcWrite(priv->station, priv->offs,
+            status = s7plcWritePriv(priv,
                 1, &rval8);
             break;
         case menuFtypeSHORT:
@@ -1964,7 +2216,7 @@ STATIC long s7plcWriteAo(aoRecord *record)
             rval16 = rval32;
             s7plcDebugLog(2, "ao %s: write 16bit %04x\n",
                 record->name, rval16 & 0xffff);
-            status = s7plcWrite(priv->station, priv->offs,
+            status = s7plcWritePriv(priv,
                 2, &rval16);
             break;
         case menuFtypeUSHORT:
@@ -1973,7 +2225,7 @@ STATIC long s7plcWriteAo(aoRecord *record)
             rval16 = rval32;
             s7plcDebugLog(2, "ao %s: write 16bit %04x\n",
                 record->name, rval16 & 0xffff);
-            status = s7plcWrite(priv->station, priv->offs,
+            status = s7plcWritePriv(priv,
                 2, &rval16);
             break;
         case menuFtypeLONG:
@@ -1981,7 +2233,7 @@ STATIC long s7plcWriteAo(aoRecord *record)
             if (record->rval < priv->hwLow) rval32 = priv->hwLow;
             s7plcDebugLog(2, "ao %s: write 32bit %08x\n",
                 record->name, rval32);
-            status = s7plcWrite(priv->station, priv->offs,
+            status = s7plcWritePriv(priv,
                 4, &rval32);
             break;
         case menuFtypeULONG:
@@ -1989,7 +2241,7 @@ STATIC long s7plcWriteAo(aoRecord *record)
             if (rval32 < (epicsUInt32)priv->hwLow) rval32 = priv->hwLow;
             s7plcDebugLog(2, "ao %s: write 32bit %08x\n",
                 record->name, rval32);
-            status = s7plcWrite(priv->station, priv->offs,
+            status = s7plcWritePriv(priv,
                 4, &rval32);
             break;
         case menuFtypeFLOAT:
@@ -1998,7 +2250,7 @@ STATIC long s7plcWriteAo(aoRecord *record)
             if (record->aslo != 0) val32.f /= record->aslo;
             s7plcDebugLog(2, "ao %s: write 32bit %08x = %g\n",
                 record->name, val32.i, val32.f);
-            status = s7plcWrite(priv->station, priv->offs,
+            status = s7plcWritePriv(priv,
                 4, &val32);
             break;
         case menuFtypeDOUBLE:
@@ -2007,7 +2259,7 @@ STATIC long s7plcWriteAo(aoRecord *record)
             if (record->aslo != 0) val64.f /= record->aslo;
             s7plcDebugLog(2, "ao %s: write 64bit "CONV64" = %g\n",
                 record->name, val64.i, val64.f);
-            status = s7plcWrite(priv->station, priv->offs,
+            status = s7plcWritePriv(priv,
                 8, &val64);
             break;
         default:
@@ -2247,10 +2499,12 @@ static long s7plcInitRecordArray(dbCommon* record, struct link* iolink, int ftvl
         case DBF_ULONG:
             priv->dtype = menuFtypeULONG;
             priv->dlen = 4;
+            break;
 #ifdef DBR_INT64
         case DBF_INT64:
             priv->dtype = menuFtypeINT64;
             priv->dlen = 8;
+            break;
         case DBF_UINT64:
             priv->dtype = menuFtypeUINT64;
             priv->dlen = 8;
@@ -2279,6 +2533,7 @@ static long s7plcInitRecordArray(dbCommon* record, struct link* iolink, int ftvl
         return S_db_badField;
     }
     assert(priv->station);
+    priv->nelem = priv->dtype == menuFtypeSTRING ? 1 : nelm;
     switch (priv->dtype)
     {
         case S7MEM_TIME:
@@ -2370,6 +2625,38 @@ static unsigned char d2bcd(unsigned char dec)
     return (dec/10) << 4 | dec%10;
 }
 
+/*
+ * Convert arrays between BCD and decimal format with lookup tables.
+ */
+static unsigned char bcd2dTable[256];
+static unsigned char d2bcdTable[256];
+
+static void bcdInitTables()
+{
+    static int done = 0;
+    int i;
+
+    if (done) return;
+    for (i = 0; i < 256; i++)
+    {
+        bcd2dTable[i] = bcd2d(i);
+        d2bcdTable[i] = d2bcd(i);
+    }
+    done = 1;
+}
+
+static void bcd2dArray(unsigned char* dst, const unsigned char* src, unsigned int n)
+{
+    bcdInitTables();
+    while (n--) *dst++ = bcd2dTable[*src++];
+}
+
+static void d2bcdArray(unsigned char* dst, const unsigned char* src, unsigned int n)
+{
+    bcdInitTables();
+    while (n--) *dst++ = d2bcdTable[*src++];
+}
+
 static long s7plcReadRecordArray(dbCommon *record, int nelm, void* bptr)
 {
     int status;
@@ -2400,12 +2687,7 @@ static long s7plcReadRecordArray(dbCommon *record, int nelm, void* bptr)
         record->name, nelm, dlen, bptr);
     if (status) return status;
     if (priv->dtype == S7MEM_TIME)
-    {
-        int i;
-        unsigned char* p = bptr;
-        for (i = 0; i < nelm; i++)
-            p[i] = bcd2d(p[i]);
-    }
+        bcd2dArray(bptr, bptr, nelm);
     return 0;
 }
 
@@ -2474,14 +2756,15 @@ STATIC long s7plcWriteAao(aaoRecord *record)
     assert(priv->station);
     if (priv->dtype == S7MEM_TIME)
     {
-        unsigned int i;
-        unsigned char* p = record->bptr;
-        unsigned char bcd;
-        for (i=0; i < record->nelm; i++)
+        unsigned int i, n;
+        unsigned char bcd[256];
+        for (i = 0; i < record->nelm; i += n)
         {
-            bcd = d2bcd(p[i]);
-            status = s7plcWrite(priv->station, priv->offs,
-                priv->dlen, &bcd);
+            n = record->nelm - i;
+            if (n > sizeof(bcd)) n = sizeof(bcd);
+            d2bcdArray(bcd, (unsigned char*)record->bptr + i, n);
+            status = s7plcWriteArray(priv->station, priv->offs + i,
+                1, n, bcd);
             if (status != 0) break;
         }
     }
@@ -2593,7 +2876,7 @@ STATIC long s7plcWriteCalcout(calcoutRecord *record)
             if (val64.f < priv->hwLow) sval8 = priv->hwLow;
             s7plcDebugLog(2, "calcout %s: write 8bit %02x\n",
                 record->name, sval8 & 0xff);
-            status = s7plcWrite(priv->station, priv->offs,
+            status = s7plcWritePriv(priv,
                 1, &sval8);
             break;
         case menuFtypeUCHAR:
@@ -2602,7 +2885,7 @@ STATIC long s7plcWriteCalcout(calcoutRecord *record)
             if (val64.f < priv->hwLow) uval8 = priv->hwLow;
             s7plcDebugLog(2, "calcout %s: write 8bit %02x\n",
                 record->name, uval8 & 0xff);
-            status = s7plcWrite(priv->station, priv->offs,
+            status = s7plcWritePriv(priv,
                 1, &uval8);
             break;
         case menuFtypeSHORT:
@@ -2611,7 +2894,7 @@ STATIC long s7plcWriteCalcout(calcoutRecord *record)
             if (val64.f < priv->hwLow) sval16 = priv->hwLow;
             s7plcDebugLog(2, "calcout %s: write 16bit %04x\n",
                 record->name, sval16 & 0xffff);
-            status = s7plcWrite(priv->station, priv->offs,
+            status = s7plcWritePriv(priv,
                 2, &sval16);
             break;
         case menuFtypeUSHORT:
@@ -2620,7 +2903,7 @@ STATIC long s7plcWriteCalcout(calcoutRecord *record)
             if (val64.f < priv->hwLow) uval16 = priv->hwLow;
             s7plcDebugLog(2, "calcout %s: write 16bit %04x\n",
                 record->name, uval16 & 0xffff);
-            status = s7plcWrite(priv->station, priv->offs,
+            status = s7plcWritePriv(priv,
                 2, &uval16);
             break;
         case menuFtypeLONG:
@@ -2629,7 +2912,7 @@ STATIC long s7plcWriteCalcout(calcoutRecord *record)
             if (val64.f < priv->hwLow) sval32 = priv->hwLow;
             s7plcDebugLog(2, "calcout %s: write 32bit %08x\n",
                 record->name, sval32);
-            status = s7plcWrite(priv->station, priv->offs,
+            status = s7plcWritePriv(priv,
                 4, &sval32);
             break;
         case menuFtypeULONG:
@@ -2638,20 +2921,20 @@ STATIC long s7plcWriteCalcout(calcoutRecord *record)
             if (val64.f < priv->hwLow) uval32 = priv->hwLow;
             s7plcDebugLog(2, "calcout %s: write 32bit %08x\n",
                 record->name, uval32);
-            status = s7plcWrite(priv->station, priv->offs,
+            status = s7plcWritePriv(priv,
                 4, &uval32);
             break;
         case menuFtypeFLOAT:
             val32.f = val64.f;
             s7plcDebugLog(2, "calcout %s: write 32bit %08x = %g\n",
                 record->name, val32.i, val32.f);
-            status = s7plcWrite(priv->station, priv->offs,
+            status = s7plcWritePriv(priv,
                 4, &val32);
             break;
         case menuFtypeDOUBLE:
             s7plcDebugLog(2, "calcout %s: write 64bit "CONV64" = %g\n",
                 record->name, val64.i, val64.f);
-            status = s7plcWrite(priv->station, priv->offs,
+            status = s7plcWritePriv(priv,
                 8, &val64);
             break;
         default:
@@ -25,13 +25,56 @@ typedef struct {              /* Private structure to save IO arguments */
     unsigned short bit;       /* Bit number (0-15) for bi/bo */
     unsigned short dtype;     /* Data type */
     unsigned short dlen;      /* Data length (in bytes) */
+    unsigned int nelem;       /* Number of array elements */
+    int kind;                 /* Decoded value kind (S7PLC_...) */
+    int channel;              /* Index in decode cache or -1 */
+    s7plcReadFunc read;       /* Specialised accessors or NULL */
+    s7plcWriteFunc write;
+    s7plcWriteMaskedFunc writeMasked;
     epicsInt64 hwLow;         /* Hardware Low limit */
     epicsInt64 hwHigh;        /* Hardware High limit */
 } S7memPrivate_t;
 
+/* Use the accessors selected at init, the generic ones otherwise */
+#define s7plcReadPriv(priv, dlen, pdata) \
+    ((priv)->read ? (priv)->read((priv)->station, (priv)->offs, (pdata)) \
+    : s7plcRead((priv)->station, (priv)->offs, (dlen), (pdata)))
+
+#define s7plcWritePriv(priv, dlen, pdata) \
+    ((priv)->write ? (priv)->write((priv)->station, (priv)->offs, (pdata)) \
+    : s7plcWrite((priv)->station, (priv)->offs, (dlen), (pdata)))
+
+#define s7plcWriteMaskedPriv(priv, dlen, pdata, pmask) \
+    ((priv)->writeMasked ? (priv)->writeMasked((priv)->station, (priv)->offs, (pdata), (pmask)) \
+    : s7plcWriteMasked((priv)->station, (priv)->offs, (dlen), (pdata), (pmask)))
+
+/*
+ * With S7PLC_USDT, the dset calls the record read or write function
+ * through a wrapper with entry and exit probes:
+ *   S7PLC_PROBED(read, s7plcReadAi, aiRecord)
+ *   ... S7PLC_PROBE_FN(s7plcReadAi) in the dset
+ */
+#ifdef S7PLC_USDT
+#define S7PLC_PROBED(dir, fn, rectype) \
+STATIC long fn##Probed(rectype *record) \
+{ \
+    long status; \
+    S7PLC_PROBE1(dir##_entry, (const char*)record->name); \
+    status = fn(record); \
+    S7PLC_PROBE2(dir##_exit, (const char*)record->name, status); \
+    return status; \
+}
+#define S7PLC_PROBE_FN(fn) fn##Probed
+#else
+#define S7PLC_PROBED(dir, fn, rectype)
+#define S7PLC_PROBE_FN(fn) fn
+#endif
+
 int s7plcIoParse(char* recordName, char *parameters, S7memPrivate_t *);
 long s7plcGetInIntInfo(int cmd, dbCommon *record, IOSCANPVT *ppvt);
+long s7plcGetBitInIntInfo(int cmd, dbCommon *record, IOSCANPVT *ppvt);
 long s7plcGetOutIntInfo(int cmd, dbCommon *record, IOSCANPVT *ppvt);
+void s7plcInitChannel(S7memPrivate_t *priv, int unsign);
 
 struct devsup {
     long      number;
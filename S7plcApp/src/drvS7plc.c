@@ -1,6 +1,9 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
+#include <math.h>
+#include <errno.h>
 #include <fcntl.h>
 
 #ifdef _WIN32
@@ -16,6 +19,7 @@
 #else
 #include <netinet/in.h>
 #include <unistd.h>
+#include <time.h>
 #define SOCKFMT "d"
 #define NFDS(fd) fd+1
 #define SOCKERRTYPE int
@@ -37,20 +41,69 @@
 
 #include <osiSock.h>
 #include <dbAccess.h>
+#include <callback.h>
 #include <iocsh.h>
 #include <cantProceed.h>
 #include <epicsMutex.h>
 #include <epicsThread.h>
-#include <epicsTimer.h>
 #include <epicsEvent.h>
 #include <epicsTime.h>
 #include <epicsString.h>
+#include <epicsVersion.h>
 #include <epicsExport.h>
 
+#ifndef VERSION_INT
+#define VERSION_INT(V,R,M,P) ( ((V)<<24) | ((R)<<16) | ((M)<<8) | (P))
+#endif
+#ifndef EPICS_VERSION_INT
+#define EPICS_VERSION_INT VERSION_INT(EPICS_VERSION, EPICS_REVISION, EPICS_MODIFICATION, EPICS_PATCH_LEVEL)
+#endif
+#if EPICS_VERSION_INT >= VERSION_INT(3,15,0,1)
+#include <epicsAtomic.h>
+#define HAVE_ATOMIC
+#endif
+#if EPICS_VERSION_INT >= VERSION_INT(3,15,0,2)
+#define HAVE_SCAN_COMPLETE
+#endif
+#if EPICS_VERSION_INT >= VERSION_INT(7,0,2,0)
+#define HAVE_CALLBACK_STATUS
+#endif
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <linux/sockios.h>
+#define HAVE_EPOLL
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/socket.h>
+#define HAVE_MMAP
+#define HAVE_SOCKETPAIR
+#define HAVE_RECV_WAITALL
+#endif
+
+#ifndef MSG_DONTWAIT
+/* sends may block, s7plcWaitForOutput before each send limits that */
+#define MSG_DONTWAIT 0
+#define S7PLC_BLOCKING_SEND
+#endif
+
 #include "drvS7plc.h"
 
 #define CONNECT_TIMEOUT   5.0  /* connect timeout [s] */
-#define RECONNECT_DELAY  30.0  /* delay before reconnect [s] */
+#define RECONNECT_DELAY  30.0  /* max delay before reconnect [s] */
+#define RESOLVE_TTL      60.0  /* cache resolved host names [s] */
+
+/* after the first failed connect attempt, errors are debug output */
+#if defined __GNUC__ && __GNUC__ < 3
+#define s7plcConnectErrorLog(station, fmt, args...) do{if (!(station)->failedConnects || s7plcDebug >= 1) s7plcErrorLog(fmt , ##args);}while(0)
+#else
+#define s7plcConnectErrorLog(station, fmt, ...) do{if (!(station)->failedConnects || s7plcDebug >= 1) s7plcErrorLog(fmt , ##__VA_ARGS__);}while(0)
+#endif
+#define REACTOR_EVENTS     64  /* max epoll events handled per wakeup */
 
 STATIC long s7plcIoReport(int level);
 STATIC long s7plcInit();
@@ -58,19 +111,55 @@ void s7plcMain();
 STATIC void s7plcSendThread(s7plcStation* station);
 STATIC void s7plcReceiveThread(s7plcStation* station);
 STATIC int s7plcWaitForInput(s7plcStation* station, double timeout);
+STATIC int s7plcWaitForOutput(s7plcStation* station, double timeout);
 STATIC int s7plcConnect(s7plcStation* station);
 STATIC void s7plcCloseConnection(s7plcStation* station);
 STATIC int s7plcCheckConnection(s7plcStation* station);
-STATIC void s7plcSignal(void* event);
+STATIC void s7plcWaitForConnect(s7plcStation* station);
+STATIC double s7plcConnectFailed(s7plcStation* station, double now);
+STATIC double s7plcPeerClosed(s7plcStation* station, double now);
+STATIC int s7plcSocketRecv(s7plcStation* station, SOCKET sock, void* buf, unsigned int size);
+STATIC int s7plcSocketSend(s7plcStation* station, SOCKET sock, const void* buf, unsigned int size);
+STATIC int s7plcSocketPending(s7plcStation* station, SOCKET sock, unsigned long* avail);
+STATIC void s7plcSocketClose(s7plcStation* station, SOCKET sock);
+#ifdef HAVE_RECV_WAITALL
+STATIC int s7plcSocketRecvAll(s7plcStation* station, SOCKET sock, void* buf, unsigned int size);
+STATIC void s7plcSocketSetTimeout(s7plcStation* station, SOCKET sock);
+#else
+#define s7plcSocketRecvAll NULL
+#endif
+STATIC void s7plcTriggerSend(s7plcStation* station);
+STATIC void s7plcSchedule();
+STATIC unsigned char* s7plcInputFrame(s7plcStation* station);
+STATIC void s7plcPublishInput(s7plcStation* station);
+STATIC int s7plcSkipStale(s7plcStation* station, SOCKET sock, unsigned char* recvBuf);
+STATIC int s7plcFetchOutput(s7plcStation* station, char* sendBuf, int force);
+STATIC void s7plcSendDone(s7plcStation* station, double now);
+STATIC void s7plcScanAllInputs(s7plcStation* station);
+STATIC void s7plcScanBegin(s7plcStation* station, double stamp);
+STATIC void s7plcScanRequest(s7plcStation* station, IOSCANPVT scanPvt);
+STATIC void s7plcScanEnd(s7plcStation* station);
+STATIC void s7plcMergeBlocks(s7plcStation* station);
+STATIC void s7plcTakeOutput(s7plcStation* station);
+STATIC void s7plcScanBlocks(s7plcStation* station);
+STATIC void s7plcFramesLost(s7plcStation* station);
+STATIC void s7plcRecordFrame(s7plcStation* station, int direction,
+    const void* data, unsigned int size);
+STATIC void s7plcReplayThread(s7plcStation* station);
+STATIC void s7plcLoopbackThread(s7plcStation* station);
+STATIC void s7plcSelectKernels();
+#ifdef HAVE_EPOLL
+typedef struct s7plcReactor s7plcReactor;
+STATIC int s7plcReactorStart();
+STATIC void s7plcReactorThread(s7plcReactor* reactor);
+STATIC void s7plcReactorReset(s7plcStation* station);
+STATIC void s7plcReactorWake(s7plcStation* station);
+#endif
 s7plcStation* s7plcStationList = NULL;
-static epicsTimerQueueId timerqueue = NULL;
 static short bigEndianIoc;
+static unsigned int reactorShards = 0;
 
-struct {
-    long number;
-    long (*report)();
-    long (*init)();
-} s7plc = {
+struct drvet s7plc = {
     2,
     s7plcIoReport,
     s7plcInit
@@ -79,6 +168,310 @@ epicsExportAddress(drvet, s7plc);
 
 int s7plcDebug = 0;
 epicsExportAddress(int, s7plcDebug);
+int s7plcTrace = 0;
+epicsExportAddress(int, s7plcTrace);
+
+/*
+ * Input frames are triple buffered: the receiver fills one frame while
+ * readers copy from the latest published one. The sequence number is odd
+ * while a frame is being filled, so a reader that was too slow to finish
+ * before the frame got recycled notices it and retries (seqlock).
+ */
+typedef struct s7plcFrame {
+    int seq;
+    unsigned char* data;
+    s7plcValue* values;       /* decoded channels, see s7plcDecodeFrame */
+    unsigned int nvalues;
+    double stamp;             /* s7plcMonotonic() when received */
+} s7plcFrame;
+
+STATIC void s7plcPublishBlocks(s7plcStation* station, s7plcFrame* frame);
+
+/*
+ * Byte range of the input image that "I/O Intr" records are interested in.
+ * With scanOnChange, only the ranges that differ from the previous frame
+ * are triggered.
+ */
+typedef struct s7plcRange {
+    unsigned int offset;
+    unsigned int size;
+    unsigned char mask;       /* bits of interest if size is 1 */
+    unsigned int triggered;   /* frame when last triggered */
+    IOSCANPVT scanPvt;
+} s7plcRange;
+
+/*
+ * Input scans requested for one frame, under scanLock. Each scanIoRequest
+ * adds a completion for every priority it has queued records for, and
+ * the frame is done when all completions have arrived. The callbacks of
+ * one priority run in the order requested, so a completion belongs to
+ * the oldest frame still waiting for that priority.
+ */
+#define S7PLC_SCAN_BATCHES 32
+typedef struct s7plcScanBatch {
+    double stamp;             /* frame published */
+    unsigned int pending[NUM_CALLBACK_PRIORITIES];
+} s7plcScanBatch;
+
+/* Contention on one mutex, updated while holding it */
+typedef struct s7plcLockStats {
+    unsigned long waits;
+    double waitTime;
+} s7plcLockStats;
+
+/*
+ * Performance counters. Each section is written by one thread only (the
+ * receive thread, the send thread or the reactor that owns the station)
+ * or under the lock named. Input scans are also triggered by whichever
+ * thread closes the connection, so they are counted under scanLock.
+ */
+typedef struct s7plcCounters {
+    /* receiver */
+    unsigned long framesIn;
+    unsigned long bytesIn;
+    unsigned long recvCalls;
+    unsigned long partialRecvs;
+    double waitTime;
+    unsigned long periods;
+    double periodMin;
+    double periodMax;
+    double periodSum;
+    double periodSumSq;
+    double lastFrame;
+    unsigned long skippedFrames;
+    /* sender */
+    unsigned long framesOut;
+    unsigned long bytesOut;
+    unsigned long sendCycles;
+    double sendTimeSum;
+    double sendTimeMax;
+    double sendStart;
+    unsigned long outScans;
+    unsigned long sendCalls;
+    unsigned long partialSends;
+    unsigned long cycles;     /* periodic send cycles */
+    double cycleMin;
+    double cycleMax;
+    double cycleSum;
+    double cycleSumSq;
+    double lastCycle;
+    unsigned long sendOverruns;
+    unsigned long sendBlocks; /* sends that found the socket full */
+    double blockedTime;
+    unsigned long sendTimeouts;
+    unsigned long droppedFrames;
+    unsigned long sendQueue;  /* bytes not yet taken by the PLC */
+    unsigned long sendQueueMax;
+    /* outLock */
+    unsigned long bytesCopied;
+    /* connLock */
+    unsigned long connects;
+    unsigned long connectFailures;
+    /* inLock and outLock */
+    s7plcLockStats inLock;
+    s7plcLockStats outLock;
+    /* scanLock, input scans requested and completed */
+    unsigned long inScans;
+    unsigned long scansDone;
+    double scanTimeSum;
+    double scanTimeMax;
+} s7plcCounters;
+
+/*
+ * Latency histogram with logarithmic buckets of microseconds: below
+ * S7PLC_LATENCY_SUB each microsecond has its own bucket, above each
+ * power of two is split into S7PLC_LATENCY_SUB linear buckets (HDR
+ * histogram with 3 significant bits, up to about 2 minutes).
+ */
+#define S7PLC_LATENCY_SUB 8
+
+typedef struct s7plcHistogram {
+    int counts[S7PLC_LATENCY_BUCKETS];
+} s7plcHistogram;
+
+/*
+ * Frame recording file: a header followed by fixed size slots, one per
+ * frame received or sent. Append-only files grow when full, ring files
+ * overwrite the oldest frames. count is updated after the slot has been
+ * written, so a file may be replayed while it is still being recorded.
+ * All fields are in host byte order, see byteOrder.
+ */
+#define S7PLC_RECORD_MAGIC "S7PLCREC"
+#define S7PLC_RECORD_IN  0
+#define S7PLC_RECORD_OUT 1
+
+/* output bytes changed since the last s7plcFetchOutput, under outLock */
+#define s7plcMarkDirty(station, offset, size) do { \
+    if ((offset) < (station)->dirtyStart) (station)->dirtyStart = (offset); \
+    if ((offset)+(size) > (station)->dirtyEnd) (station)->dirtyEnd = (offset)+(size); \
+} while (0)
+
+/* a record write: the first change since the last fetch stamps outStamp */
+#define s7plcMarkWritten(station, offset, size) do { \
+    if ((station)->latency && (station)->dirtyEnd <= (station)->dirtyStart) \
+        (station)->outStamp = s7plcMonotonic(); \
+    s7plcMarkDirty(station, offset, size); \
+} while (0)
+
+/* stations that have no socket */
+#define s7plcIsLocal(station) ((station)->replayFile || (station)->loopback)
+
+/* connected to the PLC, or replaying or looping back without socket */
+#define s7plcIsConnected(station) \
+    ((station)->sock != INVALID_SOCKET || (station)->localConnected)
+
+/* the connection that carries the data of the station is up */
+#define s7plcConnUp(station) \
+    s7plcIsConnected((station)->carrier ? (station)->carrier : (station))
+
+/* the connection that carries the output is up, see sendAddr */
+#define s7plcOutUp(station) \
+    ((station)->sender ? s7plcIsConnected((station)->sender) : s7plcConnUp(station))
+
+/* stations that send their output themselves */
+#define s7plcSends(station) ((station)->outSize && !(station)->sender)
+
+/*
+ * How the receive and send threads talk to the PLC. connect sets
+ * station->sock under connLock like a TCP connect does, all other
+ * functions work on a connected sock and return what the socket calls
+ * would return. configure gets the text after the transport name in
+ * the transport option. recvAll, if not NULL, blocks until size bytes
+ * or recvTimeout and replaces wait and recv in the receive thread.
+ * send must not block, waitOut waits until it can take more data.
+ * connectAsync, if not NULL, lets the reactor drive the station instead
+ * of the threads: it opens a non-blocking stream socket that the reactor
+ * reads with recv and writes with send, and returns the reactor state to
+ * continue in, S7PLC_CONNECTING (EPOLLOUT signals completion),
+ * S7PLC_CONNECTED, S7PLC_RESOLVING (no socket yet) or -1 on error.
+ */
+typedef struct s7plcTransport {
+    const char* name;
+    int (*configure)(s7plcStation* station, const char* args);
+    int (*connect)(s7plcStation* station);
+    int (*wait)(s7plcStation* station, double timeout);
+    int (*waitOut)(s7plcStation* station, double timeout);
+    int (*recv)(s7plcStation* station, SOCKET sock, void* buf, unsigned int size);
+    int (*recvAll)(s7plcStation* station, SOCKET sock, void* buf, unsigned int size);
+    int (*send)(s7plcStation* station, SOCKET sock, const void* buf, unsigned int size);
+    int (*pending)(s7plcStation* station, SOCKET sock, unsigned long* avail);
+    void (*close)(s7plcStation* station, SOCKET sock);
+    int (*connectAsync)(s7plcStation* station, SOCKET* sock, double now);
+} s7plcTransport;
+
+enum {S7PLC_IDLE, S7PLC_RESOLVING, S7PLC_CONNECTING, S7PLC_CONNECTED};
+
+#ifdef HAVE_EPOLL
+STATIC int s7plcTcpConnectAsync(s7plcStation* station, SOCKET* sock, double now);
+#else
+#define s7plcTcpConnectAsync NULL
+#endif
+
+STATIC const s7plcTransport s7plcTcpTransport = {
+    "tcp",
+    NULL,
+    s7plcConnect,
+    s7plcWaitForInput,
+    s7plcWaitForOutput,
+    s7plcSocketRecv,
+    s7plcSocketRecvAll,
+    s7plcSocketSend,
+    s7plcSocketPending,
+    s7plcSocketClose,
+    s7plcTcpConnectAsync
+};
+
+#ifdef HAVE_SOCKETPAIR
+STATIC int s7plcPairConfigure(s7plcStation* station, const char* args);
+STATIC int s7plcPairConnect(s7plcStation* station);
+#ifdef HAVE_EPOLL
+STATIC int s7plcPairConnectAsync(s7plcStation* station, SOCKET* sock, double now);
+#else
+#define s7plcPairConnectAsync NULL
+#endif
+
+/*
+ * In-process transport for tests: connect creates a socket pair, the
+ * other end is taken by the test with s7plcGetPeer.
+ */
+STATIC const s7plcTransport s7plcPairTransport = {
+    "pair",
+    s7plcPairConfigure,
+    s7plcPairConnect,
+    s7plcWaitForInput,
+    s7plcWaitForOutput,
+    s7plcSocketRecv,
+    s7plcSocketRecvAll,
+    s7plcSocketSend,
+    s7plcSocketPending,
+    s7plcSocketClose,
+    s7plcPairConnectAsync
+};
+#endif
+
+STATIC const s7plcTransport* s7plcTransports[] = {
+    &s7plcTcpTransport,
+#ifdef HAVE_SOCKETPAIR
+    &s7plcPairTransport,
+#endif
+    NULL
+};
+
+#define s7plcUseReactor(station) \
+    (!s7plcIsLocal(station) && !(station)->carrier \
+    && (station)->transport->connectAsync)
+
+typedef struct s7plcRecordHeader {
+    char magic[8];
+    epicsUInt32 byteOrder;    /* 0x01020304 */
+    epicsUInt32 headerSize;
+    epicsUInt32 slotSize;
+    epicsUInt32 inSize;
+    epicsUInt32 outSize;
+    epicsUInt32 ring;
+    epicsUInt32 slots;
+    epicsUInt32 reserved;
+    epicsUInt32 countLow;     /* frames written */
+    epicsUInt32 countHigh;
+} s7plcRecordHeader;
+
+typedef struct s7plcRecordSlot {
+    epicsUInt32 secPastEpoch; /* epicsTimeStamp of the frame */
+    epicsUInt32 nsec;
+    epicsUInt32 size;
+    epicsUInt32 direction;    /* S7PLC_RECORD_IN or S7PLC_RECORD_OUT */
+} s7plcRecordSlot;
+
+/*
+ * Loopback mode: sent output bytes are copied back into the input image,
+ * ranges given by s7plcLoopbackMap.
+ */
+#define S7PLC_PATTERN_STATIC  0
+#define S7PLC_PATTERN_COUNTER 1
+#define S7PLC_PATTERN_RANDOM  2
+#define S7PLC_PATTERN_ALL     3
+
+static const char* s7plcPatternNames[] = { "static", "counter", "random", "all" };
+
+/* What to do when the PLC does not take a frame within sendTimeout */
+#define S7PLC_SEND_RECONNECT 0
+#define S7PLC_SEND_DROP      1
+
+static const char* s7plcSendPolicyNames[] = { "reconnect", "drop" };
+
+typedef struct s7plcLoopbackMap {
+    unsigned int inOffset;
+    unsigned int outOffset;
+    unsigned int size;
+} s7plcLoopbackMap;
+
+typedef struct s7plcRecorder {
+    int fd;
+    s7plcRecordHeader* header;  /* mapped file */
+    size_t mapSize;
+    double count;             /* exact up to 2^53 */
+    int full;
+} s7plcRecorder;
 
 struct s7plcStation {
     struct s7plcStation* next;
@@ -87,21 +480,145 @@ struct s7plcStation {
     int serverPort;
     unsigned int inSize;
     unsigned int outSize;
-    unsigned char* inBuffer;
+    s7plcFrame inFrame[3];
+    s7plcFrame* inCurrent;
+    s7plcFrame* inFill;
     unsigned char* outBuffer;
     int swapBytes;
     SOCKET sock;
-    epicsMutexId mutex;
-    epicsMutexId io;
-    epicsTimerId timer;
+    epicsMutexId inLock;      /* ranges, decode plan, input image without atomics */
+    epicsMutexId outLock;     /* output image and outputChanged */
+    epicsMutexId connLock;    /* sock, server address and connecting */
+    epicsMutexId scanLock;    /* input scans in progress and their counters */
+    s7plcScanBatch scanBatches[S7PLC_SCAN_BATCHES]; /* ring, oldest first */
+    unsigned int scanFirst;
+    unsigned int scanCount;
+    s7plcScanBatch* scanBatch; /* being requested, see s7plcScanBegin */
+    int connecting;
+    epicsEventId connEvent;   /* a connect attempt has finished */
+    double reconnectMin;      /* backoff after failed connects */
+    double reconnectMax;
+    double reconnectFactor;
+    double reconnectJitter;   /* +- fraction of the delay */
+    double reconnectDelay;    /* next backoff step */
+    double reconnectTime;     /* next connect attempt */
+    unsigned int reconnectSeed;
+    unsigned long failedConnects; /* since the last connect */
+    double connectedSince;
+    double probeInterval;     /* fixed fast retries instead, 0: off */
+    double probeTimeout;      /* connect timeout of the retries */
+    double resolveTTL;        /* cache resolved names, < 0: forever */
+    char* resolvedHost;
+    struct in_addr resolvedAddr;
+    double resolvedTime;
     epicsEventId outTrigger;
     int outputChanged;
+    unsigned int dirtyStart;  /* see s7plcMarkDirty */
+    unsigned int dirtyEnd;
+    int sendOnWrite;
+    double sendGap;
+    int sendRequest;
     IOSCANPVT inScanPvt;
     IOSCANPVT outScanPvt;
     epicsThreadId sendThread;
     epicsThreadId recvThread;
     double recvTimeout;
     double sendIntervall;
+    double sendPhase;         /* offset in the period, < 0: automatic */
+    double sendDeadline;      /* next periodic send, see s7plcNextDeadline */
+    double sendTimeout;       /* for the PLC to take a frame */
+    int sendPolicy;           /* S7PLC_SEND_RECONNECT or S7PLC_SEND_DROP */
+    unsigned int sendPos;     /* pending frame, sent up to sendPos */
+    unsigned int sendLen;
+    double sendExpire;        /* when the pending frame times out */
+    int sendLate;             /* timeout of the pending frame logged */
+    double blockedSince;      /* socket full since, reactor */
+    int scanOnChange;
+    double heartbeat;
+    int latestFrame;
+    s7plcCounters stats;
+    int latency;
+    s7plcHistogram latencyIn;   /* frame received until record read */
+    s7plcHistogram latencyOut;  /* record written until frame sent */
+    double outStamp;            /* first change since last send, outLock */
+    double sendStamp;           /* outStamp of the frame being sent */
+    s7plcRange* ranges;
+    unsigned int nranges;
+    unsigned int maxranges;
+    int rangesChanged;
+    /* receiver's copy of ranges, indexed by word */
+    s7plcRange* index;
+    unsigned int nindex;
+    unsigned int* wordStart;
+    unsigned int* wordRanges;
+    unsigned int frameCount;
+    int fullScan;
+    epicsTimeStamp lastFullScan;
+    /* decode plan, fixed when the first frame after iocInit arrives */
+    unsigned int* planOffset;
+    unsigned char* planKind;
+    unsigned int nplan;
+    unsigned int maxplan;
+    int planBuilt;
+    /* see s7plcTransport */
+    const s7plcTransport* transport;
+    int pairBufSize;
+    SOCKET pairPeer;          /* pair transport, connLock */
+    /* frame recorder, see s7plcRecordFrame */
+    s7plcRecorder* recorder;
+    epicsMutexId recordLock;
+    unsigned int recordSlots;
+    int recordRing;
+    /* replay or loopback running, instead of sock, connLock */
+    int localConnected;
+    /* replay from a recording instead of connecting */
+    char* replayFile;
+    double replaySpeed;
+    int replayLoop;
+    /* loopback instead of connecting, see s7plcLoopbackThread */
+    int loopback;
+    unsigned char* loopBuf;         /* last frame sent, outLock */
+    s7plcLoopbackMap* loopMap;      /* outLock */
+    unsigned int nloopMap;
+    int loopPattern;
+    unsigned int loopRandom;
+    unsigned int loopSeed;
+    unsigned int loopCounter;
+    double loopPeriod;
+    /* named blocks, see s7plcConfigureBlock */
+    struct s7plcStation* parent;
+    struct s7plcStation* blocks;
+    struct s7plcStation* blockNext;
+    struct s7plcStation* carrier;   /* parent if carried in its frames */
+    unsigned int blockIn;           /* offsets in the parent's frames */
+    unsigned int blockOut;
+    double blockDeadline;           /* next input frame to publish */
+    /* separate output connection, see the sendAddr option */
+    struct s7plcStation* sender;    /* station sending our output */
+    struct s7plcStation* outSource; /* station whose output we send */
+#ifdef HAVE_EPOLL
+    /* reactor mode: state machine driven by the owning shard */
+    s7plcReactor* reactor;
+    unsigned int heapIndex;   /* position in the deadline heap of the shard */
+    double reactorDue;        /* when the shard visits this station next */
+    struct s7plcStation* dueNext;
+    struct s7plcStation* wakeNext;
+    int wakeQueued;           /* on the woken list of the shard */
+    int reactorState;
+    int reactorReset;
+    int resolving;            /* queued for the resolver thread */
+    int resolveFailed;        /* resolving resolveHost failed */
+    char* resolveHost;
+    struct s7plcStation* resolveNext;
+    SOCKET reactorSock;
+    unsigned int reactorEvents;
+    double reactorDeadline;
+    double recvDeadline;
+    double lastSendTime;
+    unsigned char* recvBuf;
+    unsigned int input;
+    char* sendBuf;
+#endif
 };
 
 char* s7plcCurrentTime()
@@ -113,6 +630,316 @@ char* s7plcCurrentTime()
     return buffer;
 }
 
+/* Seconds on a clock that does not jump, for timeouts and statistics. */
+STATIC double s7plcMonotonic()
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+#else
+    epicsTimeStamp stamp;
+    epicsTimeGetCurrent(&stamp);
+    return stamp.secPastEpoch + stamp.nsec * 1e-9;
+#endif
+}
+
+/* Locks and accounts the time spent waiting if the lock was taken. */
+STATIC void s7plcLock(epicsMutexId lock, s7plcLockStats* stats)
+{
+    double start;
+
+    if (epicsMutexTryLock(lock) == epicsMutexLockOK) return;
+    start = s7plcMonotonic();
+    epicsMutexMustLock(lock);
+    stats->waits++;
+    stats->waitTime += s7plcMonotonic() - start;
+}
+
+STATIC int s7plcLatencyBucket(double seconds)
+{
+    unsigned long us;
+    int e = 0, i;
+
+    if (seconds <= 0.0) return 0;
+    if (seconds >= 1000.0) return S7PLC_LATENCY_BUCKETS-1;
+    us = (unsigned long)(seconds * 1e6);
+    if (us < S7PLC_LATENCY_SUB) return us;
+    while ((us >> e) >= 2*S7PLC_LATENCY_SUB) e++;
+    i = (e+1) * S7PLC_LATENCY_SUB + (us >> e) - S7PLC_LATENCY_SUB;
+    return i < S7PLC_LATENCY_BUCKETS ? i : S7PLC_LATENCY_BUCKETS-1;
+}
+
+/* Lower limit of bucket index in seconds */
+double s7plcLatencyLimit(int index)
+{
+    int e;
+
+    if (index < 0) return 0.0;
+    if (index < S7PLC_LATENCY_SUB) return index * 1e-6;
+    e = index / S7PLC_LATENCY_SUB - 1;
+    return (double)((index % S7PLC_LATENCY_SUB + S7PLC_LATENCY_SUB) << e) * 1e-6;
+}
+
+/* Record threads add concurrently */
+STATIC void s7plcLatencyAdd(s7plcHistogram* hist, double seconds)
+{
+#ifdef HAVE_ATOMIC
+    epicsAtomicIncrIntT(&hist->counts[s7plcLatencyBucket(seconds)]);
+#else
+    hist->counts[s7plcLatencyBucket(seconds)]++;
+#endif
+}
+
+/*
+ * Binary trace: each thread writes events into its own ring, without
+ * locks or formatting. s7plcTraceDump decodes the rings later.
+ */
+#define S7PLC_TRACE_EVENTS 4096  /* per thread, power of 2 */
+
+#define S7PLC_TRACE_RECV     0
+#define S7PLC_TRACE_PUBLISH  1
+#define S7PLC_TRACE_SEND     2
+#define S7PLC_TRACE_READ     3
+#define S7PLC_TRACE_WRITE    4
+#define S7PLC_TRACE_CONNECT  5
+#define S7PLC_TRACE_CLOSE    6
+
+static const char* s7plcTraceNames[] = {
+    "recv", "publish", "send", "read", "write", "connect", "close"
+};
+
+typedef struct s7plcTraceEntry {
+    double time;
+    s7plcStation* station;
+    unsigned int offset;
+    unsigned int length;
+    int type;
+} s7plcTraceEntry;
+
+typedef struct s7plcTraceRing {
+    struct s7plcTraceRing* next;
+    char thread[32];
+    unsigned long head;       /* only written by the owning thread */
+    s7plcTraceEntry events[S7PLC_TRACE_EVENTS];
+} s7plcTraceRing;
+
+static epicsThreadOnceId s7plcTraceOnce = EPICS_THREAD_ONCE_INIT;
+static epicsThreadPrivateId s7plcTraceKey;
+static epicsMutexId s7plcTraceLock;   /* list of rings */
+static s7plcTraceRing* s7plcTraceRings;
+
+STATIC void s7plcTraceInit(void* arg)
+{
+    s7plcTraceKey = epicsThreadPrivateCreate();
+    s7plcTraceLock = epicsMutexMustCreate();
+}
+
+STATIC void s7plcTraceAdd(int type, s7plcStation* station,
+    unsigned int offset, unsigned int length)
+{
+    s7plcTraceRing* ring;
+    s7plcTraceEntry* event;
+
+    epicsThreadOnce(&s7plcTraceOnce, s7plcTraceInit, NULL);
+    ring = epicsThreadPrivateGet(s7plcTraceKey);
+    if (!ring)
+    {
+        /* first event of this thread, rings are never freed */
+        ring = calloc(1, sizeof(s7plcTraceRing));
+        if (!ring) return;
+        epicsThreadGetName(epicsThreadGetIdSelf(), ring->thread, sizeof(ring->thread));
+        epicsThreadPrivateSet(s7plcTraceKey, ring);
+        epicsMutexMustLock(s7plcTraceLock);
+        ring->next = s7plcTraceRings;
+        s7plcTraceRings = ring;
+        epicsMutexUnlock(s7plcTraceLock);
+    }
+    event = &ring->events[ring->head & (S7PLC_TRACE_EVENTS-1)];
+    event->time = s7plcMonotonic();
+    event->station = station;
+    event->offset = offset;
+    event->length = length;
+    event->type = type;
+    ring->head++;
+}
+
+#define s7plcTraceEvent(type, station, offset, length) \
+    do {if (s7plcTrace) s7plcTraceAdd(S7PLC_TRACE_##type, station, offset, length);} while(0)
+
+#define S7PLC_RECORD_SLOT(station) \
+    ((sizeof(s7plcRecordSlot) + ((station)->inSize > (station)->outSize ? \
+    (station)->inSize : (station)->outSize) + 7) & ~7)
+
+#ifdef HAVE_MMAP
+/* Maps header and slots of the recording file, growing the file if needed. */
+STATIC int s7plcRecordMap(s7plcRecorder* rec, size_t size)
+{
+    void* map;
+
+    if (ftruncate(rec->fd, size) != 0) return -1;
+    if (rec->header) munmap((void*)rec->header, rec->mapSize);
+    rec->header = NULL;
+    map = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, rec->fd, 0);
+    if (map == MAP_FAILED) return -1;
+    rec->header = map;
+    rec->mapSize = size;
+    return 0;
+}
+
+STATIC void s7plcRecordClose(s7plcStation* station, s7plcRecorder* rec)
+{
+    s7plcRecordHeader* header = rec->header;
+
+    if (header)
+    {
+        if (!header->ring)
+        {
+            /* cut the unused slots of an append-only file */
+            header->slots = (epicsUInt32)rec->count;
+            munmap((void*)header, rec->mapSize);
+            if (ftruncate(rec->fd, sizeof(s7plcRecordHeader)
+                + (size_t)rec->count * S7PLC_RECORD_SLOT(station)) != 0)
+                s7plcErrorLog("s7plcRecord %s: truncating file failed\n",
+                    station->name);
+        }
+        else
+            munmap((void*)header, rec->mapSize);
+    }
+    close(rec->fd);
+    free(rec);
+}
+
+STATIC s7plcRecorder* s7plcRecordOpen(s7plcStation* station, const char* filename)
+{
+    s7plcRecorder* rec;
+    s7plcRecordHeader* header;
+    unsigned int slots = station->recordSlots ? station->recordSlots : 10000;
+    char errmsg[100];
+
+    rec = calloc(1, sizeof(s7plcRecorder));
+    if (!rec) return NULL;
+    rec->fd = open(filename, O_RDWR|O_CREAT|O_TRUNC, 0644);
+    if (rec->fd < 0 || s7plcRecordMap(rec, sizeof(s7plcRecordHeader)
+        + (size_t)slots * S7PLC_RECORD_SLOT(station)) != 0)
+    {
+        epicsSocketConvertErrnoToString(errmsg, sizeof(errmsg));
+        s7plcErrorLog("s7plcRecord %s: cannot create %s: %s\n",
+            station->name, filename, errmsg);
+        if (rec->fd >= 0) close(rec->fd);
+        free(rec);
+        return NULL;
+    }
+    header = rec->header;
+    memcpy(header->magic, S7PLC_RECORD_MAGIC, sizeof(header->magic));
+    header->byteOrder = 0x01020304;
+    header->headerSize = sizeof(s7plcRecordHeader);
+    header->slotSize = S7PLC_RECORD_SLOT(station);
+    header->inSize = station->inSize;
+    header->outSize = station->outSize;
+    header->ring = station->recordRing;
+    header->slots = slots;
+    s7plcErrorLog("s7plcRecord %s: recording frames to %s (%s, %u frames)\n",
+        station->name, filename, header->ring ? "ring" : "append-only", slots);
+    return rec;
+}
+
+/*
+ * Records a frame received or sent. Frames arrive from the receive and
+ * the send side, so writers are serialized by recordLock.
+ */
+STATIC void s7plcRecordFrame(s7plcStation* station, int direction,
+    const void* data, unsigned int size)
+{
+    s7plcRecorder* rec;
+    s7plcRecordHeader* header;
+    s7plcRecordSlot* slot;
+    epicsTimeStamp now;
+    double index;
+
+    if (station->outSource) station = station->outSource;
+    if (!station->recorder) return;
+    epicsTimeGetCurrent(&now);
+    epicsMutexMustLock(station->recordLock);
+    rec = station->recorder;
+    if (!rec || rec->full)
+    {
+        epicsMutexUnlock(station->recordLock);
+        return;
+    }
+    header = rec->header;
+    if (header->ring)
+        index = fmod(rec->count, header->slots);
+    else
+    {
+        index = rec->count;
+        if (index >= header->slots)
+        {
+            /* append-only: double the file */
+            if (s7plcRecordMap(rec, sizeof(s7plcRecordHeader)
+                + 2 * (size_t)header->slots * header->slotSize) != 0)
+            {
+                s7plcErrorLog("s7plcRecord %s: cannot grow recording file, stopped\n",
+                    station->name);
+                rec->full = 1;
+                epicsMutexUnlock(station->recordLock);
+                return;
+            }
+            header = rec->header;
+            header->slots *= 2;
+        }
+    }
+    slot = (s7plcRecordSlot*)((char*)(header+1) + (size_t)index * header->slotSize);
+    slot->secPastEpoch = now.secPastEpoch;
+    slot->nsec = now.nsec;
+    slot->size = size;
+    slot->direction = direction;
+    memcpy(slot+1, data, size);
+    rec->count++;
+#ifdef HAVE_ATOMIC
+    epicsAtomicWriteMemoryBarrier();
+#endif
+    header->countHigh = (epicsUInt32)(rec->count / 4294967296.0);
+    header->countLow = (epicsUInt32)fmod(rec->count, 4294967296.0);
+    epicsMutexUnlock(station->recordLock);
+}
+#else
+STATIC void s7plcRecordFrame(s7plcStation* station, int direction,
+    const void* data, unsigned int size)
+{
+}
+#endif
+
+/* Starts recording to filename or stops if filename is empty. */
+STATIC int s7plcRecord(s7plcStation* station, const char* filename)
+{
+#ifdef HAVE_MMAP
+    s7plcRecorder* rec = NULL;
+    s7plcRecorder* old;
+
+    if (filename && *filename)
+    {
+        rec = s7plcRecordOpen(station, filename);
+        if (!rec) return -1;
+    }
+    epicsMutexMustLock(station->recordLock);
+    old = station->recorder;
+    station->recorder = rec;
+    epicsMutexUnlock(station->recordLock);
+    if (old)
+    {
+        s7plcErrorLog("s7plcRecord %s: recorded %.0f frames\n",
+            station->name, old->count);
+        s7plcRecordClose(station, old);
+    }
+    return 0;
+#else
+    s7plcErrorLog("s7plcRecord %s: recording not supported on this system\n",
+        station->name);
+    return -1;
+#endif
+}
+
 STATIC void hexdump(unsigned char* data, int size, int ascii)
 {
     int offs, x;
@@ -146,12 +973,33 @@ STATIC long s7plcIoReport(int level)
     for (station = s7plcStationList; station;
         station=station->next)
     {
-        printf("  %s %s %s:%d\n",
-            station->name,
-            station->sock != INVALID_SOCKET ? "connected to" : "disconnected from",
-            station->server, station->serverPort);
+        if (station->carrier)
+            printf("  %s %s in frames of %s at %u/%u\n",
+                station->name,
+                s7plcConnUp(station) ? "carried" : "disconnected",
+                station->carrier->name, station->blockIn, station->blockOut);
+        else if (station->loopback)
+            printf("  %s loopback\n", station->name);
+        else if (station->replayFile)
+            printf("  %s %s %s\n",
+                station->name,
+                station->localConnected ? "replaying" : "finished replay of",
+                station->replayFile);
+        else if (station->transport != &s7plcTcpTransport)
+            printf("  %s %s %s transport\n",
+                station->name,
+                station->sock != INVALID_SOCKET ? "connected by" : "disconnected from",
+                station->transport->name);
+        else
+            printf("  %s %s %s:%d\n",
+                station->name,
+                station->sock != INVALID_SOCKET ? "connected to" : "disconnected from",
+                station->server, station->serverPort);
         if (level < 1) continue;
-        printf("    file descriptor %" SOCKFMT "\n", station->sock);
+        if (station->sender)
+            printf("    output sent by  %s\n", station->sender->name);
+        if (!station->loopback && !station->carrier)
+            printf("    file descriptor %" SOCKFMT "\n", station->sock);
         printf("    swap bytes %s\n",
             station->swapBytes
                 ? ( bigEndianIoc ? "ioc:motorola <-> plc:intel" : "ioc:intel <-> plc:motorola" )
@@ -160,10 +1008,57 @@ STATIC long s7plcIoReport(int level)
             station->recvTimeout);
         printf("    send intervall  %g sec\n",
             station->sendIntervall);
+        if (s7plcSends(station))
+            printf("    send timeout    %g sec, then %s\n",
+                station->sendTimeout, s7plcSendPolicyNames[station->sendPolicy]);
+        if (station->transport == &s7plcTcpTransport && !s7plcIsLocal(station)
+            && !station->carrier)
+        {
+            if (station->probeInterval > 0.0)
+                printf("    reconnect       probe every %g sec, timeout %g sec\n",
+                    station->probeInterval, station->probeTimeout);
+            else
+                printf("    reconnect       after %g up to %g sec, x%g +-%g%%\n",
+                    station->reconnectMin, station->reconnectMax,
+                    station->reconnectFactor, station->reconnectJitter * 100);
+            if (station->failedConnects)
+                printf("    failed connects %lu, next in %g sec\n",
+                    station->failedConnects, station->reconnectTime - s7plcMonotonic());
+        }
+        if (station->sendOnWrite)
+            printf("    send on write   min gap %g sec\n",
+                station->sendGap);
+        if (station->latestFrame)
+            printf("    latest frame    %lu stale frames skipped\n",
+                station->stats.skippedFrames);
+        if (station->scanOnChange)
+            printf("    scan on change  %u ranges, heartbeat %g sec\n",
+                station->nranges, station->heartbeat);
+        if (station->nplan)
+            printf("    decode cache    %u channels%s\n",
+                station->nplan, station->planBuilt ? "" : " (not yet active)");
+        if (station->replayFile)
+            printf("    replay speed    %g%s\n",
+                station->replaySpeed, station->replayLoop ? " loop" : "");
+        if (station->loopback)
+        {
+            unsigned int i;
+            printf("    loopback period %g sec, pattern %s, map",
+                station->loopPeriod, s7plcPatternNames[station->loopPattern]);
+            epicsMutexMustLock(station->outLock);
+            for (i = 0; i < station->nloopMap; i++)
+                printf(" %u:%u:%u", station->loopMap[i].inOffset,
+                    station->loopMap[i].outOffset, station->loopMap[i].size);
+            epicsMutexUnlock(station->outLock);
+            printf("\n");
+        }
+        if (station->recorder)
+            printf("    recording       %.0f frames\n",
+                station->recorder->count);
         printf("    inBuffer  at address %p (%u bytes)\n",
-            station->inBuffer,  station->inSize);
+            station->inCurrent->data,  station->inSize);
         if (level >= 2)
-            hexdump(station->inBuffer,  station->inSize, level >= 3);
+            hexdump(station->inCurrent->data,  station->inSize, level >= 3);
         printf("    outBuffer at address %p (%u bytes)\n",
             station->outBuffer,  station->outSize);
         if (level >= 2)
@@ -176,11 +1071,77 @@ STATIC long s7plcInit()
 {
     s7plcStation* station;
     char threadname[20];
+    int reactor = 0;
 
     if (!s7plcStationList) return 0;
 
+    s7plcSelectKernels();
+    for (station = s7plcStationList; station; station=station->next)
+    {
+        s7plcStation* sender = station->sender;
+
+        if (!sender) continue;
+        /* send options are set for the PLC, the sender applies them */
+        sender->sendIntervall = station->sendIntervall;
+        sender->sendPhase = station->sendPhase;
+        sender->sendOnWrite = station->sendOnWrite;
+        sender->sendGap = station->sendGap;
+        sender->latency = station->latency;
+        sender->sendTimeout = station->sendTimeout;
+        sender->sendPolicy = station->sendPolicy;
+        sender->reconnectMin = station->reconnectMin;
+        sender->reconnectMax = station->reconnectMax;
+        sender->reconnectFactor = station->reconnectFactor;
+        sender->reconnectJitter = station->reconnectJitter;
+        sender->probeInterval = station->probeInterval;
+        sender->probeTimeout = station->probeTimeout;
+        sender->resolveTTL = station->resolveTTL;
+        sender->transport = station->transport;
+        sender->pairBufSize = station->pairBufSize;
+    }
+    s7plcSchedule();
+
+    for (station = s7plcStationList; station; station=station->next)
+    {
+        if (!station->carrier) continue;
+        if (station->blockIn + station->inSize > station->carrier->inSize
+            || station->blockOut + station->outSize > station->carrier->outSize)
+        {
+            s7plcErrorLog(
+                "s7plcInit %s: FATAL ERROR! block at %u/%u does not fit into the frames of %s\n",
+                station->name, station->blockIn, station->blockOut,
+                station->carrier->name);
+            return -1;
+        }
+    }
+
+    if (reactorShards)
+    {
+#ifdef HAVE_EPOLL
+        if (s7plcReactorStart() != 0) return -1;
+        reactor = 1;
+#else
+        s7plcErrorLog(
+            "s7plcInit: reactor mode not supported on this system. Using threads.\n");
+#endif
+    }
+
     for (station = s7plcStationList; station; station=station->next)
     {
+        /* Carried blocks are handled by their parent. */
+        if (station->carrier) continue;
+        /* Stations without socket always use threads, the reactor has the others. */
+        if (reactor && s7plcUseReactor(station)) continue;
+
+        if (station->loopback)
+        {
+            /* loopback is always "connected" */
+            epicsMutexMustLock(station->connLock);
+            station->localConnected = 1;
+            station->stats.connects++;
+            epicsMutexUnlock(station->connLock);
+        }
+
         /* Create a receiver thread only if there will be any data to receive. */
         if (station->inSize)
         {
@@ -192,6 +1153,8 @@ STATIC long s7plcInit()
                 threadname,
                 epicsThreadPriorityHigh,
                 epicsThreadGetStackSize(epicsThreadStackBig),
+                station->replayFile ? (EPICSTHREADFUNC)s7plcReplayThread :
+                station->loopback ? (EPICSTHREADFUNC)s7plcLoopbackThread :
                 (EPICSTHREADFUNC)s7plcReceiveThread,
                 station);
             if (!station->recvThread)
@@ -204,7 +1167,7 @@ STATIC long s7plcInit()
         }
 
         /* Create a sender thread only if there will be any data to send. */
-        if (station->outSize)
+        if (s7plcSends(station))
         {
             sprintf (threadname, "%.15sS", station->name);
             s7plcDebugLog(1,
@@ -228,552 +1191,4027 @@ STATIC long s7plcInit()
     return 0;
 }
 
-STATIC void s7plcSignal(void* event)
+/*
+ * Sets the first send deadline of all stations. Stations without the
+ * sendPhase option are spread evenly over their send intervall, so that
+ * stations with equal intervalls do not all send at the same time.
+ */
+STATIC void s7plcSchedule()
 {
-    epicsEventSignal((epicsEventId)event);
+    s7plcStation* station;
+    unsigned int n = 0, k = 0;
+    double now = s7plcMonotonic();
+    double phase;
+
+    for (station = s7plcStationList; station; station=station->next)
+        if (s7plcSends(station)) n++;
+    for (station = s7plcStationList; station; station=station->next)
+    {
+        if (!s7plcSends(station)) continue;
+        if (station->sendPhase >= 0.0)
+            phase = fmod(station->sendPhase, station->sendIntervall);
+        else
+            phase = station->sendIntervall * k / n;
+        station->sendDeadline = now + phase;
+        k++;
+    }
 }
 
-int s7plcConfigure(char *name, char* IPaddr, unsigned int port, unsigned int inSize, unsigned int outSize, unsigned int bigEndian, unsigned int recvTimeout, unsigned int sendIntervall)
+/*
+ * Advances a periodic deadline by whole periods, so the phase never
+ * drifts. Returns the number of periods that have been missed.
+ */
+STATIC unsigned long s7plcNextDeadline(double* deadline, double period, double now)
 {
-    s7plcStation* station;
-    s7plcStation** pstation;
+    unsigned long missed = 0;
 
-    union {short s; char c [sizeof(short)];} u;
-    u.s=1;
-    bigEndianIoc = !u.c[0];
-    if (!name)
+    *deadline += period;
+    if (*deadline <= now)
     {
-        errlogSevPrintf(errlogFatal,
-            "s7plcConfigure: missing name\n");
-        return -1;
+        missed = (unsigned long)((now - *deadline) / period) + 1;
+        *deadline += missed * period;
     }
+    return missed;
+}
 
-    if (!IPaddr || !IPaddr[0])
+/* Counts a periodic send cycle started at now. */
+STATIC void s7plcSendCycle(s7plcStation* station, double now, int connected)
+{
+    s7plcCounters* stats = &station->stats;
+    double period;
+    unsigned long missed;
+
+    missed = s7plcNextDeadline(&station->sendDeadline, station->sendIntervall, now);
+    if (!connected)
     {
-        IPaddr = NULL;
-        errlogSevPrintf(errlogInfo,
-            "s7plcConfigure: missing IP address or name. Waiting for address set by record.\n");
+        stats->lastCycle = 0.0;
+        return;
     }
-    else
-    if (!port)
+    stats->sendOverruns += missed;
+    if (stats->lastCycle > 0.0)
     {
-        errlogSevPrintf(errlogFatal,
-            "s7plcConfigure: missing IP port\n");
-        return -1;
+        period = now - stats->lastCycle;
+        if (!stats->cycles || period < stats->cycleMin)
+            stats->cycleMin = period;
+        if (period > stats->cycleMax)
+            stats->cycleMax = period;
+        stats->cycleSum += period;
+        stats->cycleSumSq += period * period;
+        stats->cycles++;
     }
+    stats->lastCycle = now;
+}
 
-    /* find last station in list */
-    for (pstation = &s7plcStationList; *pstation; pstation = &(*pstation)->next);
+/* Sleeps until the s7plcMonotonic time t. */
+STATIC void s7plcSleepUntil(double t)
+{
+#if defined(__linux__) && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
 
-    station = callocMustSucceed(1,
-        sizeof(s7plcStation) + inSize + outSize + strlen(name)+1, "s7plcConfigure");
-    station->next = NULL;
-    station->serverPort = port;
-    station->inSize = inSize;
-    station->outSize = outSize;
-    station->inBuffer = (unsigned char*)(station+1);
-    station->outBuffer = (unsigned char*)(station+1)+inSize;
-    station->name = (char*)(station+1)+inSize+outSize;
-    strcpy(station->name, name);
-    station->server = IPaddr ? epicsStrDup(IPaddr) : NULL;
-    station->swapBytes = bigEndian ^ bigEndianIoc;
-    station->sock = INVALID_SOCKET;
-    station->mutex = epicsMutexMustCreate();
-    station->io = epicsMutexMustCreate();
-    station->outputChanged = 0;
-    if (station->outSize)
+    ts.tv_sec = (time_t)t;
+    ts.tv_nsec = (long)((t - ts.tv_sec) * 1e9);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+#else
+    double delay = t - s7plcMonotonic();
+    if (delay > 0.0) epicsThreadSleep(delay);
+#endif
+}
+
+/*
+ * Waits for the next periodic send or a write in sendOnWrite mode.
+ * The last millisecond is slept with an absolute deadline because event
+ * timeouts may be rounded to clock ticks. Returns 1 for the periodic send.
+ */
+STATIC int s7plcWaitForSend(s7plcStation* station)
+{
+    double remaining;
+
+    while ((remaining = station->sendDeadline - s7plcMonotonic()) > 0.0)
     {
-        station->outTrigger = epicsEventMustCreate(epicsEventEmpty);
-        if (!timerqueue)
+        if (remaining <= 0.001)
         {
-            timerqueue = epicsTimerQueueAllocate(1, epicsThreadPriorityHigh);
+            s7plcSleepUntil(station->sendDeadline);
+            break;
         }
-        station->timer = epicsTimerQueueCreateTimer(timerqueue,
-            s7plcSignal, station->outTrigger);
+        if (epicsEventWaitWithTimeout(station->outTrigger, remaining - 0.001)
+            == epicsEventWaitOK)
+            return 0;
     }
-    scanIoInit(&station->inScanPvt);
-    scanIoInit(&station->outScanPvt);
-    station->recvThread = NULL;
-    station->sendThread = NULL;
-    station->recvTimeout = recvTimeout > 0 ? recvTimeout/1000.0 : 2.0;
-    station->sendIntervall = sendIntervall > 0 ? sendIntervall/1000.0 : 1.0;
+    return 1;
+}
 
-    /* append station to list */
-    *pstation = station;
-    pstation = &station->next;
+/*
+ * Statistics by name. A counter is an unsigned long, a time a double in
+ * s7plcCounters. Means divide the sum at a by the count at c, jitters
+ * also take the sum of squares at b.
+ */
+enum { S7PLC_COUNT, S7PLC_COUNTS, S7PLC_TIME, S7PLC_TIMES, S7PLC_MEAN, S7PLC_JITTER };
 
-    return 0;
-}
+typedef struct s7plcStat {
+    const char* name;
+    int kind;
+    size_t a, b, c;
+} s7plcStat;
 
-static const iocshArg s7plcConfigureArg0 = { "name", iocshArgString };
-static const iocshArg s7plcConfigureArg1 = { "IPaddr", iocshArgString };
-static const iocshArg s7plcConfigureArg2 = { "IPport", iocshArgInt };
-static const iocshArg s7plcConfigureArg3 = { "inSize", iocshArgInt };
-static const iocshArg s7plcConfigureArg4 = { "outSize", iocshArgInt };
-static const iocshArg s7plcConfigureArg5 = { "bigEndian", iocshArgInt };
-static const iocshArg s7plcConfigureArg6 = { "recvTimeout", iocshArgInt };
-static const iocshArg s7plcConfigureArg7 = { "sendIntervall", iocshArgInt };
-static const iocshArg * const s7plcConfigureArgs[] = {
-    &s7plcConfigureArg0,
-    &s7plcConfigureArg1,
-    &s7plcConfigureArg2,
-    &s7plcConfigureArg3,
-    &s7plcConfigureArg4,
-    &s7plcConfigureArg5,
-    &s7plcConfigureArg6,
-    &s7plcConfigureArg7
+#define S7PLC_STAT(name, kind, a, b, c) \
+    { name, kind, offsetof(s7plcCounters, a), offsetof(s7plcCounters, b), \
+      offsetof(s7plcCounters, c) }
+#define S7PLC_STAT_COUNT(name, f) S7PLC_STAT(name, S7PLC_COUNT, f, f, f)
+#define S7PLC_STAT_TIME(name, f) S7PLC_STAT(name, S7PLC_TIME, f, f, f)
+
+static const s7plcStat s7plcStatTable[] = {
+    /* frames published */
+    S7PLC_STAT_COUNT("framesIn", framesIn),
+    /* bytes received */
+    S7PLC_STAT_COUNT("bytesIn", bytesIn),
+    /* successful recv calls */
+    S7PLC_STAT_COUNT("recvCalls", recvCalls),
+    /* recv calls returning less than requested */
+    S7PLC_STAT_COUNT("partialRecvs", partialRecvs),
+    /* seconds spent waiting for input */
+    S7PLC_STAT_TIME("waitTime", waitTime),
+    /* seconds between published frames */
+    S7PLC_STAT_TIME("periodMin", periodMin),
+    S7PLC_STAT("periodMean", S7PLC_MEAN, periodSum, periodSum, periods),
+    S7PLC_STAT_TIME("periodMax", periodMax),
+    /* standard deviation of the period */
+    S7PLC_STAT("periodJitter", S7PLC_JITTER, periodSum, periodSumSq, periods),
+    /* stale frames dropped in latestFrame mode */
+    S7PLC_STAT_COUNT("skippedFrames", skippedFrames),
+    /* frames sent */
+    S7PLC_STAT_COUNT("framesOut", framesOut),
+    /* bytes sent */
+    S7PLC_STAT_COUNT("bytesOut", bytesOut),
+    /* seconds from fetching to sending a frame */
+    S7PLC_STAT("sendTimeMean", S7PLC_MEAN, sendTimeSum, sendTimeSum, sendCycles),
+    S7PLC_STAT_TIME("sendTimeMax", sendTimeMax),
+    /* connections established */
+    S7PLC_STAT_COUNT("connects", connects),
+    /* contended inLock and outLock acquisitions */
+    S7PLC_STAT("lockWaits", S7PLC_COUNTS, inLock.waits, outLock.waits, inLock.waits),
+    /* seconds spent waiting for them */
+    S7PLC_STAT("lockWaitTime", S7PLC_TIMES, inLock.waitTime, outLock.waitTime, inLock.waitTime),
+    /* scanIoRequest calls */
+    S7PLC_STAT("scans", S7PLC_COUNTS, inScans, outScans, inScans),
+    /* seconds from input scan request to completion */
+    S7PLC_STAT("scanTimeMean", S7PLC_MEAN, scanTimeSum, scanTimeSum, scansDone),
+    S7PLC_STAT_TIME("scanTimeMax", scanTimeMax),
+    /* successful send calls */
+    S7PLC_STAT_COUNT("sendCalls", sendCalls),
+    /* send calls writing less than requested */
+    S7PLC_STAT_COUNT("partialSends", partialSends),
+    /* output bytes copied from records to the send buffer */
+    S7PLC_STAT_COUNT("bytesCopied", bytesCopied),
+    /* seconds between periodic send cycles */
+    S7PLC_STAT_TIME("cycleMin", cycleMin),
+    S7PLC_STAT("cycleMean", S7PLC_MEAN, cycleSum, cycleSum, cycles),
+    S7PLC_STAT_TIME("cycleMax", cycleMax),
+    /* standard deviation of the send cycle */
+    S7PLC_STAT("cycleJitter", S7PLC_JITTER, cycleSum, cycleSumSq, cycles),
+    /* periodic send cycles missed */
+    S7PLC_STAT_COUNT("sendOverruns", sendOverruns),
+    /* sends that found the socket full */
+    S7PLC_STAT_COUNT("sendBlocks", sendBlocks),
+    /* seconds waited for the PLC to take data */
+    S7PLC_STAT_TIME("blockedTime", blockedTime),
+    /* frames not taken within sendTimeout */
+    S7PLC_STAT_COUNT("sendTimeouts", sendTimeouts),
+    /* send cycles skipped while a frame was pending */
+    S7PLC_STAT_COUNT("droppedFrames", droppedFrames),
+    /* bytes not yet taken by the PLC */
+    S7PLC_STAT_COUNT("sendQueue", sendQueue),
+    S7PLC_STAT_COUNT("sendQueueMax", sendQueueMax),
+    /* failed connect attempts */
+    S7PLC_STAT_COUNT("connectFailures", connectFailures),
+    { NULL }
 };
-static const iocshFuncDef s7plcConfigureDef = { "s7plcConfigure", 8, s7plcConfigureArgs };
-static void s7plcConfigureFunc (const iocshArgBuf *args)
+
+int s7plcStatIndex(const char* name)
 {
-    int status = s7plcConfigure(
-        args[0].sval, args[1].sval, args[2].ival,
-        args[3].ival, args[4].ival, args[5].ival,
-        args[6].ival, args[7].ival);
+    int i;
 
-    if (status) exit(1);
+    for (i = 0; s7plcStatTable[i].name; i++)
+        if (epicsStrCaseCmp(name, s7plcStatTable[i].name) == 0) return i;
+    return -1;
 }
 
-static void s7plcRegister()
+#define S7PLC_FIELD(type, stats, offset) (*(const type*)((const char*)(stats) + (offset)))
+
+/* Counters are read without locking. A value may be one update behind. */
+int s7plcGetStat(s7plcStation* station, int index, double* value)
 {
-    iocshRegister(&s7plcConfigureDef, s7plcConfigureFunc);
+    const s7plcCounters* stats = &station->stats;
+    const s7plcStat* stat;
+    unsigned long n;
+    double mean;
+
+    if (index < 0 || index >= (int)(sizeof(s7plcStatTable) / sizeof(s7plcStat)) - 1)
+        return -1;
+    stat = &s7plcStatTable[index];
+    switch (stat->kind)
+    {
+        case S7PLC_COUNT:
+            *value = S7PLC_FIELD(unsigned long, stats, stat->a);
+            break;
+        case S7PLC_COUNTS:
+            *value = S7PLC_FIELD(unsigned long, stats, stat->a)
+                + S7PLC_FIELD(unsigned long, stats, stat->b);
+            break;
+        case S7PLC_TIME:
+            *value = S7PLC_FIELD(double, stats, stat->a);
+            break;
+        case S7PLC_TIMES:
+            *value = S7PLC_FIELD(double, stats, stat->a)
+                + S7PLC_FIELD(double, stats, stat->b);
+            break;
+        case S7PLC_MEAN:
+        case S7PLC_JITTER:
+            n = S7PLC_FIELD(unsigned long, stats, stat->c);
+            if (!n) { *value = 0.0; break; }
+            mean = S7PLC_FIELD(double, stats, stat->a) / n;
+            if (stat->kind == S7PLC_MEAN) { *value = mean; break; }
+            mean = S7PLC_FIELD(double, stats, stat->b) / n - mean * mean;
+            *value = mean > 0.0 ? sqrt(mean) : 0.0;
+            break;
+    }
+    return 0;
 }
 
-epicsExportRegistrar(s7plcRegister);
+int s7plcGetLatency(s7plcStation* station, int output,
+    epicsInt32* counts, unsigned int n)
+{
+    s7plcHistogram* hist = output ? &station->latencyOut : &station->latencyIn;
+    unsigned int i;
 
-s7plcStation *s7plcOpen(char *name)
+    if (n > S7PLC_LATENCY_BUCKETS) n = S7PLC_LATENCY_BUCKETS;
+    for (i = 0; i < n; i++)
+        counts[i] = hist->counts[i];
+    return n;
+}
+
+STATIC void s7plcLatencyPrint(const char* title, s7plcHistogram* hist, int level)
 {
-    s7plcStation *station;
+    static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999, 1.0 };
+    unsigned long total = 0, sum = 0;
+    unsigned int i, q = 0;
+
+    for (i = 0; i < S7PLC_LATENCY_BUCKETS; i++)
+        total += hist->counts[i];
+    printf("    %s: %lu samples\n", title, total);
+    if (!total) return;
+    printf("     ");
+    for (i = 0; i < S7PLC_LATENCY_BUCKETS && q < 5; i++)
+    {
+        sum += hist->counts[i];
+        /* upper limit of the bucket holding the quantile */
+        while (q < 5 && sum >= quantiles[q] * total)
+            printf(" p%g<%gus", quantiles[q++] * 100,
+                s7plcLatencyLimit(i+1) * 1e6);
+    }
+    printf("\n");
+    if (level < 1) return;
+    for (i = 0; i < S7PLC_LATENCY_BUCKETS; i++)
+    {
+        if (hist->counts[i])
+            printf("      %9.0f - %9.0f us %d\n",
+                s7plcLatencyLimit(i) * 1e6, s7plcLatencyLimit(i+1) * 1e6,
+                hist->counts[i]);
+    }
+}
+
+int s7plcLatency(const char* name, int level)
+{
+    s7plcStation* station;
 
     for (station = s7plcStationList; station; station = station->next)
     {
-        if (strcmp(name, station->name) == 0)
-        {
-            return station;
-        }
+        if (name && *name && strcmp(name, station->name) != 0) continue;
+        printf("%s:%s\n", station->name,
+            station->latency ? "" : " latency option not set");
+        s7plcLatencyPrint("input (received -> record read)",
+            &station->latencyIn, level);
+        s7plcLatencyPrint("output (record written -> sent)",
+            &station->latencyOut, level);
     }
-    errlogSevPrintf(errlogFatal,
-        "s7plcOpen: station %s not found\n", name);
-    return NULL;
+    return 0;
 }
 
-IOSCANPVT s7plcGetInScanPvt(s7plcStation *station)
+/* Samples added while resetting may survive. */
+int s7plcLatencyReset(const char* name)
 {
-    return station->inScanPvt;
+    s7plcStation* station;
+
+    for (station = s7plcStationList; station; station = station->next)
+    {
+        if (name && *name && strcmp(name, station->name) != 0) continue;
+        memset(&station->latencyIn, 0, sizeof(s7plcHistogram));
+        memset(&station->latencyOut, 0, sizeof(s7plcHistogram));
+    }
+    return 0;
 }
 
-IOSCANPVT s7plcGetOutScanPvt(s7plcStation *station)
+STATIC int s7plcTraceCompare(const void* a, const void* b)
 {
-    return station->outScanPvt;
+    const s7plcTraceEntry* ea = *(s7plcTraceEntry* const*)a;
+    const s7plcTraceEntry* eb = *(s7plcTraceEntry* const*)b;
+    return ea->time < eb->time ? -1 : ea->time > eb->time;
 }
 
-int s7plcReadArray(
-    s7plcStation *station,
-    unsigned int offset,
-    unsigned int dlen,
-    unsigned int nelem,
-    void* data
-)
+/*
+ * Prints the events of all threads in time order, to a file if given.
+ * Events written while dumping may be garbled, so better stop tracing.
+ */
+int s7plcTraceDump(const char* filename)
 {
-    unsigned int elem, i;
-    unsigned char byte;
+    s7plcTraceRing* ring;
+    s7plcTraceEntry** list;
+    const char** threads;
+    unsigned long n = 0, i, head, first;
+    FILE* file = stdout;
+    double start;
 
-    if (offset+dlen > station->inSize)
+    epicsThreadOnce(&s7plcTraceOnce, s7plcTraceInit, NULL);
+    epicsMutexMustLock(s7plcTraceLock);
+    for (ring = s7plcTraceRings; ring; ring = ring->next)
+        n += ring->head < S7PLC_TRACE_EVENTS ? ring->head : S7PLC_TRACE_EVENTS;
+    list = calloc(n ? n : 1, sizeof(s7plcTraceEntry*));
+    if (!list)
     {
-       errlogSevPrintf(errlogMajor,
-        "s7plcRead %s/%u: offset out of range\n",
-        station->name, offset);
-       return S_dev_badArgument;
+        epicsMutexUnlock(s7plcTraceLock);
+        s7plcErrorLog("s7plcTraceDump: out of memory\n");
+        return -1;
     }
-    if (offset+nelem*dlen > station->inSize)
+    n = 0;
+    for (ring = s7plcTraceRings; ring; ring = ring->next)
     {
-       errlogSevPrintf(errlogMajor,
-        "s7plcRead %s/%u: too many elements (%u)\n",
-        station->name, offset, nelem);
-       return S_dev_badArgument;
+        head = ring->head;
+        first = head < S7PLC_TRACE_EVENTS ? 0 : head - S7PLC_TRACE_EVENTS;
+        for (i = first; i < head; i++)
+            list[n++] = &ring->events[i & (S7PLC_TRACE_EVENTS-1)];
     }
-    s7plcDebugLog(4,
-        "s7plcReadArray (station=%p, offset=%u, dlen=%u, nelem=%u)\n",
-        station, offset, dlen, nelem);
-    epicsMutexMustLock(station->mutex);
-    for (elem = 0; elem < nelem; elem++)
+    epicsMutexUnlock(s7plcTraceLock);
+    qsort(list, n, sizeof(s7plcTraceEntry*), s7plcTraceCompare);
+
+    if (filename && *filename)
     {
-        s7plcDebugLog(5, "data in:");
-        for (i = 0; i < dlen; i++)
+        file = fopen(filename, "w");
+        if (!file)
         {
-            if (station->swapBytes)
-                byte = station->inBuffer[offset + elem*dlen + dlen - 1 - i];
-            else
-                byte = station->inBuffer[offset + elem*dlen + i];
-            ((char*)data)[elem*dlen+i] = byte;
-            s7plcDebugLog(5, " %02x", byte);
+            s7plcErrorLog("s7plcTraceDump: cannot open %s\n", filename);
+            free(list);
+            return -1;
         }
-        s7plcDebugLog(5, "\n");
     }
-    epicsMutexUnlock(station->mutex);
-    if (station->sock == INVALID_SOCKET) return S_dev_noDevice;
-    return S_dev_success;
+    /* the owning ring holds the thread name */
+    threads = calloc(n ? n : 1, sizeof(char*));
+    for (i = 0; threads && i < n; i++)
+        for (ring = s7plcTraceRings; ring; ring = ring->next)
+            if (list[i] >= ring->events && list[i] < ring->events + S7PLC_TRACE_EVENTS)
+                threads[i] = ring->thread;
+    start = n ? list[0]->time : 0.0;
+    for (i = 0; i < n; i++)
+    {
+        fprintf(file, "%12.6f %-16s %-12s %-8s %5u %5u\n",
+            list[i]->time - start,
+            threads && threads[i] ? threads[i] : "",
+            list[i]->station ? list[i]->station->name : "",
+            (unsigned int)list[i]->type < sizeof(s7plcTraceNames)/sizeof(char*) ?
+                s7plcTraceNames[list[i]->type] : "?",
+            list[i]->offset, list[i]->length);
+    }
+    if (file != stdout) fclose(file);
+    free(threads);
+    free(list);
+    return 0;
 }
 
-int s7plcWriteMaskedArray(
-    s7plcStation *station,
-    unsigned int offset,
-    unsigned int dlen,
-    unsigned int nelem,
-    void* data,
-    void* mask
-)
+int s7plcStats(const char* name)
 {
-    unsigned int elem, i;
-    unsigned char byte;
+    s7plcStation* station;
+    double value;
+    int i;
 
-    if (offset+dlen > station->outSize)
-    {
-        errlogSevPrintf(errlogMajor,
-            "s7plcWrite %s/%d: offset out of range\n",
-            station->name, offset);
-        return -1;
-    }
-    if (offset+nelem*dlen > station->outSize)
-    {
-        errlogSevPrintf(errlogMajor,
-            "s7plcWrite %s/%d: too many elements (%u)\n",
-            station->name, offset, nelem);
-        return -1;
-    }
-    s7plcDebugLog(4,
-        "s7plcWriteMaskedArray (station=%p, offset=%u, dlen=%u, nelem=%u)\n",
-        station, offset, dlen, nelem);
-    epicsMutexMustLock(station->mutex);
-    for (elem = 0; elem < nelem; elem++)
+    for (station = s7plcStationList; station; station = station->next)
     {
-        s7plcDebugLog(5, "data out:");
-        for (i = 0; i < dlen; i++)
+        if (name && *name && strcmp(name, station->name) != 0) continue;
+        printf("%s:\n", station->name);
+        for (i = 0; s7plcStatTable[i].name; i++)
         {
-            byte = ((unsigned char*)data)[elem*dlen+i];
-            if (mask)
-            {
-                s7plcDebugLog(5, "(%02x & %02x)",
-                    byte, ((unsigned char*)mask)[i]);
-                byte &= ((unsigned char*)mask)[i];
-            }
-            if (station->swapBytes)
-            {
-                if (mask)
-                {
-                    s7plcDebugLog(5, " | (%02x & %02x) =>",
-                        station->outBuffer[offset + elem*dlen + dlen - 1 - i],
-                        ~((unsigned char*)mask)[i]);
-                    byte |=
-                        station->outBuffer[offset + elem*dlen + dlen - 1 - i]
-                        & ~((unsigned char*)mask)[i];
-                }
-                s7plcDebugLog(5, " %02x", byte);
-                station->outBuffer[offset + elem*dlen + dlen - 1 - i] = byte;
-            }
-            else
-            {
-                if (mask)
-                {
-                    s7plcDebugLog(5, " | (%02x & %02x) =>",
-                        station->outBuffer[offset + elem*dlen + i],
-                        ~((unsigned char*)mask)[i]);
-                    byte |= station->outBuffer[offset + elem*dlen + i]
-                        & ~((unsigned char*)mask)[i];
-                }
-                s7plcDebugLog(5, " %02x", byte);
-                station->outBuffer[offset + elem*dlen + i] = byte;
-            }
+            s7plcGetStat(station, i, &value);
+            printf("    %-14s %g\n", s7plcStatTable[i].name, value);
         }
-        s7plcDebugLog(5, "\n");
-        station->outputChanged=1;
     }
-    epicsMutexUnlock(station->mutex);
-    if (station->sock == INVALID_SOCKET) return S_dev_noDevice;
-    return S_dev_success;
+    return 0;
 }
 
-STATIC void s7plcSendThread(s7plcStation* station)
+/* 1 if all completions of the batch have arrived */
+STATIC int s7plcScanDone(const s7plcScanBatch* batch)
 {
-    char* sendBuf = callocMustSucceed(1, station->outSize, "s7plcSendThread");
-    char errmsg[100];
+    int prio;
 
-    s7plcDebugLog(1, "s7plcSendThread %s: started\n",
-            station->name);
+    for (prio = 0; prio < NUM_CALLBACK_PRIORITIES; prio++)
+        if (batch->pending[prio]) return 0;
+    return 1;
+}
 
-    while (1)
+/*
+ * Input scans of a frame are requested between s7plcScanBegin and
+ * s7plcScanEnd, holding scanLock so that no completion can arrive before
+ * the frame has been queued. Any thread may scan, not only the receiver.
+ */
+STATIC void s7plcScanBegin(s7plcStation* station, double stamp)
+{
+    s7plcScanBatch* batch;
+
+    epicsMutexMustLock(station->scanLock);
+    if (station->scanCount == S7PLC_SCAN_BATCHES)
     {
-        /*
-         * Check if the connection is established and establish a new if it isn't - in a
-         * thread-safe manner.
-         */
-        if (s7plcCheckConnection(station) == -1)
-        {
-            s7plcDebugLog(1,
-                "s7plcMain %s: connect to %s:%d failed. Retry in %g seconds\n",
-                station->name, station->server, station->serverPort,
-                (double)RECONNECT_DELAY);
-            epicsThreadSleep(RECONNECT_DELAY);
-            continue;
-        }
+        batch = &station->scanBatches[
+            (station->scanFirst + station->scanCount - 1) % S7PLC_SCAN_BATCHES];
+        station->scanBatch = batch;
+        /* callbacks far behind, measure together with the newest frame */
+        if (!s7plcScanDone(batch)) return;
+        /* or take the place of the newest if that is already counted */
+        station->scanCount--;
+    }
+    batch = &station->scanBatches[
+        (station->scanFirst + station->scanCount) % S7PLC_SCAN_BATCHES];
+    memset(batch, 0, sizeof(s7plcScanBatch));
+    batch->stamp = stamp;
+    station->scanCount++;
+    station->scanBatch = batch;
+}
 
-        epicsTimerStartDelay(station->timer, station->sendIntervall);
-        s7plcDebugLog(2, "s7plcSendThread %s: look for data to send\n",
-            station->name);
+STATIC void s7plcScanRequest(s7plcStation* station, IOSCANPVT scanPvt)
+{
+#ifdef HAVE_SCAN_COMPLETE
+    unsigned int queued = scanIoRequest(scanPvt);
+    int prio;
 
-        if (interruptAccept && station->sock != INVALID_SOCKET)
-        {
-            if (station->outputChanged)
-            {
-                epicsMutexMustLock(station->mutex);
-                memcpy(sendBuf, station->outBuffer, station->outSize);
-                station->outputChanged = 0;
-                epicsMutexUnlock(station->mutex);
+    for (prio = 0; prio < NUM_CALLBACK_PRIORITIES; prio++)
+        if (queued & (1 << prio))
+            station->scanBatch->pending[prio]++;
+#else
+    scanIoRequest(scanPvt);
+#endif
+    station->stats.inScans++;
+}
 
-                if (station->sock != INVALID_SOCKET)
-                {
-                    int written;
-                    s7plcDebugLog(2,
-                        "s7plcSendThread %s: sending %d bytes\n",
-                        station->name, station->outSize);
-                    written=send(station->sock, sendBuf, station->outSize, 0);
-                    if (written < 0)
-                    {
-                        epicsSocketConvertErrnoToString(errmsg, sizeof(errmsg));
-                        s7plcErrorLog(
-                            "s7plcSendThread %s: send(%d, ..., %d, 0) failed: %s\n",
-                            station->name,
-                            station->sock, station->outSize, errmsg);
-                        s7plcCloseConnection(station);
-                    }
-                    else if ((unsigned int)written < station->outSize)
-                    {
-                        s7plcErrorLog(
-                            "s7plcSendThread %s: send wrote only %d of %d bytes\n",
-                            station->name, written, station->outSize);
-                    }
-                }
-            }
-            /* notify all "I/O Intr" output records */
-            s7plcDebugLog(2,
-                "s7plcSendThread %s: send cycle done, notify all output records\n",
-                station->name);
-            scanIoRequest(station->outScanPvt);
-        }
-        epicsEventMustWait(station->outTrigger);
+/* Drops the completed frames at the front of the ring */
+STATIC void s7plcScanRetire(s7plcStation* station)
+{
+    while (station->scanCount &&
+        s7plcScanDone(&station->scanBatches[station->scanFirst]))
+    {
+        station->scanFirst = (station->scanFirst + 1) % S7PLC_SCAN_BATCHES;
+        station->scanCount--;
     }
 }
 
-STATIC void s7plcReceiveThread(s7plcStation* station)
+STATIC void s7plcScanEnd(s7plcStation* station)
 {
-    unsigned char* recvBuf = callocMustSucceed(1, station->inSize, "s7plcReceiveThread");
+    /* a frame without "I/O Intr" records queued has nothing to measure */
+    if (s7plcScanDone(station->scanBatch))
+    {
+        station->scanCount--;
+        s7plcScanRetire(station);
+    }
+    station->scanBatch = NULL;
+    epicsMutexUnlock(station->scanLock);
+}
 
-    s7plcDebugLog(1, "s7plcReceiveThread %s: started\n",
-            station->name);
+#ifdef HAVE_SCAN_COMPLETE
+/*
+ * Called by the callback thread of each priority when it has processed
+ * the "I/O Intr" records of one scanIoRequest. The scan time of a frame
+ * is counted once, when its last completion arrives.
+ */
+STATIC void s7plcScanComplete(void* arg, IOSCANPVT scanPvt, int prio)
+{
+    s7plcStation* station = arg;
+    s7plcCounters* stats = &station->stats;
+    s7plcScanBatch* batch;
+    unsigned int i;
+    double t;
 
-    while (1)
+    epicsMutexMustLock(station->scanLock);
+    for (i = 0; i < station->scanCount; i++)
     {
-        unsigned int input;
-        double timeout;
-        double waitTime;
-        int received;
-        int status;
-        epicsTimeStamp start, end;
-        char errmsg[100];
+        batch = &station->scanBatches[(station->scanFirst + i) % S7PLC_SCAN_BATCHES];
+        if (batch->pending[prio]) break;
+    }
+    if (i < station->scanCount && --batch->pending[prio] == 0 && s7plcScanDone(batch))
+    {
+        t = s7plcMonotonic() - batch->stamp;
+        stats->scansDone++;
+        stats->scanTimeSum += t;
+        if (t > stats->scanTimeMax)
+            stats->scanTimeMax = t;
+        s7plcScanRetire(station);
+    }
+    epicsMutexUnlock(station->scanLock);
+}
+#endif
 
-        /*
-         * Check if the connection is established and establish a new if it isn't - in a
-         * thread-safe manner.
-         */
-        if (s7plcCheckConnection(station) == -1)
+/*
+ * Prints the load of all stations every interval seconds for count
+ * intervals: received frames per second, CPU time of the whole IOC per
+ * frame, mean and max time to complete input scans and callback queue
+ * overflows (EPICS 7.0.2 and later).
+ */
+int s7plcLoadReport(double interval, int count)
+{
+    s7plcStation* station;
+    unsigned long frames, scans;
+    double scanTime, scanMax, lastFrames = 0, lastScans = 0, lastScanTime = 0;
+    clock_t cpu, lastCpu;
+    epicsTimeStamp now, last;
+    unsigned int stations, connected;
+    double t;
+    int i;
+#ifdef HAVE_CALLBACK_STATUS
+    callbackQueueStats queues;
+    int overflows;
+#endif
+
+    if (interval <= 0.0) interval = 10.0;
+    if (count <= 0) count = 1;
+    lastCpu = clock();
+    epicsTimeGetCurrent(&last);
+    for (i = 0; i <= count; i++)
+    {
+        if (i > 0) epicsThreadSleep(interval);
+        epicsTimeGetCurrent(&now);
+        cpu = clock();
+        frames = scans = stations = connected = 0;
+        scanTime = scanMax = 0.0;
+        for (station = s7plcStationList; station; station = station->next)
         {
-            s7plcDebugLog(1,
-                "s7plcMain %s: connect to %s:%d failed. Retry in %g seconds\n",
-                station->name, station->server, station->serverPort,
-                (double)RECONNECT_DELAY);
-            epicsThreadSleep(RECONNECT_DELAY);
-            continue;
+            stations++;
+            if (s7plcConnUp(station)) connected++;
+            frames += station->stats.framesIn;
+            epicsMutexMustLock(station->scanLock);
+            scans += station->stats.scansDone;
+            scanTime += station->stats.scanTimeSum;
+            if (station->stats.scanTimeMax > scanMax)
+                scanMax = station->stats.scanTimeMax;
+            epicsMutexUnlock(station->scanLock);
         }
-
-        input = 0;
-        timeout = station->recvTimeout;
-        /* check (with timeout) for data arrival from server */
-        while (station->sock != INVALID_SOCKET && input < station->inSize)
+        if (i > 0)
         {
-            s7plcDebugLog(3,
-                "s7plcReceiveThread %s: waiting for input on fd %d for %g seconds\n",
-                station->name, station->sock, timeout);
-            epicsTimeGetCurrent(&start);
-            /* Don't lock here! We need to be able to send while we wait */
-            status = s7plcWaitForInput(station, timeout);
-            epicsTimeGetCurrent(&end);
-            waitTime = epicsTimeDiffInSeconds(&end, &start);
-            if (status < 0)
+            t = epicsTimeDiffInSeconds(&now, &last);
+            printf("s7plcLoadReport: stations=%u connected=%u frames/s=%.1f",
+                stations, connected, (frames - lastFrames) / t);
+            if (frames > lastFrames)
+                printf(" cpu/frame=%.1fus",
+                    (double)(cpu - lastCpu) / CLOCKS_PER_SEC * 1e6 / (frames - lastFrames));
+            if (scans > lastScans)
+                printf(" scanTimeMean=%.1fus scanTimeMax=%.1fus",
+                    (scanTime - lastScanTime) / (scans - lastScans) * 1e6,
+                    scanMax * 1e6);
+#ifdef HAVE_CALLBACK_STATUS
+            if (callbackQueueStatus(0, &queues) == 0)
             {
-                epicsSocketConvertErrnoToString(errmsg, sizeof(errmsg));
-                s7plcErrorLog(
-                    "s7plcReceiveThread %s: waiting for input failed: %s\n",
-                    station->name, errmsg);
-                s7plcCloseConnection(station);
-                break;
+                int p;
+                for (overflows = 0, p = 0; p < NUM_CALLBACK_PRIORITIES; p++)
+                    overflows += queues.numOverflow[p];
+                printf(" callbackOverflows=%d", overflows);
             }
-            if (status > 0)
-            {
-                int receiveSize = station->inSize;
+#endif
+            printf("\n");
+        }
+        lastFrames = frames;
+        lastScans = scans;
+        lastScanTime = scanTime;
+        lastCpu = cpu;
+        last = now;
+    }
+    return 0;
+}
 
-                received = recv(station->sock, (void*)(recvBuf+input), receiveSize-input, 0);
-                if (received == 0)
-                {
-                    s7plcErrorLog(
-                        "s7plcReceiveThread %s: connection closed by %s\n",
-                        station->name, station->server);
-                    s7plcCloseConnection(station);
-                    break;
-                }
+int s7plcConfigure(char *name, char* IPaddr, unsigned int port, unsigned int inSize, unsigned int outSize, unsigned int bigEndian, unsigned int recvTimeout, unsigned int sendIntervall)
+{
+    s7plcStation* station;
+    s7plcStation** pstation;
+
+    union {short s; char c [sizeof(short)];} u;
+    u.s=1;
+    bigEndianIoc = !u.c[0];
+    if (!name)
+    {
+        errlogSevPrintf(errlogFatal,
+            "s7plcConfigure: missing name\n");
+        return -1;
+    }
+
+    if (!IPaddr || !IPaddr[0])
+    {
+        IPaddr = NULL;
+        errlogSevPrintf(errlogInfo,
+            "s7plcConfigure: missing IP address or name. Waiting for address set by record.\n");
+    }
+    else
+    if (!port && strncmp(IPaddr, "replay:", 7) != 0
+        && epicsStrCaseCmp(IPaddr, "loopback") != 0)
+    {
+        errlogSevPrintf(errlogFatal,
+            "s7plcConfigure: missing IP port\n");
+        return -1;
+    }
+
+    /* find last station in list */
+    for (pstation = &s7plcStationList; *pstation; pstation = &(*pstation)->next);
+
+    station = callocMustSucceed(1,
+        sizeof(s7plcStation) + 3*inSize + outSize + strlen(name)+1, "s7plcConfigure");
+    station->next = NULL;
+    station->serverPort = port;
+    station->inSize = inSize;
+    station->outSize = outSize;
+    station->inFrame[0].data = (unsigned char*)(station+1);
+    station->inFrame[1].data = (unsigned char*)(station+1)+inSize;
+    station->inFrame[2].data = (unsigned char*)(station+1)+2*inSize;
+    station->inCurrent = &station->inFrame[0];
+    station->inFill = NULL;
+    station->outBuffer = (unsigned char*)(station+1)+3*inSize;
+    station->name = (char*)(station+1)+3*inSize+outSize;
+    strcpy(station->name, name);
+    station->server = IPaddr ? epicsStrDup(IPaddr) : NULL;
+    station->swapBytes = bigEndian ^ bigEndianIoc;
+    station->sock = INVALID_SOCKET;
+    station->transport = &s7plcTcpTransport;
+    station->pairPeer = INVALID_SOCKET;
+    station->inLock = epicsMutexMustCreate();
+    station->outLock = epicsMutexMustCreate();
+    station->connLock = epicsMutexMustCreate();
+    station->scanLock = epicsMutexMustCreate();
+    station->recordLock = epicsMutexMustCreate();
+    if (IPaddr && strncmp(IPaddr, "replay:", 7) == 0)
+        station->replayFile = epicsStrDup(IPaddr+7);
+    station->replaySpeed = 1.0;
+    if (IPaddr && epicsStrCaseCmp(IPaddr, "loopback") == 0)
+    {
+        station->loopback = 1;
+        station->loopBuf = callocMustSucceed(1, outSize + 1, "s7plcConfigure");
+        /* default: output image mirrored to the input image */
+        if (inSize && outSize)
+        {
+            station->loopMap = callocMustSucceed(1, sizeof(s7plcLoopbackMap),
+                "s7plcConfigure");
+            station->loopMap->size = inSize < outSize ? inSize : outSize;
+            station->nloopMap = 1;
+        }
+        station->loopRandom = 8;
+        station->loopSeed = 2463534242u;
+    }
+    station->outputChanged = 0;
+    station->dirtyStart = 0;
+    station->dirtyEnd = outSize;
+    if (station->outSize)
+        station->outTrigger = epicsEventMustCreate(epicsEventEmpty);
+    scanIoInit(&station->inScanPvt);
+    scanIoInit(&station->outScanPvt);
+#ifdef HAVE_SCAN_COMPLETE
+    scanIoSetComplete(station->inScanPvt, s7plcScanComplete, station);
+#endif
+    station->recvThread = NULL;
+    station->sendThread = NULL;
+    station->recvTimeout = recvTimeout > 0 ? recvTimeout/1000.0 : 2.0;
+    station->sendIntervall = sendIntervall > 0 ? sendIntervall/1000.0 : 1.0;
+    station->sendPhase = -1.0;
+    station->sendTimeout = station->recvTimeout;
+    station->connEvent = epicsEventMustCreate(epicsEventEmpty);
+    station->reconnectMin = 1.0;
+    station->reconnectMax = RECONNECT_DELAY;
+    station->reconnectFactor = 2.0;
+    station->reconnectJitter = 0.1;
+    /* different per station and IOC, so that they do not retry in lockstep */
+    station->reconnectSeed = (2463534242u ^ (unsigned int)(size_t)station
+        ^ (unsigned int)(s7plcMonotonic() * 1e6)) | 1;
+    station->resolveTTL = RESOLVE_TTL;
+    station->heartbeat = 10.0;
+    station->sendGap = 0.001;
+    station->fullScan = 1;
+    station->loopPeriod = station->sendIntervall;
+
+    /* append station to list */
+    *pstation = station;
+    pstation = &station->next;
+
+    return 0;
+}
+
+static const iocshArg s7plcConfigureArg0 = { "name", iocshArgString };
+static const iocshArg s7plcConfigureArg1 = { "IPaddr", iocshArgString };
+static const iocshArg s7plcConfigureArg2 = { "IPport", iocshArgInt };
+static const iocshArg s7plcConfigureArg3 = { "inSize", iocshArgInt };
+static const iocshArg s7plcConfigureArg4 = { "outSize", iocshArgInt };
+static const iocshArg s7plcConfigureArg5 = { "bigEndian", iocshArgInt };
+static const iocshArg s7plcConfigureArg6 = { "recvTimeout", iocshArgInt };
+static const iocshArg s7plcConfigureArg7 = { "sendIntervall", iocshArgInt };
+static const iocshArg * const s7plcConfigureArgs[] = {
+    &s7plcConfigureArg0,
+    &s7plcConfigureArg1,
+    &s7plcConfigureArg2,
+    &s7plcConfigureArg3,
+    &s7plcConfigureArg4,
+    &s7plcConfigureArg5,
+    &s7plcConfigureArg6,
+    &s7plcConfigureArg7
+};
+static const iocshFuncDef s7plcConfigureDef = { "s7plcConfigure", 8, s7plcConfigureArgs };
+static void s7plcConfigureFunc (const iocshArgBuf *args)
+{
+    int status = s7plcConfigure(
+        args[0].sval, args[1].sval, args[2].ival,
+        args[3].ival, args[4].ival, args[5].ival,
+        args[6].ival, args[7].ival);
+
+    if (status) exit(1);
+}
+
+int s7plcConfigureReactor(unsigned int shards)
+{
+    if (interruptAccept)
+    {
+        errlogSevPrintf(errlogFatal,
+            "s7plcConfigureReactor: must be called before iocInit\n");
+        return -1;
+    }
+    reactorShards = shards;
+    return 0;
+}
+
+static const iocshArg s7plcConfigureReactorArg0 = { "shards", iocshArgInt };
+static const iocshArg * const s7plcConfigureReactorArgs[] = {
+    &s7plcConfigureReactorArg0
+};
+static const iocshFuncDef s7plcConfigureReactorDef = { "s7plcConfigureReactor", 1, s7plcConfigureReactorArgs };
+static void s7plcConfigureReactorFunc (const iocshArgBuf *args)
+{
+    s7plcConfigureReactor(args[0].ival);
+}
+
+/*
+ * Adds the named block "name:block" to a configured PLC. With a port,
+ * the block has its own connection to the address of the PLC. With
+ * port 0, it is carried in the frames of the PLC at the offsets set by
+ * the blockOffset option. Either way it has its own sizes, period and
+ * "I/O Intr" scans.
+ */
+int s7plcConfigureBlock(char *name, char *block, unsigned int port, unsigned int inSize, unsigned int outSize, unsigned int recvTimeout, unsigned int period)
+{
+    s7plcStation* parent;
+    s7plcStation* station;
+    s7plcStation** pblock;
+    char* blockName;
+
+    if (!name || !block || !block[0])
+    {
+        errlogSevPrintf(errlogFatal,
+            "usage: s7plcConfigureBlock PLCname block port inSize outSize recvTimeout period\n");
+        return -1;
+    }
+    if (interruptAccept)
+    {
+        errlogSevPrintf(errlogFatal,
+            "s7plcConfigureBlock: must be called before iocInit\n");
+        return -1;
+    }
+    parent = s7plcOpen(name);
+    if (!parent) return -1;
+    if (parent->parent)
+    {
+        errlogSevPrintf(errlogFatal,
+            "s7plcConfigureBlock %s: blocks cannot have blocks\n", name);
+        return -1;
+    }
+    if (port && parent->replayFile)
+    {
+        errlogSevPrintf(errlogFatal,
+            "s7plcConfigureBlock %s: blocks of a replay need port 0\n", name);
+        return -1;
+    }
+    blockName = mallocMustSucceed(strlen(name) + strlen(block) + 2,
+        "s7plcConfigureBlock");
+    sprintf(blockName, "%s:%s", name, block);
+    for (station = s7plcStationList; station; station = station->next)
+    {
+        if (strcmp(station->name, blockName) == 0)
+        {
+            errlogSevPrintf(errlogFatal,
+                "s7plcConfigureBlock: %s already exists\n", blockName);
+            free(blockName);
+            return -1;
+        }
+    }
+    if (s7plcConfigure(blockName,
+        parent->loopback ? "loopback" : parent->server,
+        port ? port : (unsigned int)parent->serverPort,
+        inSize, outSize, parent->swapBytes ^ bigEndianIoc,
+        recvTimeout, period) != 0)
+    {
+        free(blockName);
+        return -1;
+    }
+    station = s7plcOpen(blockName);
+    free(blockName);
+    station->parent = parent;
+    station->transport = parent->transport;
+    station->pairBufSize = parent->pairBufSize;
+    if (!port)
+    {
+        /* no connection of its own */
+        station->carrier = parent;
+        station->replayFile = NULL;
+        station->loopback = 0;
+    }
+    for (pblock = &parent->blocks; *pblock; pblock = &(*pblock)->blockNext);
+    *pblock = station;
+    return 0;
+}
+
+static const iocshArg s7plcConfigureBlockArg0 = { "PLCname", iocshArgString };
+static const iocshArg s7plcConfigureBlockArg1 = { "block", iocshArgString };
+static const iocshArg s7plcConfigureBlockArg2 = { "IPport", iocshArgInt };
+static const iocshArg s7plcConfigureBlockArg3 = { "inSize", iocshArgInt };
+static const iocshArg s7plcConfigureBlockArg4 = { "outSize", iocshArgInt };
+static const iocshArg s7plcConfigureBlockArg5 = { "recvTimeout", iocshArgInt };
+static const iocshArg s7plcConfigureBlockArg6 = { "period", iocshArgInt };
+static const iocshArg * const s7plcConfigureBlockArgs[] = {
+    &s7plcConfigureBlockArg0,
+    &s7plcConfigureBlockArg1,
+    &s7plcConfigureBlockArg2,
+    &s7plcConfigureBlockArg3,
+    &s7plcConfigureBlockArg4,
+    &s7plcConfigureBlockArg5,
+    &s7plcConfigureBlockArg6
+};
+static const iocshFuncDef s7plcConfigureBlockDef = { "s7plcConfigureBlock", 7, s7plcConfigureBlockArgs };
+static void s7plcConfigureBlockFunc (const iocshArgBuf *args)
+{
+    int status = s7plcConfigureBlock(
+        args[0].sval, args[1].sval, args[2].ival,
+        args[3].ival, args[4].ival, args[5].ival,
+        args[6].ival);
+
+    if (status) exit(1);
+}
+
+/*
+ * Sends the output over a connection of its own to [host:]port, by a
+ * block named "name:send" that shares the output image of the PLC.
+ */
+STATIC int s7plcSetSendAddr(s7plcStation* station, const char* value)
+{
+    s7plcStation* sender;
+    char* host = NULL;
+    const char* c;
+    int port;
+
+    if (interruptAccept || station->sender || station->parent
+        || s7plcIsLocal(station) || !station->outSize)
+    {
+        errlogSevPrintf(errlogFatal,
+            "s7plcSetOption %s: sendAddr must be set once before iocInit"
+            " for a PLC with output and a connection\n", station->name);
+        return -1;
+    }
+    c = strrchr(value, ':');
+    port = strtol(c ? c+1 : value, NULL, 10);
+    if (port <= 0)
+    {
+        errlogSevPrintf(errlogFatal,
+            "s7plcSetOption %s: sendAddr needs [host:]port\n", station->name);
+        return -1;
+    }
+    if (s7plcConfigureBlock(station->name, "send", port, 0, station->outSize,
+        (unsigned int)(station->recvTimeout * 1000),
+        (unsigned int)(station->sendIntervall * 1000)) != 0)
+        return -1;
+    for (sender = station->blocks; sender->blockNext; sender = sender->blockNext);
+    if (c)
+    {
+        host = epicsStrDup(value);
+        host[c - value] = 0;
+        free(sender->server);
+        sender->server = host;
+    }
+    /* records write to the PLC, the sender takes the data from there */
+    epicsMutexDestroy(sender->outLock);
+    sender->outLock = station->outLock;
+    sender->outBuffer = station->outBuffer;
+    sender->outScanPvt = station->outScanPvt;
+    sender->outSource = station;
+    station->sender = sender;
+    return 0;
+}
+
+/* Selects the transport by name, optionally followed by :args */
+STATIC int s7plcSetTransport(s7plcStation* station, const char* value)
+{
+    const s7plcTransport** t;
+    const char* args = strchr(value, ':');
+    size_t len = args ? (size_t)(args++ - value) : strlen(value);
+
+    if (interruptAccept)
+    {
+        errlogSevPrintf(errlogFatal,
+            "s7plcSetOption %s: transport must be set before iocInit\n",
+            station->name);
+        return -1;
+    }
+    for (t = s7plcTransports; *t; t++)
+    {
+        if (strlen((*t)->name) == len && strncmp((*t)->name, value, len) == 0)
+        {
+            if ((*t)->configure && (*t)->configure(station, args ? args : "") != 0)
+                return -1;
+            station->transport = *t;
+            return 0;
+        }
+    }
+    errlogSevPrintf(errlogFatal,
+        "s7plcSetOption %s: unknown transport %.*s\n",
+        station->name, (int)len, value);
+    return -1;
+}
+
+/*
+ * Parses a list of inOffset:outOffset:size separated by commas or spaces.
+ * An empty list disables the mapping.
+ */
+STATIC int s7plcSetLoopbackMap(s7plcStation* station, const char* value)
+{
+    s7plcLoopbackMap* map;
+    s7plcLoopbackMap* old;
+    unsigned int n = 0, max = 1;
+    const char* p;
+    char* end;
+
+    for (p = value; *p; p++)
+        if (*p == ',') max++;
+    map = callocMustSucceed(max, sizeof(s7plcLoopbackMap), "s7plcSetLoopbackMap");
+    p = value;
+    while (1)
+    {
+        while (*p == ' ' || *p == ',') p++;
+        if (!*p) break;
+        map[n].inOffset = strtoul(p, &end, 0);
+        if (*end != ':') goto error;
+        map[n].outOffset = strtoul(end+1, &end, 0);
+        if (*end != ':') goto error;
+        map[n].size = strtoul(end+1, &end, 0);
+        if (*end && *end != ',' && *end != ' ') goto error;
+        if (map[n].inOffset + map[n].size > station->inSize
+            || map[n].outOffset + map[n].size > station->outSize)
+        {
+            errlogSevPrintf(errlogFatal,
+                "s7plcSetOption %s: loopbackMap %u:%u:%u exceeds inSize %u or outSize %u\n",
+                station->name, map[n].inOffset, map[n].outOffset, map[n].size,
+                station->inSize, station->outSize);
+            free(map);
+            return -1;
+        }
+        p = end;
+        if (++n == max) break;
+    }
+    /* the loopback thread uses the map under outLock */
+    s7plcLock(station->outLock, &station->stats.outLock);
+    old = station->loopMap;
+    station->loopMap = map;
+    station->nloopMap = n;
+    epicsMutexUnlock(station->outLock);
+    free(old);
+    return 0;
+error:
+    errlogSevPrintf(errlogFatal,
+        "s7plcSetOption %s: loopbackMap syntax is inOffset:outOffset:size[,...]\n",
+        station->name);
+    free(map);
+    return -1;
+}
+
+int s7plcSetOption(char *name, char *option, char *value)
+{
+    s7plcStation* station;
+
+    if (!name || !option || !value)
+    {
+        errlogSevPrintf(errlogFatal,
+            "usage: s7plcSetOption PLCname option value\n");
+        return -1;
+    }
+    station = s7plcOpen(name);
+    if (!station) return -1;
+    if (epicsStrCaseCmp(option, "scanOnChange") == 0)
+    {
+        station->scanOnChange = strtol(value, NULL, 0);
+    }
+    else if (epicsStrCaseCmp(option, "heartbeat") == 0)
+    {
+        station->heartbeat = strtod(value, NULL);
+    }
+    else if (epicsStrCaseCmp(option, "latency") == 0)
+    {
+        station->latency = strtol(value, NULL, 0);
+    }
+    else if (epicsStrCaseCmp(option, "latestFrame") == 0)
+    {
+        station->latestFrame = strtol(value, NULL, 0);
+    }
+    else if (epicsStrCaseCmp(option, "sendOnWrite") == 0)
+    {
+        station->sendOnWrite = strtol(value, NULL, 0);
+    }
+    else if (epicsStrCaseCmp(option, "sendGap") == 0)
+    {
+        station->sendGap = strtod(value, NULL);
+    }
+    else if (epicsStrCaseCmp(option, "sendTimeout") == 0)
+    {
+        double timeout = strtod(value, NULL);
+        if (timeout <= 0.0)
+        {
+            errlogSevPrintf(errlogFatal,
+                "s7plcSetOption %s: sendTimeout must be > 0\n", name);
+            return -1;
+        }
+        station->sendTimeout = timeout;
+    }
+    else if (epicsStrCaseCmp(option, "sendPolicy") == 0)
+    {
+        int i;
+        for (i = 0; i < 2; i++)
+            if (epicsStrCaseCmp(value, s7plcSendPolicyNames[i]) == 0) break;
+        if (i == 2)
+        {
+            errlogSevPrintf(errlogFatal,
+                "s7plcSetOption %s: unknown sendPolicy %s\n", name, value);
+            return -1;
+        }
+        station->sendPolicy = i;
+    }
+    else if (epicsStrCaseCmp(option, "reconnectMin") == 0)
+    {
+        double delay = strtod(value, NULL);
+        if (delay <= 0.0)
+        {
+            errlogSevPrintf(errlogFatal,
+                "s7plcSetOption %s: reconnectMin must be > 0\n", name);
+            return -1;
+        }
+        station->reconnectMin = delay;
+    }
+    else if (epicsStrCaseCmp(option, "reconnectMax") == 0)
+    {
+        double delay = strtod(value, NULL);
+        if (delay <= 0.0)
+        {
+            errlogSevPrintf(errlogFatal,
+                "s7plcSetOption %s: reconnectMax must be > 0\n", name);
+            return -1;
+        }
+        station->reconnectMax = delay;
+    }
+    else if (epicsStrCaseCmp(option, "reconnectFactor") == 0)
+    {
+        double factor = strtod(value, NULL);
+        if (factor < 1.0)
+        {
+            errlogSevPrintf(errlogFatal,
+                "s7plcSetOption %s: reconnectFactor must be >= 1\n", name);
+            return -1;
+        }
+        station->reconnectFactor = factor;
+    }
+    else if (epicsStrCaseCmp(option, "reconnectJitter") == 0)
+    {
+        double jitter = strtod(value, NULL);
+        if (jitter < 0.0 || jitter >= 1.0)
+        {
+            errlogSevPrintf(errlogFatal,
+                "s7plcSetOption %s: reconnectJitter must be >= 0 and < 1\n", name);
+            return -1;
+        }
+        station->reconnectJitter = jitter;
+    }
+    else if (epicsStrCaseCmp(option, "probe") == 0)
+    {
+        char* c;
+        double interval = strtod(value, &c);
+        double timeout = interval;
+
+        if (*c == ':') timeout = strtod(c+1, &c);
+        if (*c || interval < 0.0 || (interval > 0.0 && timeout <= 0.0))
+        {
+            errlogSevPrintf(errlogFatal,
+                "s7plcSetOption %s: probe must be interval[:timeout]\n", name);
+            return -1;
+        }
+        station->probeInterval = interval;
+        station->probeTimeout = timeout < CONNECT_TIMEOUT ? timeout : CONNECT_TIMEOUT;
+    }
+    else if (epicsStrCaseCmp(option, "resolveTTL") == 0)
+    {
+        station->resolveTTL = strtod(value, NULL);
+    }
+    else if (epicsStrCaseCmp(option, "sendAddr") == 0)
+    {
+        if (s7plcSetSendAddr(station, value) != 0) return -1;
+    }
+    else if (epicsStrCaseCmp(option, "blockOffset") == 0)
+    {
+        char* c;
+
+        if (!station->carrier)
+        {
+            errlogSevPrintf(errlogFatal,
+                "s7plcSetOption %s: blockOffset needs a block with port 0\n", name);
+            return -1;
+        }
+        station->blockIn = strtoul(value, &c, 0);
+        station->blockOut = *c == ':' ? strtoul(c+1, NULL, 0) : 0;
+    }
+    else if (epicsStrCaseCmp(option, "sendIntervall") == 0)
+    {
+        double intervall = strtod(value, NULL);
+        if (intervall <= 0.0)
+        {
+            errlogSevPrintf(errlogFatal,
+                "s7plcSetOption %s: sendIntervall must be > 0\n", name);
+            return -1;
+        }
+        station->sendIntervall = intervall;
+    }
+    else if (epicsStrCaseCmp(option, "sendPhase") == 0)
+    {
+        station->sendPhase = strtod(value, NULL);
+    }
+    else if (epicsStrCaseCmp(option, "recordFrames") == 0)
+    {
+        station->recordSlots = strtoul(value, NULL, 0);
+    }
+    else if (epicsStrCaseCmp(option, "recordRing") == 0)
+    {
+        station->recordRing = strtol(value, NULL, 0);
+    }
+    else if (epicsStrCaseCmp(option, "record") == 0)
+    {
+        return s7plcRecord(station, value);
+    }
+    else if (epicsStrCaseCmp(option, "replaySpeed") == 0)
+    {
+        station->replaySpeed = strtod(value, NULL);
+    }
+    else if (epicsStrCaseCmp(option, "replayLoop") == 0)
+    {
+        station->replayLoop = strtol(value, NULL, 0);
+    }
+    else if (epicsStrCaseCmp(option, "transport") == 0)
+    {
+        return s7plcSetTransport(station, value);
+    }
+    else if (epicsStrCaseCmp(option, "loopbackMap") == 0)
+    {
+        return s7plcSetLoopbackMap(station, value);
+    }
+    else if (epicsStrCaseCmp(option, "loopbackPattern") == 0)
+    {
+        int i;
+
+        for (i = 0; i <= S7PLC_PATTERN_ALL; i++)
+            if (epicsStrCaseCmp(value, s7plcPatternNames[i]) == 0) break;
+        if (i > S7PLC_PATTERN_ALL)
+        {
+            errlogSevPrintf(errlogFatal,
+                "s7plcSetOption %s: unknown loopbackPattern %s\n", name, value);
+            return -1;
+        }
+        station->loopPattern = i;
+    }
+    else if (epicsStrCaseCmp(option, "loopbackRandom") == 0)
+    {
+        station->loopRandom = strtoul(value, NULL, 0);
+    }
+    else if (epicsStrCaseCmp(option, "loopbackPeriod") == 0)
+    {
+        station->loopPeriod = strtod(value, NULL);
+    }
+    else
+    {
+        errlogSevPrintf(errlogFatal,
+            "s7plcSetOption %s: unknown option %s\n", name, option);
+        return -1;
+    }
+    return 0;
+}
+
+static const iocshArg s7plcSetOptionArg0 = { "PLCname", iocshArgString };
+static const iocshArg s7plcSetOptionArg1 = { "option", iocshArgString };
+static const iocshArg s7plcSetOptionArg2 = { "value", iocshArgString };
+static const iocshArg * const s7plcSetOptionArgs[] = {
+    &s7plcSetOptionArg0,
+    &s7plcSetOptionArg1,
+    &s7plcSetOptionArg2
+};
+static const iocshFuncDef s7plcSetOptionDef = { "s7plcSetOption", 3, s7plcSetOptionArgs };
+static void s7plcSetOptionFunc (const iocshArgBuf *args)
+{
+    s7plcSetOption(args[0].sval, args[1].sval, args[2].sval);
+}
+
+static const iocshArg s7plcStatsArg0 = { "PLCname", iocshArgString };
+static const iocshArg * const s7plcStatsArgs[] = {
+    &s7plcStatsArg0
+};
+static const iocshFuncDef s7plcStatsDef = { "s7plcStats", 1, s7plcStatsArgs };
+static void s7plcStatsFunc (const iocshArgBuf *args)
+{
+    s7plcStats(args[0].sval);
+}
+
+static const iocshArg s7plcLoadReportArg0 = { "interval", iocshArgDouble };
+static const iocshArg s7plcLoadReportArg1 = { "count", iocshArgInt };
+static const iocshArg * const s7plcLoadReportArgs[] = {
+    &s7plcLoadReportArg0,
+    &s7plcLoadReportArg1
+};
+static const iocshFuncDef s7plcLoadReportDef = { "s7plcLoadReport", 2, s7plcLoadReportArgs };
+static void s7plcLoadReportFunc (const iocshArgBuf *args)
+{
+    s7plcLoadReport(args[0].dval, args[1].ival);
+}
+
+static const iocshArg s7plcLatencyArg0 = { "PLCname", iocshArgString };
+static const iocshArg s7plcLatencyArg1 = { "level", iocshArgInt };
+static const iocshArg * const s7plcLatencyArgs[] = {
+    &s7plcLatencyArg0,
+    &s7plcLatencyArg1
+};
+static const iocshFuncDef s7plcLatencyDef = { "s7plcLatency", 2, s7plcLatencyArgs };
+static void s7plcLatencyFunc (const iocshArgBuf *args)
+{
+    s7plcLatency(args[0].sval, args[1].ival);
+}
+
+static const iocshArg s7plcLatencyResetArg0 = { "PLCname", iocshArgString };
+static const iocshArg * const s7plcLatencyResetArgs[] = {
+    &s7plcLatencyResetArg0
+};
+static const iocshFuncDef s7plcLatencyResetDef = { "s7plcLatencyReset", 1, s7plcLatencyResetArgs };
+static void s7plcLatencyResetFunc (const iocshArgBuf *args)
+{
+    s7plcLatencyReset(args[0].sval);
+}
+
+static const iocshArg s7plcTraceDumpArg0 = { "filename", iocshArgString };
+static const iocshArg * const s7plcTraceDumpArgs[] = {
+    &s7plcTraceDumpArg0
+};
+static const iocshFuncDef s7plcTraceDumpDef = { "s7plcTraceDump", 1, s7plcTraceDumpArgs };
+static void s7plcTraceDumpFunc (const iocshArgBuf *args)
+{
+    s7plcTraceDump(args[0].sval);
+}
+
+static void s7plcRegister()
+{
+    iocshRegister(&s7plcConfigureDef, s7plcConfigureFunc);
+    iocshRegister(&s7plcConfigureReactorDef, s7plcConfigureReactorFunc);
+    iocshRegister(&s7plcConfigureBlockDef, s7plcConfigureBlockFunc);
+    iocshRegister(&s7plcSetOptionDef, s7plcSetOptionFunc);
+    iocshRegister(&s7plcStatsDef, s7plcStatsFunc);
+    iocshRegister(&s7plcLoadReportDef, s7plcLoadReportFunc);
+    iocshRegister(&s7plcLatencyDef, s7plcLatencyFunc);
+    iocshRegister(&s7plcLatencyResetDef, s7plcLatencyResetFunc);
+    iocshRegister(&s7plcTraceDumpDef, s7plcTraceDumpFunc);
+}
+
+epicsExportRegistrar(s7plcRegister);
+
+s7plcStation *s7plcOpen(char *name)
+{
+    s7plcStation *station;
+
+    for (station = s7plcStationList; station; station = station->next)
+    {
+        if (strcmp(name, station->name) == 0)
+        {
+            return station;
+        }
+    }
+    errlogSevPrintf(errlogFatal,
+        "s7plcOpen: station %s not found\n", name);
+    return NULL;
+}
+
+IOSCANPVT s7plcGetInScanPvt(s7plcStation *station)
+{
+    return station->inScanPvt;
+}
+
+IOSCANPVT s7plcGetOutScanPvt(s7plcStation *station)
+{
+    return station->outScanPvt;
+}
+
+/*
+ * Returns the IOSCANPVT for input records interested in size bytes
+ * at offset. If bit >= 0, only this bit of the size bytes value counts.
+ * Records with the same range share an IOSCANPVT.
+ * Without scanOnChange, this is the same as s7plcGetInScanPvt.
+ */
+IOSCANPVT s7plcGetInScanPvtRange(s7plcStation *station,
+    unsigned int offset, unsigned int size, int bit)
+{
+    s7plcRange* range;
+    unsigned char mask = 0xff;
+    unsigned int i;
+    IOSCANPVT scanPvt;
+
+    if (!station->scanOnChange) return station->inScanPvt;
+    if (bit >= 0 && (unsigned int)bit < size*8)
+    {
+        /* in big endian byte order bit 0 is in the last byte */
+        if (station->swapBytes ^ bigEndianIoc)
+            offset += size - 1 - bit/8;
+        else
+            offset += bit/8;
+        size = 1;
+        mask = 1 << (bit & 7);
+    }
+    if (offset >= station->inSize) return station->inScanPvt;
+    if (size == 0 || offset+size > station->inSize)
+        size = station->inSize - offset;
+
+    epicsMutexMustLock(station->inLock);
+    for (i = 0; i < station->nranges; i++)
+    {
+        range = &station->ranges[i];
+        if (range->offset == offset && range->size == size && range->mask == mask)
+        {
+            scanPvt = range->scanPvt;
+            epicsMutexUnlock(station->inLock);
+            return scanPvt;
+        }
+    }
+    if (station->nranges == station->maxranges)
+    {
+        s7plcRange* ranges;
+        unsigned int maxranges = station->maxranges ? station->maxranges * 2 : 64;
+        ranges = realloc(station->ranges, maxranges * sizeof(s7plcRange));
+        if (!ranges)
+        {
+            epicsMutexUnlock(station->inLock);
+            s7plcErrorLog(
+                "s7plcGetInScanPvtRange %s: out of memory. Scanning on every frame.\n",
+                station->name);
+            return station->inScanPvt;
+        }
+        station->ranges = ranges;
+        station->maxranges = maxranges;
+    }
+    range = &station->ranges[station->nranges++];
+    range->offset = offset;
+    range->size = size;
+    range->mask = mask;
+    range->triggered = 0;
+    scanIoInit(&range->scanPvt);
+#ifdef HAVE_SCAN_COMPLETE
+    scanIoSetComplete(range->scanPvt, s7plcScanComplete, station);
+#endif
+    station->rangesChanged = 1;
+    scanPvt = range->scanPvt;
+    epicsMutexUnlock(station->inLock);
+    s7plcDebugLog(1,
+        "s7plcGetInScanPvtRange %s: new range %u offset %u size %u mask %02x\n",
+        station->name, station->nranges, offset, size, mask);
+    return scanPvt;
+}
+
+/*
+ * Readers never block the receiver. Without atomic operations (EPICS
+ * before 3.15) the frame pointer swap is protected by inLock instead.
+ */
+static s7plcFrame* s7plcReadBegin(s7plcStation *station, int *seq)
+{
+#ifdef HAVE_ATOMIC
+    s7plcFrame* frame;
+    do {
+        frame = epicsAtomicGetPtrT((EpicsAtomicPtrT*)&station->inCurrent);
+        epicsAtomicReadMemoryBarrier();
+        *seq = epicsAtomicGetIntT(&frame->seq);
+    } while (*seq & 1);
+    epicsAtomicReadMemoryBarrier();
+    return frame;
+#else
+    s7plcLock(station->inLock, &station->stats.inLock);
+    return station->inCurrent;
+#endif
+}
+
+/* Returns 0 if the frame has been recycled while reading. */
+static int s7plcReadEnd(s7plcStation *station, s7plcFrame* frame, int seq)
+{
+    double stamp = frame->stamp;
+
+#ifdef HAVE_ATOMIC
+    epicsAtomicReadMemoryBarrier();
+    if (epicsAtomicGetIntT(&frame->seq) != seq) return 0;
+#else
+    epicsMutexUnlock(station->inLock);
+#endif
+    if (station->latency && stamp > 0.0)
+        s7plcLatencyAdd(&station->latencyIn, s7plcMonotonic() - stamp);
+    return 1;
+}
+
+/*
+ * Copy kernels for s7plcReadArray and s7plcWriteMaskedArray.
+ * Swapping of 2, 4 and 8 byte elements uses bswap builtins and,
+ * on x86 CPUs which support it, SSSE3 or AVX2 byte shuffles.
+ */
+
+#if defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 8)) || defined(__clang__)
+#define BSWAP16(x) __builtin_bswap16(x)
+#define BSWAP32(x) __builtin_bswap32(x)
+#else
+#define BSWAP16(x) ((epicsUInt16)((x) >> 8 | (x) << 8))
+#define BSWAP32(x) ((x) >> 24 | ((x) >> 8 & 0xff00) | ((x) & 0xff00) << 8 | (x) << 24)
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)) || defined(__clang__))
+#include <immintrin.h>
+#define HAVE_SIMD_SWAP
+#endif
+
+STATIC void s7plcSwap2(unsigned char* dst, const unsigned char* src, size_t nelem)
+{
+    epicsUInt16 x;
+    while (nelem--)
+    {
+        memcpy(&x, src, 2);
+        x = BSWAP16(x);
+        memcpy(dst, &x, 2);
+        src += 2;
+        dst += 2;
+    }
+}
+
+STATIC void s7plcSwap4(unsigned char* dst, const unsigned char* src, size_t nelem)
+{
+    epicsUInt32 x;
+    while (nelem--)
+    {
+        memcpy(&x, src, 4);
+        x = BSWAP32(x);
+        memcpy(dst, &x, 4);
+        src += 4;
+        dst += 4;
+    }
+}
+
+STATIC void s7plcSwap8(unsigned char* dst, const unsigned char* src, size_t nelem)
+{
+    /* do not depend on a 64 bit integer type */
+    epicsUInt32 x[2], y;
+    while (nelem--)
+    {
+        memcpy(x, src, 8);
+        y = BSWAP32(x[0]);
+        x[0] = BSWAP32(x[1]);
+        x[1] = y;
+        memcpy(dst, x, 8);
+        src += 8;
+        dst += 8;
+    }
+}
+
+#ifdef HAVE_SIMD_SWAP
+/* byte shuffle patterns for 2, 4 and 8 byte elements in a 16 byte lane */
+static const char s7plcShuffle[3][16] = {
+    { 1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14 },
+    { 3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12 },
+    { 7,6,5,4,3,2,1,0,15,14,13,12,11,10,9,8 }
+};
+
+/* The vector kernels swap whole vectors only and return the number of bytes done. */
+__attribute__((target("ssse3")))
+STATIC size_t s7plcSwapSSSE3(unsigned char* dst, const unsigned char* src, size_t size, int pattern)
+{
+    size_t done;
+    __m128i shuffle = _mm_loadu_si128((const __m128i*)s7plcShuffle[pattern]);
+    for (done = 0; done + 16 <= size; done += 16)
+        _mm_storeu_si128((__m128i*)(dst + done), _mm_shuffle_epi8(
+            _mm_loadu_si128((const __m128i*)(src + done)), shuffle));
+    return done;
+}
+
+__attribute__((target("avx2")))
+STATIC size_t s7plcSwapAVX2(unsigned char* dst, const unsigned char* src, size_t size, int pattern)
+{
+    size_t done;
+    /* _mm256_shuffle_epi8 shuffles within each 16 byte lane */
+    __m256i shuffle = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i*)s7plcShuffle[pattern]));
+    for (done = 0; done + 32 <= size; done += 32)
+        _mm256_storeu_si256((__m256i*)(dst + done), _mm256_shuffle_epi8(
+            _mm256_loadu_si256((const __m256i*)(src + done)), shuffle));
+    return done;
+}
+
+static size_t (*s7plcSwapVector)(unsigned char* dst, const unsigned char* src, size_t size, int pattern);
+
+/* vectors do not pay off for only a few elements */
+#define SIMD_MIN_SIZE 32
+#endif
+
+STATIC void s7plcSelectKernels()
+{
+#ifdef HAVE_SIMD_SWAP
+    static int done = 0;
+    if (done) return;
+    done = 1;
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        s7plcSwapVector = s7plcSwapAVX2;
+    else if (__builtin_cpu_supports("ssse3"))
+        s7plcSwapVector = s7plcSwapSSSE3;
+    s7plcDebugLog(1, "s7plcSelectKernels: using %s swap kernels\n",
+        s7plcSwapVector == s7plcSwapAVX2 ? "AVX2" :
+        s7plcSwapVector == s7plcSwapSSSE3 ? "SSSE3" : "scalar");
+#endif
+}
+
+/* Copy nelem elements of dlen bytes, reversing the byte order if swap is set. */
+STATIC void s7plcCopyArray(unsigned char* dst, const unsigned char* src,
+    unsigned int dlen, unsigned int nelem, int swap)
+{
+    size_t done = 0;
+    unsigned int i;
+
+    if (!swap || dlen == 1)
+    {
+        memcpy(dst, src, (size_t)dlen * nelem);
+        return;
+    }
+#ifdef HAVE_SIMD_SWAP
+    if (s7plcSwapVector && (dlen == 2 || dlen == 4 || dlen == 8)
+        && (size_t)dlen * nelem >= SIMD_MIN_SIZE)
+    {
+        done = s7plcSwapVector(dst, src, (size_t)dlen * nelem, dlen >> 2);
+        dst += done;
+        src += done;
+        nelem -= done / dlen;
+    }
+#endif
+    switch (dlen)
+    {
+        case 2:
+            s7plcSwap2(dst, src, nelem);
+            break;
+        case 4:
+            s7plcSwap4(dst, src, nelem);
+            break;
+        case 8:
+            s7plcSwap8(dst, src, nelem);
+            break;
+        default:
+            for (; nelem; nelem--, src += dlen, dst += dlen)
+                for (i = 0; i < dlen; i++)
+                    dst[dlen - 1 - i] = src[i];
+    }
+}
+
+/* Like s7plcCopyArray but only replace the bits set in the (unswapped) mask. */
+STATIC void s7plcMergeArray(unsigned char* dst, const unsigned char* src,
+    const unsigned char* mask, unsigned int dlen, unsigned int nelem, int swap)
+{
+    unsigned int i, j;
+
+    for (; nelem; nelem--, src += dlen, dst += dlen)
+        for (i = 0; i < dlen; i++)
+        {
+            j = swap ? dlen - 1 - i : i;
+            dst[j] = (src[i] & mask[i]) | (dst[j] & ~mask[i]);
+        }
+}
+
+/*
+ * Writes through a scratch buffer and only touches the output image
+ * if any byte changes. Returns 1 if it did.
+ */
+STATIC int s7plcUpdateArray(unsigned char* dst, const unsigned char* src,
+    const unsigned char* mask, unsigned int dlen, unsigned int nelem, int swap)
+{
+    unsigned char scratch[256];
+    unsigned int n, chunk = sizeof(scratch) / dlen;
+    int changed = 0;
+
+    if (!chunk)
+    {
+        /* huge elements: just write */
+        if (mask)
+            s7plcMergeArray(dst, src, mask, dlen, nelem, swap);
+        else
+            s7plcCopyArray(dst, src, dlen, nelem, swap);
+        return nelem != 0;
+    }
+    while (nelem)
+    {
+        n = nelem < chunk ? nelem : chunk;
+        if (mask)
+        {
+            memcpy(scratch, dst, n*dlen);
+            s7plcMergeArray(scratch, src, mask, dlen, n, swap);
+        }
+        else
+            s7plcCopyArray(scratch, src, dlen, n, swap);
+        if (memcmp(scratch, dst, n*dlen) != 0)
+        {
+            memcpy(dst, scratch, n*dlen);
+            changed = 1;
+        }
+        dst += n*dlen;
+        src += n*dlen;
+        nelem -= n;
+    }
+    return changed;
+}
+
+/* Print one line per element in PLC byte order. */
+STATIC void s7plcDebugData(const char* prefix, const unsigned char* data,
+    unsigned int dlen, unsigned int nelem)
+{
+    char line[3*16+1];
+    unsigned int elem, i, n;
+
+    for (elem = 0; elem < nelem; elem++, data += dlen)
+    {
+        for (i = 0; i < dlen; i += 16)
+        {
+            for (n = 0; n < 16 && i+n < dlen; n++)
+                sprintf(line+3*n, " %02x", data[i+n]);
+            s7plcDebugLog(5, "%s:%s\n", prefix, line);
+        }
+    }
+}
+
+int s7plcReadArray(
+    s7plcStation *station,
+    unsigned int offset,
+    unsigned int dlen,
+    unsigned int nelem,
+    void* data
+)
+{
+    s7plcFrame* frame;
+    int seq;
+
+    if (offset+dlen > station->inSize)
+    {
+       errlogSevPrintf(errlogMajor,
+        "s7plcRead %s/%u: offset out of range\n",
+        station->name, offset);
+       return S_dev_badArgument;
+    }
+    if (offset+nelem*dlen > station->inSize)
+    {
+       errlogSevPrintf(errlogMajor,
+        "s7plcRead %s/%u: too many elements (%u)\n",
+        station->name, offset, nelem);
+       return S_dev_badArgument;
+    }
+    s7plcTraceEvent(READ, station, offset, dlen*nelem);
+    do {
+        frame = s7plcReadBegin(station, &seq);
+        s7plcCopyArray(data, frame->data + offset, dlen, nelem, station->swapBytes);
+    } while (!s7plcReadEnd(station, frame, seq));
+    if (s7plcDebug >= 5)
+        s7plcDebugData("data in", data, dlen, nelem);
+    if (!s7plcConnUp(station)) return S_dev_noDevice;
+    return S_dev_success;
+}
+
+int s7plcWriteMaskedArray(
+    s7plcStation *station,
+    unsigned int offset,
+    unsigned int dlen,
+    unsigned int nelem,
+    void* data,
+    void* mask
+)
+{
+    int changed;
+
+    if (offset+dlen > station->outSize)
+    {
+        errlogSevPrintf(errlogMajor,
+            "s7plcWrite %s/%d: offset out of range\n",
+            station->name, offset);
+        return -1;
+    }
+    if (offset+nelem*dlen > station->outSize)
+    {
+        errlogSevPrintf(errlogMajor,
+            "s7plcWrite %s/%d: too many elements (%u)\n",
+            station->name, offset, nelem);
+        return -1;
+    }
+    s7plcTraceEvent(WRITE, station, offset, dlen*nelem);
+    s7plcLock(station->outLock, &station->stats.outLock);
+    /* like the single value accessors: only changed bytes are written */
+    changed = s7plcUpdateArray(station->outBuffer + offset, data, mask,
+        dlen, nelem, station->swapBytes);
+    if (changed)
+        s7plcMarkWritten(station, offset, dlen*nelem);
+    if (changed || !station->sendOnWrite)
+        station->outputChanged=1;
+    if (s7plcDebug >= 5)
+        s7plcDebugData("data out", station->outBuffer + offset, dlen, nelem);
+    epicsMutexUnlock(station->outLock);
+    if (changed && station->sendOnWrite)
+        s7plcTriggerSend(station);
+    if (!s7plcOutUp(station)) return S_dev_noDevice;
+    return S_dev_success;
+}
+
+/*
+ * Accessors for single values specialised for data length, byte order
+ * and masking. Device support selects them once at record init.
+ * The range is checked at selection, so the accessors do not check it.
+ */
+typedef struct { epicsUInt32 w[2]; } s7plcU64;
+
+#define SWAP_1(x)
+#define SWAP_2(x) x = BSWAP16(x)
+#define SWAP_4(x) x = BSWAP32(x)
+#define SWAP_8(x) do { epicsUInt32 t = BSWAP32(x.w[0]); \
+    x.w[0] = BSWAP32(x.w[1]); x.w[1] = t; } while (0)
+#define NOSWAP(x)
+
+#define MERGE_N(o, x, m) o = (x & m) | (o & ~m)
+#define MERGE_8(o, x, m) do { MERGE_N(o.w[0], x.w[0], m.w[0]); \
+    MERGE_N(o.w[1], x.w[1], m.w[1]); } while (0)
+
+#define S7PLC_READ_FUNC(name, type, swap) \
+STATIC int name(s7plcStation *station, unsigned int offset, void* pdata) \
+{ \
+    s7plcFrame* frame; \
+    type x; \
+    int seq; \
+    s7plcTraceEvent(READ, station, offset, sizeof(type)); \
+    do { \
+        frame = s7plcReadBegin(station, &seq); \
+        memcpy(&x, frame->data + offset, sizeof(x)); \
+    } while (!s7plcReadEnd(station, frame, seq)); \
+    swap(x); \
+    memcpy(pdata, &x, sizeof(x)); \
+    if (!s7plcConnUp(station)) return S_dev_noDevice; \
+    return S_dev_success; \
+}
+
+#define S7PLC_WRITE_FUNC(name, type, swap) \
+STATIC int name(s7plcStation *station, unsigned int offset, const void* pdata) \
+{ \
+    type x; \
+    int changed; \
+    s7plcTraceEvent(WRITE, station, offset, sizeof(type)); \
+    memcpy(&x, pdata, sizeof(x)); \
+    swap(x); \
+    s7plcLock(station->outLock, &station->stats.outLock); \
+    changed = memcmp(station->outBuffer + offset, &x, sizeof(x)) != 0; \
+    memcpy(station->outBuffer + offset, &x, sizeof(x)); \
+    if (changed) s7plcMarkWritten(station, offset, sizeof(x)); \
+    if (changed || !station->sendOnWrite) station->outputChanged=1; \
+    epicsMutexUnlock(station->outLock); \
+    if (changed && station->sendOnWrite) s7plcTriggerSend(station); \
+    if (!s7plcOutUp(station)) return S_dev_noDevice; \
+    return S_dev_success; \
+}
+
+#define S7PLC_WRITE_MASKED_FUNC(name, type, swap, merge) \
+STATIC int name(s7plcStation *station, unsigned int offset, const void* pdata, const void* pmask) \
+{ \
+    type x, m, o; \
+    int changed; \
+    s7plcTraceEvent(WRITE, station, offset, sizeof(type)); \
+    memcpy(&x, pdata, sizeof(x)); \
+    memcpy(&m, pmask, sizeof(m)); \
+    swap(x); \
+    swap(m); \
+    s7plcLock(station->outLock, &station->stats.outLock); \
+    memcpy(&o, station->outBuffer + offset, sizeof(o)); \
+    merge(o, x, m); \
+    changed = memcmp(station->outBuffer + offset, &o, sizeof(o)) != 0; \
+    memcpy(station->outBuffer + offset, &o, sizeof(o)); \
+    if (changed) s7plcMarkWritten(station, offset, sizeof(x)); \
+    if (changed || !station->sendOnWrite) station->outputChanged=1; \
+    epicsMutexUnlock(station->outLock); \
+    if (changed && station->sendOnWrite) s7plcTriggerSend(station); \
+    if (!s7plcOutUp(station)) return S_dev_noDevice; \
+    return S_dev_success; \
+}
+
+S7PLC_READ_FUNC(s7plcRead1, epicsUInt8, NOSWAP)
+S7PLC_READ_FUNC(s7plcRead2, epicsUInt16, NOSWAP)
+S7PLC_READ_FUNC(s7plcRead2Swap, epicsUInt16, SWAP_2)
+S7PLC_READ_FUNC(s7plcRead4, epicsUInt32, NOSWAP)
+S7PLC_READ_FUNC(s7plcRead4Swap, epicsUInt32, SWAP_4)
+S7PLC_READ_FUNC(s7plcRead8, s7plcU64, NOSWAP)
+S7PLC_READ_FUNC(s7plcRead8Swap, s7plcU64, SWAP_8)
+
+S7PLC_WRITE_FUNC(s7plcWrite1, epicsUInt8, NOSWAP)
+S7PLC_WRITE_FUNC(s7plcWrite2, epicsUInt16, NOSWAP)
+S7PLC_WRITE_FUNC(s7plcWrite2Swap, epicsUInt16, SWAP_2)
+S7PLC_WRITE_FUNC(s7plcWrite4, epicsUInt32, NOSWAP)
+S7PLC_WRITE_FUNC(s7plcWrite4Swap, epicsUInt32, SWAP_4)
+S7PLC_WRITE_FUNC(s7plcWrite8, s7plcU64, NOSWAP)
+S7PLC_WRITE_FUNC(s7plcWrite8Swap, s7plcU64, SWAP_8)
+
+S7PLC_WRITE_MASKED_FUNC(s7plcWriteMasked1, epicsUInt8, NOSWAP, MERGE_N)
+S7PLC_WRITE_MASKED_FUNC(s7plcWriteMasked2, epicsUInt16, NOSWAP, MERGE_N)
+S7PLC_WRITE_MASKED_FUNC(s7plcWriteMasked2Swap, epicsUInt16, SWAP_2, MERGE_N)
+S7PLC_WRITE_MASKED_FUNC(s7plcWriteMasked4, epicsUInt32, NOSWAP, MERGE_N)
+S7PLC_WRITE_MASKED_FUNC(s7plcWriteMasked4Swap, epicsUInt32, SWAP_4, MERGE_N)
+S7PLC_WRITE_MASKED_FUNC(s7plcWriteMasked8, s7plcU64, NOSWAP, MERGE_8)
+S7PLC_WRITE_MASKED_FUNC(s7plcWriteMasked8Swap, s7plcU64, SWAP_8, MERGE_8)
+
+/* indexed by [dlen 1,2,4,8][swap] */
+static const s7plcReadFunc s7plcReadFuncs[4][2] = {
+    { s7plcRead1, s7plcRead1 },
+    { s7plcRead2, s7plcRead2Swap },
+    { s7plcRead4, s7plcRead4Swap },
+    { s7plcRead8, s7plcRead8Swap }
+};
+
+static const s7plcWriteFunc s7plcWriteFuncs[4][2] = {
+    { s7plcWrite1, s7plcWrite1 },
+    { s7plcWrite2, s7plcWrite2Swap },
+    { s7plcWrite4, s7plcWrite4Swap },
+    { s7plcWrite8, s7plcWrite8Swap }
+};
+
+static const s7plcWriteMaskedFunc s7plcWriteMaskedFuncs[4][2] = {
+    { s7plcWriteMasked1, s7plcWriteMasked1 },
+    { s7plcWriteMasked2, s7plcWriteMasked2Swap },
+    { s7plcWriteMasked4, s7plcWriteMasked4Swap },
+    { s7plcWriteMasked8, s7plcWriteMasked8Swap }
+};
+
+STATIC int s7plcAccessIndex(unsigned int dlen)
+{
+    switch (dlen)
+    {
+        case 1: return 0;
+        case 2: return 1;
+        case 4: return 2;
+        case 8: return 3;
+        default: return -1;
+    }
+}
+
+/* Returns NULL if there is no specialised accessor or offset is out of range. */
+s7plcReadFunc s7plcGetReadFunc(s7plcStation *station,
+    unsigned int offset, unsigned int dlen)
+{
+    int i = s7plcAccessIndex(dlen);
+    if (i < 0 || offset + dlen > station->inSize) return NULL;
+    return s7plcReadFuncs[i][station->swapBytes != 0];
+}
+
+s7plcWriteFunc s7plcGetWriteFunc(s7plcStation *station,
+    unsigned int offset, unsigned int dlen)
+{
+    int i = s7plcAccessIndex(dlen);
+    if (i < 0 || offset + dlen > station->outSize) return NULL;
+    return s7plcWriteFuncs[i][station->swapBytes != 0];
+}
+
+s7plcWriteMaskedFunc s7plcGetWriteMaskedFunc(s7plcStation *station,
+    unsigned int offset, unsigned int dlen)
+{
+    int i = s7plcAccessIndex(dlen);
+    if (i < 0 || offset + dlen > station->outSize) return NULL;
+    return s7plcWriteMaskedFuncs[i][station->swapBytes != 0];
+}
+
+/*
+ * Decode pass: all scalar input channels registered by the records are
+ * converted once per frame into the frame's value cache, so that reading
+ * a value is a single load.
+ */
+static const unsigned char s7plcKindSize[] = { 1, 1, 2, 2, 4, 4, 4, 8 };
+
+int s7plcAddChannel(s7plcStation *station, unsigned int offset, int kind)
+{
+    unsigned int i;
+    int channel;
+
+    if (kind < 0 || kind > S7PLC_FLOAT64 ||
+        offset + s7plcKindSize[kind] > station->inSize)
+        return -1;
+    epicsMutexMustLock(station->inLock);
+    if (station->planBuilt)
+    {
+        /* too late, the value caches are already allocated */
+        epicsMutexUnlock(station->inLock);
+        return -1;
+    }
+    for (i = 0; i < station->nplan; i++)
+    {
+        if (station->planOffset[i] == offset && station->planKind[i] == kind)
+        {
+            epicsMutexUnlock(station->inLock);
+            return i;
+        }
+    }
+    if (station->nplan == station->maxplan)
+    {
+        station->maxplan = station->maxplan ? station->maxplan * 2 : 64;
+        station->planOffset = realloc(station->planOffset,
+            station->maxplan * sizeof(unsigned int));
+        station->planKind = realloc(station->planKind,
+            station->maxplan * sizeof(unsigned char));
+        if (!station->planOffset || !station->planKind)
+            cantProceed("s7plcAddChannel: out of memory\n");
+    }
+    channel = station->nplan++;
+    station->planOffset[channel] = offset;
+    station->planKind[channel] = kind;
+    epicsMutexUnlock(station->inLock);
+    return channel;
+}
+
+STATIC void s7plcBuildDecodePlan(s7plcStation* station)
+{
+    int i;
+
+    epicsMutexMustLock(station->inLock);
+    station->planBuilt = 1;
+    epicsMutexUnlock(station->inLock);
+    if (!station->nplan) return;
+    s7plcDebugLog(1, "s7plcBuildDecodePlan %s: %u channels\n",
+        station->name, station->nplan);
+    /* nvalues stays 0 until a frame has been decoded */
+    for (i = 0; i < 3; i++)
+        station->inFrame[i].values = callocMustSucceed(station->nplan,
+            sizeof(s7plcValue), "s7plcBuildDecodePlan");
+}
+
+static void s7plcDecode(const unsigned char* p, int kind, int swap, s7plcValue* value)
+{
+    epicsUInt16 x16;
+    epicsUInt32 x32[2], y;
+    epicsFloat32 f32;
+    epicsFloat64 f64;
+
+    switch (kind)
+    {
+        case S7PLC_INT8:
+            value->i = (signed char)p[0];
+            break;
+        case S7PLC_UINT8:
+            value->u = p[0];
+            break;
+        case S7PLC_INT16:
+        case S7PLC_UINT16:
+            memcpy(&x16, p, 2);
+            if (swap) x16 = BSWAP16(x16);
+            if (kind == S7PLC_INT16) value->i = (epicsInt16)x16;
+            else value->u = x16;
+            break;
+        case S7PLC_INT32:
+        case S7PLC_UINT32:
+            memcpy(x32, p, 4);
+            value->u = swap ? BSWAP32(x32[0]) : x32[0];
+            break;
+        case S7PLC_FLOAT32:
+            memcpy(x32, p, 4);
+            if (swap) x32[0] = BSWAP32(x32[0]);
+            memcpy(&f32, x32, 4);
+            value->f = f32;
+            break;
+        case S7PLC_FLOAT64:
+            memcpy(x32, p, 8);
+            if (swap)
+            {
+                y = BSWAP32(x32[0]);
+                x32[0] = BSWAP32(x32[1]);
+                x32[1] = y;
+            }
+            memcpy(&f64, x32, 8);
+            value->f = f64;
+            break;
+    }
+}
+
+STATIC void s7plcDecodeFrame(s7plcStation* station, s7plcFrame* frame)
+{
+    const unsigned char* data = frame->data;
+    const unsigned int* offset = station->planOffset;
+    const unsigned char* kind = station->planKind;
+    s7plcValue* values = frame->values;
+    int swap = station->swapBytes;
+    unsigned int i, n = station->nplan;
+
+    for (i = 0; i < n; i++)
+        s7plcDecode(data + offset[i], kind[i], swap, &values[i]);
+    frame->nvalues = n;
+}
+
+/*
+ * Reads the cached value of a channel. Values of channels that are not
+ * (yet) in the cache are decoded from the input image.
+ */
+int s7plcReadValue(s7plcStation *station, int channel,
+    unsigned int offset, int kind, s7plcValue *value)
+{
+    s7plcFrame* frame;
+    int seq;
+
+    if (kind < 0 || kind > S7PLC_FLOAT64 ||
+        offset + s7plcKindSize[kind] > station->inSize)
+    {
+       errlogSevPrintf(errlogMajor,
+        "s7plcRead %s/%u: offset out of range\n",
+        station->name, offset);
+       return S_dev_badArgument;
+    }
+    s7plcTraceEvent(READ, station, offset, s7plcKindSize[kind]);
+    do {
+        frame = s7plcReadBegin(station, &seq);
+        if (channel >= 0 && (unsigned int)channel < frame->nvalues)
+            *value = frame->values[channel];
+        else
+            s7plcDecode(frame->data + offset, kind, station->swapBytes, value);
+    } while (!s7plcReadEnd(station, frame, seq));
+    if (!s7plcConnUp(station)) return S_dev_noDevice;
+    return S_dev_success;
+}
+
+/*
+ * Returns the buffer to receive the next input frame into.
+ * This is the oldest of the three frames, which is neither the
+ * current one nor the one published before.
+ */
+STATIC unsigned char* s7plcInputFrame(s7plcStation* station)
+{
+    s7plcFrame* frame = station->inFill;
+
+    if (!frame)
+    {
+        frame = station->inFrame + (station->inCurrent - station->inFrame + 1) % 3;
+#ifdef HAVE_ATOMIC
+        /* mark frame as being written */
+        epicsAtomicIncrIntT(&frame->seq);
+        epicsAtomicWriteMemoryBarrier();
+#endif
+        station->inFill = frame;
+    }
+    return frame->data;
+}
+
+/*
+ * Triggers all "I/O Intr" input records.
+ */
+STATIC void s7plcScanAllInputs(s7plcStation* station)
+{
+    unsigned int i;
+
+    s7plcScanBegin(station, s7plcMonotonic());
+    s7plcScanRequest(station, station->inScanPvt);
+    s7plcLock(station->inLock, &station->stats.inLock);
+    for (i = 0; i < station->nranges; i++)
+        s7plcScanRequest(station, station->ranges[i].scanPvt);
+    epicsMutexUnlock(station->inLock);
+    s7plcScanEnd(station);
+}
+
+/*
+ * Takes over the ranges registered by the records into the receiver's
+ * own index, where each word of the input image lists the ranges
+ * overlapping it.
+ */
+STATIC void s7plcBuildRangeIndex(s7plcStation* station)
+{
+    unsigned int nwords = (station->inSize + sizeof(size_t) - 1) / sizeof(size_t);
+    unsigned int i, w, last, total;
+    s7plcRange* range;
+
+    epicsMutexMustLock(station->inLock);
+    free(station->index);
+    station->nindex = station->nranges;
+    station->index = callocMustSucceed(station->nindex, sizeof(s7plcRange),
+        "s7plcBuildRangeIndex");
+    memcpy(station->index, station->ranges, station->nindex * sizeof(s7plcRange));
+    station->rangesChanged = 0;
+    epicsMutexUnlock(station->inLock);
+
+    if (!station->wordStart)
+        station->wordStart = callocMustSucceed(nwords + 1, sizeof(unsigned int),
+            "s7plcBuildRangeIndex");
+    memset(station->wordStart, 0, (nwords + 1) * sizeof(unsigned int));
+    for (i = 0; i < station->nindex; i++)
+    {
+        range = &station->index[i];
+        last = (range->offset + range->size - 1) / sizeof(size_t);
+        for (w = range->offset / sizeof(size_t); w <= last; w++)
+            station->wordStart[w+1]++;
+    }
+    for (w = 0; w < nwords; w++)
+        station->wordStart[w+1] += station->wordStart[w];
+    total = station->wordStart[nwords];
+    free(station->wordRanges);
+    station->wordRanges = callocMustSucceed(total, sizeof(unsigned int),
+        "s7plcBuildRangeIndex");
+    for (i = 0; i < station->nindex; i++)
+    {
+        range = &station->index[i];
+        last = (range->offset + range->size - 1) / sizeof(size_t);
+        for (w = range->offset / sizeof(size_t); w <= last; w++)
+            station->wordRanges[station->wordStart[w]++] = i;
+    }
+    /* filling has moved each start to the next word */
+    for (w = nwords; w > 0; w--)
+        station->wordStart[w] = station->wordStart[w-1];
+    station->wordStart[0] = 0;
+}
+
+/*
+ * Compares the new frame to the previous one word by word and triggers
+ * the ranges containing changed bytes (or bits).
+ */
+STATIC void s7plcScanChanged(s7plcStation* station,
+    const unsigned char* prev, const unsigned char* data)
+{
+    unsigned int base, end, lo, hi, i, k;
+    size_t a, b;
+    s7plcRange* range;
+
+    if (station->rangesChanged)
+        s7plcBuildRangeIndex(station);
+    if (!station->nindex) return;
+    station->frameCount++;
+    for (base = 0; base < station->inSize; base += sizeof(size_t))
+    {
+        end = base + sizeof(size_t);
+        if (end <= station->inSize)
+        {
+            memcpy(&a, prev + base, sizeof(size_t));
+            memcpy(&b, data + base, sizeof(size_t));
+            if (a == b) continue;
+        }
+        else
+        {
+            end = station->inSize;
+            if (memcmp(prev + base, data + base, end - base) == 0) continue;
+        }
+        for (k = station->wordStart[base / sizeof(size_t)];
+            k < station->wordStart[base / sizeof(size_t) + 1]; k++)
+        {
+            range = &station->index[station->wordRanges[k]];
+            if (range->triggered == station->frameCount) continue;
+            lo = range->offset > base ? range->offset : base;
+            hi = range->offset + range->size < end ? range->offset + range->size : end;
+            for (i = lo; i < hi; i++)
+            {
+                if ((prev[i] ^ data[i]) & range->mask)
+                {
+                    range->triggered = station->frameCount;
+                    s7plcScanRequest(station, range->scanPvt);
+                    break;
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Makes the completely received frame the current input image and
+ * triggers the "I/O Intr" input records.
+ */
+STATIC void s7plcPublishInput(s7plcStation* station)
+{
+    s7plcFrame* frame = station->inFill;
+    s7plcFrame* prev = station->inCurrent;
+    epicsTimeStamp now;
+    s7plcCounters* stats = &station->stats;
+    double t, period;
+
+    t = s7plcMonotonic();
+    /* lastFrame is cleared when the connection is lost */
+    if (stats->lastFrame > 0.0)
+    {
+        period = t - stats->lastFrame;
+        if (!stats->periods || period < stats->periodMin)
+            stats->periodMin = period;
+        if (period > stats->periodMax)
+            stats->periodMax = period;
+        stats->periodSum += period;
+        stats->periodSumSq += period * period;
+        stats->periods++;
+    }
+    stats->lastFrame = t;
+    stats->framesIn++;
+    frame->stamp = t;
+    s7plcRecordFrame(station, S7PLC_RECORD_IN, frame->data, station->inSize);
+    s7plcTraceEvent(PUBLISH, station, 0, station->inSize);
+    S7PLC_PROBE2(frame_published, station->name, stats->framesIn);
+
+    if (!station->planBuilt && interruptAccept)
+        s7plcBuildDecodePlan(station);
+    if (frame->values)
+        s7plcDecodeFrame(station, frame);
+#ifdef HAVE_ATOMIC
+    epicsAtomicWriteMemoryBarrier();
+    epicsAtomicIncrIntT(&frame->seq);
+    epicsAtomicWriteMemoryBarrier();
+    epicsAtomicSetPtrT((EpicsAtomicPtrT*)&station->inCurrent, frame);
+#else
+    s7plcLock(station->inLock, &station->stats.inLock);
+    station->inCurrent = frame;
+    epicsMutexUnlock(station->inLock);
+#endif
+    station->inFill = NULL;
+    if (station->blocks) s7plcPublishBlocks(station, frame);
+    if (station->scanOnChange)
+    {
+        epicsTimeGetCurrent(&now);
+        if (station->heartbeat > 0.0 &&
+            epicsTimeDiffInSeconds(&now, &station->lastFullScan) >= station->heartbeat)
+            station->fullScan = 1;
+        if (!station->fullScan)
+        {
+            /* notify "I/O Intr" input records for changed data only */
+            s7plcDebugLog(3,
+                "s7plcPublishInput %s: receive successful, notify changed input records\n",
+                station->name);
+            s7plcScanBegin(station, t);
+            s7plcScanRequest(station, station->inScanPvt);
+            s7plcScanChanged(station, prev->data, frame->data);
+            s7plcScanEnd(station);
+            return;
+        }
+        station->fullScan = 0;
+        station->lastFullScan = now;
+    }
+    /* notify all "I/O Intr" input records */
+    s7plcDebugLog(3,
+        "s7plcPublishInput %s: receive successful, notify all input records\n",
+        station->name);
+    s7plcScanAllInputs(station);
+}
+
+/*
+ * Publishes the parts of a received frame that belong to the blocks
+ * carried in it, each block at most once per period.
+ */
+STATIC void s7plcPublishBlocks(s7plcStation* station, s7plcFrame* frame)
+{
+    s7plcStation* block;
+
+    for (block = station->blocks; block; block = block->blockNext)
+    {
+        if (!block->carrier || !block->inSize) continue;
+        if (frame->stamp < block->blockDeadline) continue;
+        s7plcNextDeadline(&block->blockDeadline, block->sendIntervall, frame->stamp);
+        memcpy(s7plcInputFrame(block), frame->data + block->blockIn, block->inSize);
+        s7plcPublishInput(block);
+    }
+}
+
+/*
+ * Takes the output of the blocks carried in the frames of this station
+ * into its output image, each block once per period or, with
+ * sendOnWrite, as soon as it has changed.
+ */
+STATIC void s7plcMergeBlocks(s7plcStation* station)
+{
+    s7plcStation* block;
+    double now = s7plcMonotonic();
+    unsigned int start, size;
+    int due;
+
+    for (block = station->blocks; block; block = block->blockNext)
+    {
+        if (!block->carrier || !block->outSize) continue;
+        due = now >= block->sendDeadline;
+        if (due)
+            s7plcSendCycle(block, now,
+                interruptAccept && s7plcIsConnected(station));
+        if (block->outputChanged && (due || block->sendOnWrite))
+        {
+            s7plcLock(block->outLock, &block->stats.outLock);
+            start = block->dirtyStart;
+            size = block->dirtyEnd > start ? block->dirtyEnd - start : 0;
+            s7plcLock(station->outLock, &station->stats.outLock);
+            if (size)
+            {
+                memcpy(station->outBuffer + block->blockOut + start,
+                    block->outBuffer + start, size);
+                if (station->dirtyEnd <= station->dirtyStart)
+                    station->outStamp = block->outStamp;
+                s7plcMarkDirty(station, block->blockOut + start, size);
+            }
+            station->outputChanged = 1;
+            epicsMutexUnlock(station->outLock);
+            block->stats.bytesCopied += size;
+            block->dirtyStart = block->outSize;
+            block->dirtyEnd = 0;
+            block->outputChanged = 0;
+            epicsMutexUnlock(block->outLock);
+            block->stats.framesOut++;
+            block->stats.bytesOut += block->outSize;
+        }
+        if (due && interruptAccept)
+        {
+            /* notify all "I/O Intr" output records of the block */
+            scanIoRequest(block->outScanPvt);
+            block->stats.outScans++;
+        }
+    }
+}
+
+/*
+ * A sender shares the output image and outLock of the PLC it sends for,
+ * so only the range written since the last send is handed over.
+ */
+STATIC void s7plcTakeOutput(s7plcStation* station)
+{
+    s7plcStation* source = station->outSource;
+
+    if (source->blocks) s7plcMergeBlocks(source);
+    if (!source->outputChanged) return;
+    s7plcLock(station->outLock, &station->stats.outLock);
+    if (source->dirtyEnd > source->dirtyStart)
+    {
+        if (station->dirtyEnd <= station->dirtyStart)
+            station->outStamp = source->outStamp;
+        s7plcMarkDirty(station, source->dirtyStart,
+            source->dirtyEnd - source->dirtyStart);
+    }
+    station->outputChanged = 1;
+    source->dirtyStart = source->outSize;
+    source->dirtyEnd = 0;
+    source->outputChanged = 0;
+    epicsMutexUnlock(station->outLock);
+}
+
+/*
+ * Restarts the frame period statistics of the station and its blocks.
+ * Called by the receiver when the frames stop.
+ */
+STATIC void s7plcFramesLost(s7plcStation* station)
+{
+    s7plcStation* block;
+
+    station->stats.lastFrame = 0.0;
+    for (block = station->blocks; block; block = block->blockNext)
+        block->stats.lastFrame = 0.0;
+}
+
+/* Lets the input records of the carried blocks see a lost connection. */
+STATIC void s7plcScanBlocks(s7plcStation* station)
+{
+    s7plcStation* block;
+
+    for (block = station->blocks; block; block = block->blockNext)
+    {
+        if (!block->carrier || !block->inSize) continue;
+        block->blockDeadline = 0.0;
+        block->fullScan = 1;
+        s7plcScanAllInputs(block);
+    }
+}
+
+/*
+ * In sendOnWrite mode, a write that changes the output image wakes
+ * the sender at once.
+ */
+STATIC void s7plcTriggerSend(s7plcStation* station)
+{
+    /* a carried block is sent with the frame of its parent */
+    if (station->carrier) station = station->carrier;
+    if (station->sender) station = station->sender;
+#ifdef HAVE_EPOLL
+    if (station->reactor)
+    {
+        station->sendRequest = 1;
+        s7plcReactorWake(station);
+        return;
+    }
+#endif
+    epicsEventSignal(station->outTrigger);
+}
+
+/*
+ * Prepares the next frame in sendBuf if any output record has written
+ * since the last call or if force is set. sendBuf keeps the previous
+ * frame, so only the dirty range of the output image is copied while
+ * records are locked out. Returns 1 if there is data to send.
+ */
+STATIC int s7plcFetchOutput(s7plcStation* station, char* sendBuf, int force)
+{
+    if (station->outSource) s7plcTakeOutput(station);
+    if (station->blocks) s7plcMergeBlocks(station);
+    if (!station->outputChanged && !force) return 0;
+    s7plcLock(station->outLock, &station->stats.outLock);
+    /* keep-alive without changed data has no latency */
+    station->sendStamp = station->dirtyEnd > station->dirtyStart ?
+        station->outStamp : 0.0;
+    if (station->dirtyEnd > station->dirtyStart)
+    {
+        memcpy(sendBuf + station->dirtyStart, station->outBuffer + station->dirtyStart,
+            station->dirtyEnd - station->dirtyStart);
+        station->stats.bytesCopied += station->dirtyEnd - station->dirtyStart;
+        station->dirtyStart = station->outSize;
+        station->dirtyEnd = 0;
+    }
+    station->outputChanged = 0;
+    epicsMutexUnlock(station->outLock);
+    return 1;
+}
+
+/* Accounts a send cycle started at stats.sendStart. */
+STATIC void s7plcSendDone(s7plcStation* station, double now)
+{
+    double t = now - station->stats.sendStart;
+
+    station->stats.sendCycles++;
+    station->stats.sendTimeSum += t;
+    if (t > station->stats.sendTimeMax)
+        station->stats.sendTimeMax = t;
+    if (station->latency && station->sendStamp > 0.0)
+        s7plcLatencyAdd(&station->latencyOut, now - station->sendStamp);
+}
+
+/*
+ * Sends the rest of the pending frame, resuming after partial writes,
+ * so normally with a single call. Waits for the PLC to take more data
+ * until the s7plcMonotonic time until at most. Returns 1 when the frame
+ * is complete, 0 when it is still pending and -1 on error.
+ */
+STATIC int s7plcSendFrame(s7plcStation* station, const char* sendBuf, double until)
+{
+    double now;
+    int n;
+
+    while (station->sendPos < station->sendLen)
+    {
+        n = station->transport->send(station, station->sock,
+            sendBuf + station->sendPos, station->sendLen - station->sendPos);
+        if (n < 0 && SOCKERRNO == EINTR) continue;
+        if (n < 0 && (SOCKERRNO == EAGAIN || SOCKERRNO == EWOULDBLOCK))
+        {
+            /* socket full: the PLC does not read fast enough */
+            now = s7plcMonotonic();
+            if (now >= until) return 0;
+            station->stats.sendBlocks++;
+            n = station->transport->waitOut(station, until - now);
+            station->stats.blockedTime += s7plcMonotonic() - now;
+            if (n < 0) return -1;
+            continue;
+        }
+        if (n <= 0) return -1;
+        station->stats.sendCalls++;
+        if (station->sendPos + n < station->sendLen)
+            station->stats.partialSends++;
+        s7plcTraceEvent(SEND, station, station->sendPos, n);
+        station->sendPos += n;
+    }
+    return 1;
+}
+
+/*
+ * The PLC has not taken the pending frame within sendTimeout. With the
+ * reconnect policy, returns -1 to drop the connection. With the drop
+ * policy, the frame stays pending and newer data replaces it as long as
+ * none of it has been sent. Send cycles meanwhile count as droppedFrames.
+ */
+STATIC int s7plcSendTimeout(s7plcStation* station, double now)
+{
+    station->stats.sendTimeouts++;
+    S7PLC_PROBE2(send_timeout, station->name, station->sendPos);
+    if (station->sendPolicy == S7PLC_SEND_RECONNECT)
+    {
+        s7plcErrorLog(
+            "s7plcSendThread %s: PLC took %u of %u bytes in %g seconds, reconnecting\n",
+            station->name, station->sendPos, station->sendLen, station->sendTimeout);
+        station->sendLen = 0;
+        return -1;
+    }
+    if (!station->sendLate)
+    {
+        s7plcErrorLog(
+            "s7plcSendThread %s: PLC took %u of %u bytes in %g seconds, sending newest data only\n",
+            station->name, station->sendPos, station->sendLen, station->sendTimeout);
+        station->sendLate = 1;
+    }
+    station->sendExpire = now + station->sendTimeout;
+    return 0;
+}
+
+/* Samples the bytes not yet taken by the PLC: rest of frame and socket queue. */
+STATIC void s7plcSampleQueue(s7plcStation* station, SOCKET sock)
+{
+    unsigned long queued = station->sendLen > station->sendPos
+        ? station->sendLen - station->sendPos : 0;
+#ifdef SIOCOUTQ
+    int n;
+
+    if (ioctl(sock, SIOCOUTQ, &n) == 0 && n > 0)
+        queued += n;
+#endif
+    station->stats.sendQueue = queued;
+    if (queued > station->stats.sendQueueMax)
+        station->stats.sendQueueMax = queued;
+}
+
+STATIC void s7plcSendThread(s7plcStation* station)
+{
+    char* sendBuf = callocMustSucceed(1, station->outSize, "s7plcSendThread");
+    char errmsg[100];
+    epicsTimeStamp lastSend, now;
+    int keepAlive, down = 0;
+    double wait, cycle;
+    unsigned long frameConnect = 0;
+
+    epicsTimeGetCurrent(&lastSend);
+    s7plcDebugLog(1, "s7plcSendThread %s: started\n",
+            station->name);
+
+    while (1)
+    {
+        /*
+         * Check if the connection is established and establish a new if it isn't - in a
+         * thread-safe manner.
+         */
+        if (!s7plcIsLocal(station) && s7plcCheckConnection(station) == -1)
+        {
+            s7plcDebugLog(1,
+                "s7plcMain %s: not connected to %s:%d. Retry in %g seconds\n",
+                station->name, station->server, station->serverPort,
+                station->reconnectTime - s7plcMonotonic());
+            s7plcWaitForConnect(station);
+            down = 1;
+            continue;
+        }
+        if (down)
+        {
+            /* no cycles ran while waiting: resume in phase, without overruns */
+            down = 0;
+            station->stats.lastCycle = 0.0;
+            cycle = s7plcMonotonic();
+            if (station->sendDeadline <= cycle)
+                s7plcNextDeadline(&station->sendDeadline, station->sendIntervall, cycle);
+        }
+
+        keepAlive = s7plcWaitForSend(station);
+        if (keepAlive)
+        {
+            cycle = s7plcMonotonic();
+            S7PLC_PROBE2(send_cycle, station->name, (int)((cycle - station->sendDeadline) * 1e6));
+            s7plcSendCycle(station, cycle,
+                interruptAccept && s7plcIsConnected(station));
+        }
+        s7plcDebugLog(2, "s7plcSendThread %s: look for data to send\n",
+            station->name);
+
+        if (interruptAccept && s7plcIsConnected(station))
+        {
+            int sent = 0;
+
+            if (station->sendOnWrite && !keepAlive)
+            {
+                /* woken by a write: coalesce writes within sendGap */
+                epicsTimeGetCurrent(&now);
+                wait = station->sendGap - epicsTimeDiffInSeconds(&now, &lastSend);
+                if (wait > 0.0) epicsThreadSleep(wait);
+            }
+            /* a frame pending on a lost connection is not resumed */
+            if (station->sendLen && station->stats.connects != frameConnect)
+                station->sendLen = 0;
+            if (station->sendLen)
+            {
+                /* the PLC has not taken the last frame yet */
+                if (keepAlive)
+                {
+                    /* the frame of this cycle is lost, not every write */
+                    station->stats.droppedFrames++;
+                }
+                if (!station->sendPos)
+                    s7plcFetchOutput(station, sendBuf, 0);
+            }
+            /* in sendOnWrite mode the periodic send is a keep-alive */
+            else if (s7plcFetchOutput(station, sendBuf, station->sendOnWrite && keepAlive))
+            {
+                s7plcDebugLog(2,
+                    "s7plcSendThread %s: sending %d bytes\n",
+                    station->name, station->outSize);
+                S7PLC_PROBE2(send_start, station->name, station->outSize);
+                station->stats.sendStart = s7plcMonotonic();
+                station->sendPos = 0;
+                station->sendLen = station->outSize;
+                station->sendExpire = station->stats.sendStart + station->sendTimeout;
+                frameConnect = station->stats.connects;
+                /* sendGap counts from the start of the last frame */
+                epicsTimeGetCurrent(&lastSend);
+            }
+            if (station->sendLen && s7plcIsConnected(station))
+            {
+                int status = 1;
+                if (s7plcIsLocal(station))
+                {
+                    /* there is no PLC, only record or loop back the output */
+                    station->sendPos = station->sendLen;
+                    if (station->loopback)
+                    {
+                        s7plcLock(station->outLock, &station->stats.outLock);
+                        memcpy(station->loopBuf, sendBuf, station->outSize);
+                        epicsMutexUnlock(station->outLock);
+                    }
+                }
+                else
+                {
+                    /* wait for the PLC until the next cycle at most */
+                    status = s7plcSendFrame(station, sendBuf,
+                        station->sendExpire < station->sendDeadline
+                        ? station->sendExpire : station->sendDeadline);
+                    s7plcSampleQueue(station, station->sock);
+                }
+                if (status < 0)
+                {
+                    epicsSocketConvertErrnoToString(errmsg, sizeof(errmsg));
+                    s7plcErrorLog(
+                        "s7plcSendThread %s: send(%d, ..., %d, 0) failed: %s\n",
+                        station->name,
+                        station->sock, station->sendLen - station->sendPos, errmsg);
+                    station->sendLen = 0;
+                    s7plcCloseConnection(station);
+                }
+                else if (status > 0)
+                {
+                    S7PLC_PROBE2(send_end, station->name, station->sendLen);
+                    s7plcRecordFrame(station, S7PLC_RECORD_OUT, sendBuf, station->sendLen);
+                    station->stats.bytesOut += station->sendLen;
+                    station->stats.framesOut++;
+                    s7plcSendDone(station, s7plcMonotonic());
+                    station->sendLen = 0;
+                    station->sendLate = 0;
+                    sent = 1;
+                }
+                else
+                {
+                    cycle = s7plcMonotonic();
+                    if (cycle >= station->sendExpire
+                        && s7plcSendTimeout(station, cycle) < 0)
+                        s7plcCloseConnection(station);
+                }
+            }
+            /*
+             * Notify all "I/O Intr" output records once per send cycle
+             * and once per frame sent on write, not for every write.
+             */
+            if (keepAlive || sent)
+            {
+                s7plcDebugLog(2,
+                    "s7plcSendThread %s: send cycle done, notify all output records\n",
+                    station->name);
+                scanIoRequest(station->outScanPvt);
+                station->stats.outScans++;
+            }
+        }
+    }
+}
+
+STATIC void s7plcReceiveThread(s7plcStation* station)
+{
+    unsigned char* recvBuf;
+
+    s7plcDebugLog(1, "s7plcReceiveThread %s: started\n",
+            station->name);
+
+    while (1)
+    {
+        unsigned int input;
+        double timeout;
+        double waitTime;
+        int received = 0;
+        int status;
+        epicsTimeStamp start, end;
+        char errmsg[100];
+
+        /*
+         * Check if the connection is established and establish a new if it isn't - in a
+         * thread-safe manner.
+         */
+        if (s7plcCheckConnection(station) == -1)
+        {
+            s7plcDebugLog(1,
+                "s7plcMain %s: not connected to %s:%d. Retry in %g seconds\n",
+                station->name, station->server, station->serverPort,
+                station->reconnectTime - s7plcMonotonic());
+            s7plcWaitForConnect(station);
+            continue;
+        }
+
+        input = 0;
+        recvBuf = s7plcInputFrame(station);
+        timeout = station->recvTimeout;
+        /* check (with timeout) for data arrival from server */
+        while (station->sock != INVALID_SOCKET && input < station->inSize)
+        {
+            s7plcDebugLog(3,
+                "s7plcReceiveThread %s: waiting for input on fd %d for %g seconds\n",
+                station->name, station->sock, timeout);
+            epicsTimeGetCurrent(&start);
+            /* Don't lock here! We need to be able to send while we wait */
+            if (station->transport->recvAll)
+            {
+                /* one call for the rest of the frame, straight into the frame */
+                received = station->transport->recvAll(station, station->sock,
+                    recvBuf+input, station->inSize-input);
+                if (received < 0 && SOCKERRNO == EINTR) continue;
+                status = 1;
+                if (received < 0 && (SOCKERRNO == EAGAIN || SOCKERRNO == EWOULDBLOCK))
+                {
+                    S7PLC_PROBE2(wait_timeout, station->name, (int)(timeout * 1000));
+                    s7plcErrorLog(
+                        "s7plcReceiveThread %s: timeout after %g seconds.\n",
+                        station->name, timeout);
+                    SET_TIMEOUT_ERROR;
+                    status = -1;
+                }
+            }
+            else
+                status = station->transport->wait(station, timeout);
+            epicsTimeGetCurrent(&end);
+            waitTime = epicsTimeDiffInSeconds(&end, &start);
+            station->stats.waitTime += waitTime;
+            if (status < 0)
+            {
+                epicsSocketConvertErrnoToString(errmsg, sizeof(errmsg));
+                s7plcErrorLog(
+                    "s7plcReceiveThread %s: waiting for input failed: %s\n",
+                    station->name, errmsg);
+                s7plcCloseConnection(station);
+                break;
+            }
+            if (status > 0)
+            {
+                int receiveSize = station->inSize;
+
+                if (!station->transport->recvAll)
+                    received = station->transport->recv(station, station->sock,
+                        recvBuf+input, receiveSize-input);
+                if (received == 0)
+                {
+                    double now = s7plcMonotonic();
+
+                    s7plcErrorLog(
+                        "s7plcReceiveThread %s: connection closed by %s\n",
+                        station->name, station->server ? station->server : station->transport->name);
+                    s7plcCloseConnection(station);
+                    station->reconnectTime = now + s7plcPeerClosed(station, now);
+                    break;
+                }
                 if (received < 0)
                 {
                     epicsSocketConvertErrnoToString(errmsg, sizeof(errmsg));
                     s7plcErrorLog(
-                        "s7plcReceiveThread %s: recv(%d, ..., %d, 0) failed: %s\n",
-                        station->name,
-                        station->sock, station->inSize-input, errmsg);
-                    s7plcCloseConnection(station);
-                    break;
+                        "s7plcReceiveThread %s: recv(%d, ..., %d, 0) failed: %s\n",
+                        station->name,
+                        station->sock, station->inSize-input, errmsg);
+                    s7plcCloseConnection(station);
+                    break;
+                }
+                s7plcTraceEvent(RECV, station, input, received);
+                station->stats.recvCalls++;
+                station->stats.bytesIn += received;
+                if ((unsigned int)received < receiveSize-input)
+                    station->stats.partialRecvs++;
+                s7plcDebugLog(1,
+                    "s7plcReceiveThread %s: received %4d of %4d bytes after %.6f seconds\n",
+                    station->name, received, receiveSize-input, waitTime);
+                if (s7plcDebug >= 4)
+                    hexdump(recvBuf+input, received, 1);
+                input += received;
+            }
+            if (status <= 0 && timeout > 0.0)
+            {
+                epicsSocketConvertErrnoToString(errmsg, sizeof(errmsg));
+                s7plcErrorLog(
+                    "s7plcReceiveThread %s: read error after %d of %d bytes: %s\n",
+                    station->name,
+                    input, station->inSize, errmsg);
+                s7plcCloseConnection(station);
+                break;
+            }
+        }
+        if (station->sock != INVALID_SOCKET)
+            S7PLC_PROBE2(frame_received, station->name, input);
+        if (station->sock != INVALID_SOCKET && station->latestFrame
+            && s7plcSkipStale(station, station->sock, recvBuf) < 0)
+        {
+            s7plcCloseConnection(station);
+        }
+        if (station->sock != INVALID_SOCKET)
+        {
+            s7plcPublishInput(station);
+        }
+        else
+        {
+            s7plcFramesLost(station);
+            s7plcDebugLog(1,
+                "s7plcReceiveThread %s: connection down, waiting for reconnect\n",
+                station->name);
+            /* lost connection */
+            s7plcWaitForConnect(station);
+        }
+    }
+}
+
+/*
+ * Replays the input frames of a recording instead of receiving them from
+ * a PLC. The original timing is scaled by replaySpeed, 0 replays as fast
+ * as possible. The station counts as connected while the replay runs.
+ */
+STATIC void s7plcReplayThread(s7plcStation* station)
+{
+    FILE* file;
+    s7plcRecordHeader header;
+    s7plcRecordSlot* slot = NULL;
+    double count, first, i, n;
+    double start = 0.0, stamp, stamp0 = 0.0, wait;
+    unsigned long frames;
+
+    s7plcDebugLog(1, "s7plcReplayThread %s: started\n",
+            station->name);
+
+    file = fopen(station->replayFile, "rb");
+    if (!file)
+    {
+        s7plcErrorLog("s7plcReplayThread %s: cannot open %s: %s\n",
+            station->name, station->replayFile, strerror(errno));
+        return;
+    }
+    if (fread(&header, sizeof(header), 1, file) != 1
+        || memcmp(header.magic, S7PLC_RECORD_MAGIC, sizeof(header.magic)) != 0
+        || header.byteOrder != 0x01020304
+        || header.inSize != station->inSize
+        || header.slotSize < sizeof(s7plcRecordSlot) + header.inSize)
+    {
+        s7plcErrorLog("s7plcReplayThread %s: %s is no recording of %u input bytes\n",
+            station->name, station->replayFile, station->inSize);
+        fclose(file);
+        return;
+    }
+    slot = callocMustSucceed(1, header.slotSize, "s7plcReplayThread");
+
+    /* replayed scans would be lost before iocInit has finished */
+    while (!interruptAccept)
+        epicsThreadSleep(0.1);
+
+    epicsMutexMustLock(station->connLock);
+    station->localConnected = 1;
+    station->stats.connects++;
+    epicsMutexUnlock(station->connLock);
+    s7plcErrorLog("s7plcReplayThread %s: replaying %s\n",
+        station->name, station->replayFile);
+
+    do
+    {
+        /* re-read header, the file may still be recorded */
+        if (fseek(file, 0, SEEK_SET) != 0
+            || fread(&header, sizeof(header), 1, file) != 1)
+            break;
+        count = header.countHigh * 4294967296.0 + header.countLow;
+        first = 0.0;
+        n = count;
+        if (header.ring && count > header.slots)
+        {
+            /* oldest frame first */
+            first = fmod(count, header.slots);
+            n = header.slots;
+        }
+        frames = 0;
+        for (i = 0; i < n; i++)
+        {
+            if (fseek(file, header.headerSize
+                    + (long)fmod(first + i, header.slots) * header.slotSize,
+                    SEEK_SET) != 0
+                || fread(slot, header.slotSize, 1, file) != 1)
+                break;
+            if (slot->direction != S7PLC_RECORD_IN || slot->size != station->inSize)
+                continue;
+            if (station->replaySpeed > 0.0)
+            {
+                stamp = slot->secPastEpoch + slot->nsec * 1e-9;
+                if (!frames)
+                {
+                    start = s7plcMonotonic();
+                    stamp0 = stamp;
+                }
+                wait = start + (stamp - stamp0) / station->replaySpeed - s7plcMonotonic();
+                if (wait > 0.0) epicsThreadSleep(wait);
+            }
+            memcpy(s7plcInputFrame(station), slot+1, station->inSize);
+            station->stats.recvCalls++;
+            station->stats.bytesIn += station->inSize;
+            s7plcPublishInput(station);
+            frames++;
+        }
+        s7plcDebugLog(1, "s7plcReplayThread %s: replayed %lu frames\n",
+            station->name, frames);
+    } while (station->replayLoop && frames);
+
+    epicsMutexMustLock(station->connLock);
+    station->localConnected = 0;
+    epicsMutexUnlock(station->connLock);
+    fclose(file);
+    free(slot);
+    s7plcErrorLog("s7plcReplayThread %s: replay of %s finished\n",
+        station->name, station->replayFile);
+    s7plcFramesLost(station);
+    /* notify all "I/O Intr" input records */
+    station->fullScan = 1;
+    s7plcScanAllInputs(station);
+    if (station->blocks) s7plcScanBlocks(station);
+}
+
+STATIC unsigned int s7plcXorshift(unsigned int* state)
+{
+    unsigned int x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+/*
+ * Loopback mode: instead of receiving from a PLC, an input frame is made
+ * every loopPeriod from the previous one, the mapped ranges of the last
+ * frame sent and the loopPattern, the same patterns as s7plcSim uses.
+ */
+STATIC void s7plcLoopbackThread(s7plcStation* station)
+{
+    unsigned char* data;
+    unsigned int i, x;
+    double next, now;
+
+    s7plcDebugLog(1, "s7plcLoopbackThread %s: started\n",
+            station->name);
+    next = s7plcMonotonic();
+    while (1)
+    {
+        next += station->loopPeriod;
+        now = s7plcMonotonic();
+        if (next > now)
+            epicsThreadSleep(next - now);
+        else
+            next = now;
+
+        data = s7plcInputFrame(station);
+        memcpy(data, station->inCurrent->data, station->inSize);
+        s7plcLock(station->outLock, &station->stats.outLock);
+        for (i = 0; i < station->nloopMap; i++)
+            memcpy(data + station->loopMap[i].inOffset,
+                station->loopBuf + station->loopMap[i].outOffset,
+                station->loopMap[i].size);
+        epicsMutexUnlock(station->outLock);
+
+        station->loopCounter++;
+        switch (station->loopPattern)
+        {
+            case S7PLC_PATTERN_COUNTER:
+                for (i = 0; i < 4 && i < station->inSize; i++)
+                    data[i] = station->loopCounter >> (24 - 8 * i);
+                break;
+            case S7PLC_PATTERN_RANDOM:
+                for (i = 0; i < station->loopRandom; i++)
+                {
+                    x = s7plcXorshift(&station->loopSeed);
+                    data[x % station->inSize] = x >> 24;
+                }
+                break;
+            case S7PLC_PATTERN_ALL:
+                for (i = 0; i < station->inSize; i++)
+                    data[i] = s7plcXorshift(&station->loopSeed);
+                break;
+        }
+        station->stats.recvCalls++;
+        station->stats.bytesIn += station->inSize;
+        s7plcPublishInput(station);
+    }
+}
+
+/*
+ * In latestFrame mode, overwrites the frame just received with the
+ * newest complete frame already waiting in the socket, so that a backlog
+ * does not delay the data. A partial frame stays in the socket.
+ * Returns the number of skipped frames or -1 on error.
+ */
+STATIC int s7plcSkipStale(s7plcStation* station, SOCKET sock, unsigned char* recvBuf)
+{
+    unsigned long avail;
+    unsigned int input;
+    int received;
+    int skipped = 0;
+    char errmsg[100];
+
+    while (station->transport->pending(station, sock, &avail) == 0 && avail >= station->inSize)
+    {
+        for (input = 0; input < station->inSize; input += received)
+        {
+            /* data is already there, recv does not block */
+            received = station->transport->recv(station, sock,
+                recvBuf+input, station->inSize-input);
+            if (received < 0 && SOCKERRNO == EINTR)
+            {
+                received = 0;
+                continue;
+            }
+            if (received <= 0)
+            {
+                epicsSocketConvertErrnoToString(errmsg, sizeof(errmsg));
+                s7plcErrorLog(
+                    "s7plcSkipStale %s: recv(%d, ..., %d, 0) failed: %s\n",
+                    station->name, sock, station->inSize-input,
+                    received ? errmsg : "connection closed");
+                return -1;
+            }
+            s7plcTraceEvent(RECV, station, input, received);
+            station->stats.recvCalls++;
+            station->stats.bytesIn += received;
+        }
+        skipped++;
+    }
+    if (skipped)
+    {
+        station->stats.skippedFrames += skipped;
+        s7plcDebugLog(2,
+            "s7plcSkipStale %s: skipped %d stale frames\n",
+            station->name, skipped);
+    }
+    return skipped;
+}
+
+STATIC int s7plcWaitForInput(s7plcStation* station, double timeout)
+{
+    static struct timeval to;
+    SOCKET sock;
+    int iSelect;
+    fd_set socklist;
+    char errmsg[100];
+
+    sock = station->sock;
+    FD_ZERO(&socklist);
+    FD_SET(sock, &socklist);
+    to.tv_sec=(int)timeout;
+    to.tv_usec=(int)((timeout-to.tv_sec)*1000000);
+    /* select returns when either the sock has data or the timeout elapsed */
+    s7plcDebugLog(3,
+        "s7plcWaitForInput %s: waiting for %ld.%06ld seconds\n",
+        station->name, to.tv_sec, to.tv_usec);
+
+    while ((iSelect=select(NFDS(sock),&socklist, 0, 0,&to)) < 0)
+    {
+        if (station->sock == INVALID_SOCKET) return -1;
+        if (SOCKERRNO != EINTR)
+        {
+            epicsSocketConvertErrnoToString(errmsg, sizeof(errmsg));
+            s7plcErrorLog(
+                "s7plcWaitForInput %s: select(%" SOCKFMT ", %g sec) failed: %s\n",
+                station->name, station->sock, timeout, errmsg);
+            return -1;
+        }
+        s7plcErrorLog("s7plcWaitForInput %s: interrupted by signal\n",
+            station->name);
+    }
+    if (iSelect==0 && timeout > 0)            /* timed out */
+    {
+        S7PLC_PROBE2(wait_timeout, station->name, (int)(timeout * 1000));
+        s7plcErrorLog(
+            "s7plcWaitForInput %s: timeout after %g seconds.\n",
+            station->name, timeout);
+        SET_TIMEOUT_ERROR;
+        return -1;
+    }
+    return iSelect;
+}
+
+/*
+ * Waits until the socket can take more data to send. Returns 1 if it
+ * can, 0 after timeout seconds and -1 on error.
+ */
+STATIC int s7plcWaitForOutput(s7plcStation* station, double timeout)
+{
+    struct timeval to;
+    SOCKET sock = station->sock;
+    fd_set socklist;
+    int status;
+    char errmsg[100];
+
+    if (sock == INVALID_SOCKET) return -1;
+    FD_ZERO(&socklist);
+    FD_SET(sock, &socklist);
+    to.tv_sec = (int)timeout;
+    to.tv_usec = (int)((timeout - to.tv_sec) * 1000000);
+    while ((status = select(NFDS(sock), NULL, &socklist, NULL, &to)) < 0)
+    {
+        if (station->sock == INVALID_SOCKET) return -1;
+        if (SOCKERRNO != EINTR)
+        {
+            epicsSocketConvertErrnoToString(errmsg, sizeof(errmsg));
+            s7plcErrorLog(
+                "s7plcWaitForOutput %s: select(%" SOCKFMT ", %g sec) failed: %s\n",
+                station->name, sock, timeout, errmsg);
+            return -1;
+        }
+    }
+    return status;
+}
+
+/*
+ * Schedules the next connect attempt after a failed one and returns its
+ * delay. The delay starts at reconnectMin and grows by reconnectFactor
+ * up to reconnectMax, randomized by reconnectJitter so that stations and
+ * IOCs do not retry in lockstep. With probe, the retries come every
+ * probeInterval instead.
+ */
+STATIC double s7plcConnectFailed(s7plcStation* station, double now)
+{
+    double delay;
+
+    station->failedConnects++;
+    station->stats.connectFailures++;
+    if (station->probeInterval > 0.0)
+        delay = station->probeInterval;
+    else
+    {
+        delay = station->reconnectDelay;
+        if (delay < station->reconnectMin) delay = station->reconnectMin;
+        if (delay > station->reconnectMax) delay = station->reconnectMax;
+        station->reconnectDelay = delay * station->reconnectFactor;
+        delay *= 1.0 + station->reconnectJitter *
+            (s7plcXorshift(&station->reconnectSeed) / 2147483648.0 - 1.0);
+    }
+    S7PLC_PROBE2(connect_failed, station->name, (int)(delay * 1000));
+    station->reconnectTime = now + delay;
+    return delay;
+}
+
+/* After a connect, the backoff starts again at reconnectMin. */
+STATIC void s7plcConnectDone(s7plcStation* station)
+{
+    if (station->failedConnects)
+        s7plcErrorLog(
+            "s7plcConnect %s: connected after %lu failed attempts\n",
+            station->name, station->failedConnects);
+    station->failedConnects = 0;
+    station->reconnectDelay = 0.0;
+    station->connectedSince = s7plcMonotonic();
+}
+
+/*
+ * Returns the delay before reconnecting after the PLC closed the
+ * connection. A PLC that restarts closes cleanly and can be reconnected
+ * at once, unless it keeps closing connections right after accepting.
+ */
+STATIC double s7plcPeerClosed(s7plcStation* station, double now)
+{
+    if (now - station->connectedSince < station->reconnectMin)
+        return station->reconnectMin;
+    return 0.0;
+}
+
+/* Once the PLC is known to be down, probing connects with a short timeout. */
+STATIC double s7plcConnectTimeout(s7plcStation* station)
+{
+    if (station->probeInterval > 0.0 && station->failedConnects)
+        return station->probeTimeout;
+    return CONNECT_TIMEOUT;
+}
+
+/*
+ * Waits while the connection is down: until the next connect attempt is
+ * due or another thread has finished connecting.
+ */
+STATIC void s7plcWaitForConnect(s7plcStation* station)
+{
+    double wait = station->reconnectTime - s7plcMonotonic();
+
+    if (station->connecting && wait < CONNECT_TIMEOUT)
+        wait = CONNECT_TIMEOUT;
+    if (wait > 0.0)
+        epicsEventWaitWithTimeout(station->connEvent, wait);
+}
+
+/*
+ * Resolves host, from the cache while the last resolution is younger
+ * than resolveTTL. If resolving fails, the cached address of the same
+ * host is used further on.
+ */
+STATIC int s7plcResolve(s7plcStation* station, const char* host, struct in_addr* addr)
+{
+    double now = s7plcMonotonic();
+    int cached = station->resolvedHost && strcmp(host, station->resolvedHost) == 0;
+
+    if (cached && (station->resolveTTL < 0.0
+        || now - station->resolvedTime < station->resolveTTL))
+    {
+        *addr = station->resolvedAddr;
+        return 0;
+    }
+    if (hostToIPAddr(host, addr) < 0)
+    {
+        if (!cached)
+        {
+            s7plcConnectErrorLog(station,
+                "s7plcConnect %s: hostToIPAddr(%s) failed.\n",
+                station->name, host);
+            return -1;
+        }
+        s7plcConnectErrorLog(station,
+            "s7plcConnect %s: hostToIPAddr(%s) failed, using cached address\n",
+            station->name, host);
+        *addr = station->resolvedAddr;
+        return 0;
+    }
+    if (!cached)
+    {
+        free(station->resolvedHost);
+        station->resolvedHost = epicsStrDup(host);
+    }
+    station->resolvedAddr = *addr;
+    station->resolvedTime = now;
+    return 0;
+}
+
+/**
+ * Checks if the connection with the PLC is established, and establishes a new connection if
+ * it isn't - in a thread-safe manner.
+ *
+ * Returns 0 if the existing connection is OK (or the connection was successfully established
+ * after it not being valid).
+ * Returns 1 if another thread is connecting or the address changed while connecting.
+ * Returns -1 if the connection was not OK, and a new one couldn't be established
+ * or the next attempt is not yet due, see s7plcWaitForConnect.
+ */
+STATIC int s7plcCheckConnection(s7plcStation* station)
+{
+    int status;
+
+    /*
+     * Only one thread connects at a time. The connect itself (name
+     * resolution and a select of up to CONNECT_TIMEOUT) runs without
+     * holding any lock, so records never wait for a PLC that is down.
+     */
+    epicsMutexMustLock(station->connLock);
+    if (station->sock != INVALID_SOCKET)
+    {
+        epicsMutexUnlock(station->connLock);
+        return 0;
+    }
+    if (station->connecting)
+    {
+        epicsMutexUnlock(station->connLock);
+        return 1;
+    }
+    if (s7plcMonotonic() < station->reconnectTime)
+    {
+        /* backing off */
+        epicsMutexUnlock(station->connLock);
+        return -1;
+    }
+    station->connecting = 1;
+    epicsMutexUnlock(station->connLock);
+    status = station->transport->connect(station);
+    epicsMutexMustLock(station->connLock);
+    station->connecting = 0;
+    if (status < 0)
+        s7plcConnectFailed(station, s7plcMonotonic());
+    else if (status == 0)
+        s7plcConnectDone(station);
+    epicsMutexUnlock(station->connLock);
+    /* wake up the other thread */
+    epicsEventSignal(station->connEvent);
+    return status;
+}
+
+/* Copies the server address, which s7plcSetAddr may change any time. */
+STATIC int s7plcGetServer(s7plcStation* station, char* host, size_t size, int* port)
+{
+    epicsMutexMustLock(station->connLock);
+    if (!station->server || station->server[0] == '\0')
+    {
+        epicsMutexUnlock(station->connLock);
+        return -1;
+    }
+    strncpy(host, station->server, size-1);
+    host[size-1] = '\0';
+    *port = station->serverPort;
+    epicsMutexUnlock(station->connLock);
+    return 0;
+}
+
+STATIC int s7plcConnect(s7plcStation* station)
+{
+    SOCKET sock;
+    struct sockaddr_in serverAddr = {0};
+    struct timeval to;
+    double timeout;
+    int nonblocking;
+    char errmsg[100];
+    char host[256];
+    int port;
+
+    if (s7plcGetServer(station, host, sizeof(host), &port) < 0)
+        return -1; /* empty host string */
+
+    s7plcDebugLog(1, "s7plcConnect %s: IP=%s port=%d\n",
+        station->name, host, port);
+
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_port = htons(port);
+    if (s7plcResolve(station, host, &serverAddr.sin_addr) < 0)
+        return -1;
+
+    if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+    {
+        epicsSocketConvertErrnoToString(errmsg, sizeof(errmsg));
+        s7plcErrorLog(
+            "s7plcConnect %s: creating socket failed: %s\n",
+            station->name, errmsg);
+        return -1;
+    }
+
+    /* connect to server */
+    timeout = s7plcConnectTimeout(station);
+    to.tv_sec = (int)timeout;
+    to.tv_usec = (int)((timeout - to.tv_sec) * 1000000);
+    /* connect in non-blocking mode to use select with timeout */
+    nonblocking = 1;
+    ioctl(sock, FIONBIO, &nonblocking);
+    if (connect(sock, (struct sockaddr *) &serverAddr, sizeof(serverAddr)) < 0)
+    {
+        if (SOCKERRNO == EINPROGRESS)
+        {
+            /* start timeout */
+            int status;
+            SOCKERRTYPE sockerr;
+            socklen_t len = sizeof(sockerr);
+            fd_set fdset;
+
+            FD_ZERO(&fdset);
+            FD_SET(sock, &fdset);
+            /* wait for connection */
+            while ((status = select(NFDS(sock), NULL, &fdset, NULL, &to)) < 0)
+            {
+                if (SOCKERRNO != EINTR) /* select may be interrupted by signal */
+                {
+                    epicsSocketConvertErrnoToString(errmsg, sizeof(errmsg));
+                    s7plcErrorLog(
+                        "s7plcConnect %s: select(%d, %f sec) failed: %s\n",
+                        station->name, sock, timeout, errmsg);
+                    epicsSocketDestroy(sock);
+                    return -1;
                 }
-                s7plcDebugLog(1,
-                    "s7plcReceiveThread %s: received %4d of %4d bytes after %.6f seconds\n",
-                    station->name, received, receiveSize-input, waitTime);
-                if (s7plcDebug >= 4)
-                    hexdump(recvBuf+input, received, 1);
-                input += received;
             }
-            if (status <= 0 && timeout > 0.0)
+            if (status == 0)
             {
-                epicsSocketConvertErrnoToString(errmsg, sizeof(errmsg));
-                s7plcErrorLog(
-                    "s7plcReceiveThread %s: read error after %d of %d bytes: %s\n",
-                    station->name,
-                    input, station->inSize, errmsg);
-                s7plcCloseConnection(station);
-                break;
+                s7plcConnectErrorLog(station,
+                    "s7plcConnect %s: connect to %s:%d timeout after %g seconds\n",
+                    station->name, host, port, timeout);
+                epicsSocketDestroy(sock);
+                return -1;
+            }
+            /* get background error status */
+            getsockopt(sock, SOL_SOCKET, SO_ERROR, (void*)&sockerr, &len);
+            if (sockerr)
+            {
+                epicsSocketConvertErrorToString(errmsg, sizeof(errmsg), sockerr);
+                s7plcConnectErrorLog(station,
+                    "s7plcConnect %s: background connect to %s:%d failed: %s\n",
+                    station->name, host, port, errmsg);
+                epicsSocketDestroy(sock);
+                return -1;
             }
         }
-        if (station->sock != INVALID_SOCKET)
+        else
         {
-            epicsMutexMustLock(station->mutex);
-            memcpy(station->inBuffer, recvBuf, station->inSize);
-            epicsMutexUnlock(station->mutex);
-            /* notify all "I/O Intr" input records */
-            s7plcDebugLog(3,
-                "s7plcReceiveThread %s: receive successful, notify all input records\n",
-                station->name);
-            scanIoRequest(station->inScanPvt);
+            epicsSocketConvertErrnoToString(errmsg, sizeof(errmsg));
+            s7plcConnectErrorLog(station,
+                "s7plcConnect %s: connect to %s:%d failed: %s\n",
+                station->name, host, port, errmsg);
+            epicsSocketDestroy(sock);
+            return -1;
         }
-        else
+    }
+    /* connected */
+    nonblocking = 0;
+    ioctl(sock, FIONBIO, &nonblocking);
+#ifdef HAVE_RECV_WAITALL
+    s7plcSocketSetTimeout(station, sock);
+#endif
+    epicsMutexMustLock(station->connLock);
+    if (!station->server || strcmp(host, station->server) != 0 || port != station->serverPort)
+    {
+        /* s7plcSetAddr was called meanwhile */
+        epicsMutexUnlock(station->connLock);
+        s7plcDebugLog(1,
+            "s7plcConnect %s: address changed while connecting to %s:%d\n",
+            station->name, host, port);
+        epicsSocketDestroy(sock);
+        return 1;
+    }
+    station->sock = sock;
+    station->stats.connects++;
+    epicsMutexUnlock(station->connLock);
+    s7plcTraceEvent(CONNECT, station, 0, 0);
+    S7PLC_PROBE2(connect, station->name, station->sock);
+    s7plcErrorLog(
+        "s7plcConnect %s: connected to %s:%d\n",
+        station->name, host, port);
+    return 0;
+}
+
+STATIC void s7plcCloseConnection(s7plcStation* station)
+{
+    s7plcErrorLog(
+        "s7plcCloseConnection %s\n", station->name);
+    s7plcTraceEvent(CLOSE, station, 0, 0);
+    S7PLC_PROBE1(close, station->name);
+    epicsMutexMustLock(station->connLock);
+    if (station->sock>0)
+    {
+        station->transport->close(station, station->sock);
+        station->sock = INVALID_SOCKET;
+        station->reconnectTime = s7plcMonotonic() + station->reconnectMin;
+    }
+    epicsMutexUnlock(station->connLock);
+    /* notify all "I/O Intr" input records */
+    station->fullScan = 1;
+    s7plcScanAllInputs(station);
+    if (station->blocks) s7plcScanBlocks(station);
+}
+
+/* Socket functions shared by the transports */
+
+STATIC int s7plcSocketRecv(s7plcStation* station, SOCKET sock, void* buf, unsigned int size)
+{
+    return recv(sock, buf, size, 0);
+}
+
+#ifdef HAVE_RECV_WAITALL
+STATIC int s7plcSocketRecvAll(s7plcStation* station, SOCKET sock, void* buf, unsigned int size)
+{
+    return recv(sock, buf, size, MSG_WAITALL);
+}
+
+/* recvTimeout for s7plcSocketRecvAll */
+STATIC void s7plcSocketSetTimeout(s7plcStation* station, SOCKET sock)
+{
+    struct timeval to;
+    char errmsg[100];
+
+    to.tv_sec = (int)station->recvTimeout;
+    to.tv_usec = (int)((station->recvTimeout - to.tv_sec) * 1000000);
+    if (setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (void*)&to, sizeof(to)) != 0)
+    {
+        epicsSocketConvertErrnoToString(errmsg, sizeof(errmsg));
+        s7plcErrorLog(
+            "s7plcConnect %s: setsockopt(%d, SO_RCVTIMEO) failed: %s\n",
+            station->name, sock, errmsg);
+    }
+}
+#endif
+
+STATIC int s7plcSocketSend(s7plcStation* station, SOCKET sock, const void* buf, unsigned int size)
+{
+#ifdef S7PLC_BLOCKING_SEND
+    if (s7plcWaitForOutput(station, station->sendTimeout) <= 0)
+    {
+        SET_TIMEOUT_ERROR;
+        return -1;
+    }
+#endif
+    return send(sock, buf, size, MSG_DONTWAIT);
+}
+
+STATIC int s7plcSocketPending(s7plcStation* station, SOCKET sock, unsigned long* avail)
+{
+    osiSockIoctl_t n;
+
+    if (ioctl(sock, FIONREAD, &n) != 0) return -1;
+    *avail = n;
+    return 0;
+}
+
+STATIC void s7plcSocketClose(s7plcStation* station, SOCKET sock)
+{
+    char errmsg[100];
+
+    if (shutdown(sock, SHUT_RDWR) && SOCKERRNO != ENOTCONN)
+    {
+        epicsSocketConvertErrnoToString(errmsg, sizeof(errmsg));
+        s7plcErrorLog(
+            "s7plcCloseConnection %s: shutdown(%d, SHUT_RDWR) failed (ignored): %s\n",
+            station->name,
+            sock, errmsg);
+    }
+    epicsSocketDestroy(sock);
+}
+
+#ifdef HAVE_SOCKETPAIR
+/* args: optional socket buffer size in bytes, e.g. for latency tests */
+STATIC int s7plcPairConfigure(s7plcStation* station, const char* args)
+{
+    station->pairBufSize = strtol(args, NULL, 0);
+    return 0;
+}
+
+/* Creates a socket pair and keeps the PLC end for s7plcGetPeer */
+STATIC int s7plcPairOpen(s7plcStation* station, SOCKET* sock)
+{
+    SOCKET sv[2];
+    char errmsg[100];
+    int i;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+    {
+        epicsSocketConvertErrnoToString(errmsg, sizeof(errmsg));
+        s7plcErrorLog(
+            "s7plcConnect %s: creating socket pair failed: %s\n",
+            station->name, errmsg);
+        return -1;
+    }
+    if (station->pairBufSize > 0)
+    {
+        for (i = 0; i < 2; i++)
         {
-            s7plcDebugLog(1,
-                "s7plcReceiveThread %s: connection down, sleeping %g seconds\n",
-                station->name, CONNECT_TIMEOUT/4);
-            /* lost connection. Wait some time */
-            epicsThreadSleep(CONNECT_TIMEOUT/4);
+            setsockopt(sv[i], SOL_SOCKET, SO_SNDBUF,
+                (void*)&station->pairBufSize, sizeof(station->pairBufSize));
+            setsockopt(sv[i], SOL_SOCKET, SO_RCVBUF,
+                (void*)&station->pairBufSize, sizeof(station->pairBufSize));
         }
     }
+    epicsMutexMustLock(station->connLock);
+    /* a peer nobody has taken belongs to the previous connection */
+    if (station->pairPeer != INVALID_SOCKET)
+        epicsSocketDestroy(station->pairPeer);
+    station->pairPeer = sv[1];
+    epicsMutexUnlock(station->connLock);
+    s7plcDebugLog(1,
+        "s7plcConnect %s: connected to socket pair peer %d\n",
+        station->name, sv[1]);
+    *sock = sv[0];
+    return 0;
 }
 
-STATIC int s7plcWaitForInput(s7plcStation* station, double timeout)
+STATIC int s7plcPairConnect(s7plcStation* station)
 {
-    static struct timeval to;
     SOCKET sock;
-    int iSelect;
-    fd_set socklist;
-    char errmsg[100];
 
-    sock = station->sock;
-    FD_ZERO(&socklist);
-    FD_SET(sock, &socklist);
-    to.tv_sec=(int)timeout;
-    to.tv_usec=(int)((timeout-to.tv_sec)*1000000);
-    /* select returns when either the sock has data or the timeout elapsed */
-    s7plcDebugLog(3,
-        "s7plcWaitForInput %s: waiting for %ld.%06ld seconds\n",
-        station->name, to.tv_sec, to.tv_usec);
+    if (s7plcPairOpen(station, &sock) < 0)
+        return -1;
+    s7plcSocketSetTimeout(station, sock);
+    epicsMutexMustLock(station->connLock);
+    station->sock = sock;
+    station->stats.connects++;
+    epicsMutexUnlock(station->connLock);
+    s7plcTraceEvent(CONNECT, station, 0, 0);
+    S7PLC_PROBE2(connect, station->name, station->sock);
+    return 0;
+}
 
-    while ((iSelect=select(NFDS(sock),&socklist, 0, 0,&to)) < 0)
+#ifdef HAVE_EPOLL
+STATIC int s7plcPairConnectAsync(s7plcStation* station, SOCKET* sock, double now)
+{
+    int nonblocking = 1;
+
+    if (s7plcPairOpen(station, sock) < 0)
+        return -1;
+    ioctl(*sock, FIONBIO, &nonblocking);
+    return S7PLC_CONNECTED;
+}
+#endif
+#endif
+
+/*
+ * Takes the PLC end of a pair transport connection, the caller closes it.
+ * Returns -1 if there is none (yet).
+ */
+int s7plcGetPeer(s7plcStation* station)
+{
+    SOCKET peer = INVALID_SOCKET;
+
+#ifdef HAVE_SOCKETPAIR
+    epicsMutexMustLock(station->connLock);
+    peer = station->pairPeer;
+    station->pairPeer = INVALID_SOCKET;
+    epicsMutexUnlock(station->connLock);
+#endif
+    return peer == INVALID_SOCKET ? -1 : (int)peer;
+}
+
+#ifdef HAVE_EPOLL
+/*
+ * Reactor mode: instead of one receive and one send thread per station,
+ * a small pool of I/O threads (shards) multiplexes the sockets of all
+ * stations with epoll. Each station is driven by a non-blocking state
+ * machine for connect, receive, periodic send and reconnect.
+ */
+
+struct s7plcReactor {
+    unsigned int index;
+    int epfd;
+    int wakefd;
+    int timerfd;              /* absolute deadlines below epoll's milliseconds */
+    s7plcStation** heap;      /* min-heap by reactorDue */
+    unsigned int count;
+    epicsMutexId wakeLock;
+    s7plcStation* woken;      /* stations to visit now, see s7plcReactorWake */
+    epicsThreadId thread;
+};
+
+/*
+ * hostToIPAddr may block for seconds, far too long for a shard.
+ * Names of reactor stations are resolved by this thread instead,
+ * which wakes up the shard when done.
+ */
+STATIC epicsMutexId s7plcResolverLock;
+STATIC epicsEventId s7plcResolverEvent;
+STATIC s7plcStation* s7plcResolverQueue;
+
+STATIC void s7plcResolverThread(void* dummy)
+{
+    s7plcStation* station;
+    struct in_addr addr;
+    int status, cached;
+
+    while (1)
     {
-        if (station->sock == INVALID_SOCKET) return -1;
-        if (SOCKERRNO != EINTR)
+        epicsMutexMustLock(s7plcResolverLock);
+        station = s7plcResolverQueue;
+        if (station)
+            s7plcResolverQueue = station->resolveNext;
+        epicsMutexUnlock(s7plcResolverLock);
+        if (!station)
+        {
+            epicsEventMustWait(s7plcResolverEvent);
+            continue;
+        }
+        /* resolveHost does not change while resolving is set */
+        status = hostToIPAddr(station->resolveHost, &addr);
+        epicsMutexMustLock(station->connLock);
+        cached = station->resolvedHost
+            && strcmp(station->resolveHost, station->resolvedHost) == 0;
+        if (status < 0)
+        {
+            s7plcConnectErrorLog(station,
+                "s7plcConnect %s: hostToIPAddr(%s) failed%s\n",
+                station->name, station->resolveHost,
+                cached ? ", using cached address" : ".");
+            station->resolveFailed = !cached;
+        }
+        else
+        {
+            if (!cached)
+            {
+                free(station->resolvedHost);
+                station->resolvedHost = epicsStrDup(station->resolveHost);
+            }
+            station->resolvedAddr = addr;
+            station->resolvedTime = s7plcMonotonic();
+        }
+        station->resolving = 0;
+        epicsMutexUnlock(station->connLock);
+        s7plcReactorWake(station);
+    }
+}
+
+/*
+ * Reactor version of s7plcResolve: takes the address from the cache only
+ * and queues the host for the resolver thread if it is missing or older
+ * than resolveTTL. A stale address is used while it is refreshed.
+ * Returns 1 while waiting for the resolver.
+ */
+STATIC int s7plcReactorResolve(s7plcStation* station, const char* host,
+    struct in_addr* addr, double now)
+{
+    int cached, status = 0;
+
+    epicsMutexMustLock(station->connLock);
+    cached = station->resolvedHost && strcmp(host, station->resolvedHost) == 0;
+    if (station->resolving)
+    {
+        if (!cached) status = 1;
+    }
+    else if (!cached && station->resolveFailed
+        && strcmp(host, station->resolveHost) == 0)
+    {
+        /* reported by the resolver, retry after the connect backoff */
+        station->resolveFailed = 0;
+        status = -1;
+    }
+    else if (!cached || (station->resolveTTL >= 0.0
+        && now - station->resolvedTime >= station->resolveTTL))
+    {
+        if (!station->resolveHost || strcmp(host, station->resolveHost) != 0)
+        {
+            free(station->resolveHost);
+            station->resolveHost = epicsStrDup(host);
+        }
+        station->resolving = 1;
+        station->resolveFailed = 0;
+        epicsMutexMustLock(s7plcResolverLock);
+        station->resolveNext = s7plcResolverQueue;
+        s7plcResolverQueue = station;
+        epicsMutexUnlock(s7plcResolverLock);
+        epicsEventSignal(s7plcResolverEvent);
+        if (!cached) status = 1;
+    }
+    if (status == 0)
+        *addr = station->resolvedAddr;
+    epicsMutexUnlock(station->connLock);
+    return status;
+}
+
+STATIC int s7plcReactorStart()
+{
+    s7plcReactor* reactors;
+    s7plcStation* station;
+    unsigned int i = 0;
+    char threadname[20];
+    struct epoll_event ev;
+
+    s7plcResolverLock = epicsMutexMustCreate();
+    s7plcResolverEvent = epicsEventMustCreate(epicsEventEmpty);
+    if (!epicsThreadCreate(
+        "s7plcResolve",
+        epicsThreadPriorityMedium,
+        epicsThreadGetStackSize(epicsThreadStackMedium),
+        s7plcResolverThread,
+        NULL))
+    {
+        s7plcErrorLog(
+            "s7plcInit: FATAL ERROR! could not start resolver thread\n");
+        return -1;
+    }
+    reactors = callocMustSucceed(reactorShards, sizeof(s7plcReactor),
+        "s7plcReactorStart");
+    for (station = s7plcStationList; station; station=station->next)
+    {
+        s7plcReactor* reactor;
+
+        if (!s7plcUseReactor(station)) continue;
+        reactor = &reactors[i++ % reactorShards];
+        station->reactor = reactor;
+        reactor->count++;
+        station->reactorState = S7PLC_IDLE;
+        station->reactorSock = INVALID_SOCKET;
+        station->reactorDeadline = 0.0;
+        station->resolving = 0;
+        station->resolveFailed = 0;
+        if (station->outSize)
+            station->sendBuf = callocMustSucceed(1, station->outSize,
+                "s7plcReactorStart");
+    }
+    for (i = 0; i < reactorShards; i++)
+    {
+        s7plcReactor* reactor = &reactors[i];
+        reactor->index = i;
+        if (!reactor->count) continue;
+        /* all stations are due at once, so any order is a heap */
+        reactor->heap = callocMustSucceed(reactor->count, sizeof(s7plcStation*),
+            "s7plcReactorStart");
+        reactor->count = 0;
+        for (station = s7plcStationList; station; station=station->next)
         {
+            if (!s7plcUseReactor(station) || station->reactor != reactor) continue;
+            station->reactorDue = 0.0;
+            station->heapIndex = reactor->count;
+            reactor->heap[reactor->count++] = station;
+        }
+        reactor->wakeLock = epicsMutexMustCreate();
+        reactor->epfd = epoll_create(REACTOR_EVENTS);
+        reactor->wakefd = eventfd(0, EFD_NONBLOCK);
+        reactor->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        if (reactor->epfd < 0 || reactor->wakefd < 0 || reactor->timerfd < 0)
+        {
+            char errmsg[100];
             epicsSocketConvertErrnoToString(errmsg, sizeof(errmsg));
             s7plcErrorLog(
-                "s7plcWaitForInput %s: select(%" SOCKFMT ", %g sec) failed: %s\n",
-                station->name, station->sock, timeout, errmsg);
+                "s7plcInit: FATAL ERROR! could not create reactor %u: %s\n",
+                i, errmsg);
             return -1;
         }
-        s7plcErrorLog("s7plcWaitForInput %s: interrupted by signal\n",
-            station->name);
+        ev.events = EPOLLIN;
+        ev.data.ptr = NULL;
+        epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, reactor->wakefd, &ev);
+        ev.data.ptr = reactor;
+        epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, reactor->timerfd, &ev);
+        sprintf(threadname, "s7plcIO%u", i);
+        s7plcDebugLog(1,
+            "s7plcMain: starting reactor thread %s\n", threadname);
+        reactor->thread = epicsThreadCreate(
+            threadname,
+            epicsThreadPriorityHigh,
+            epicsThreadGetStackSize(epicsThreadStackBig),
+            (EPICSTHREADFUNC)s7plcReactorThread,
+            reactor);
+        if (!reactor->thread)
+        {
+            s7plcErrorLog(
+                "s7plcInit: FATAL ERROR! could not start reactor thread %s\n",
+                threadname);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Sets the epoll event mask for the socket of this station. */
+STATIC void s7plcReactorWatch(s7plcStation* station, unsigned int events)
+{
+    struct epoll_event ev;
+
+    if (events == station->reactorEvents) return;
+    ev.events = events;
+    ev.data.ptr = station;
+    epoll_ctl(station->reactor->epfd, EPOLL_CTL_MOD, station->reactorSock, &ev);
+    station->reactorEvents = events;
+}
+
+/*
+ * The stations of a shard are kept in a binary min-heap by the time
+ * they need attention next, so a wakeup only visits the stations due.
+ * The heap belongs to the shard thread.
+ */
+STATIC void s7plcHeapSet(s7plcReactor* reactor, unsigned int i, s7plcStation* station)
+{
+    reactor->heap[i] = station;
+    station->heapIndex = i;
+}
+
+STATIC void s7plcHeapUp(s7plcReactor* reactor, unsigned int i)
+{
+    s7plcStation* station = reactor->heap[i];
+
+    while (i > 0 && reactor->heap[(i-1)/2]->reactorDue > station->reactorDue)
+    {
+        s7plcHeapSet(reactor, i, reactor->heap[(i-1)/2]);
+        i = (i-1)/2;
+    }
+    s7plcHeapSet(reactor, i, station);
+}
+
+STATIC void s7plcHeapDown(s7plcReactor* reactor, unsigned int i)
+{
+    s7plcStation* station = reactor->heap[i];
+    unsigned int child;
+
+    while ((child = 2*i+1) < reactor->count)
+    {
+        if (child+1 < reactor->count
+            && reactor->heap[child+1]->reactorDue < reactor->heap[child]->reactorDue)
+            child++;
+        if (reactor->heap[child]->reactorDue >= station->reactorDue) break;
+        s7plcHeapSet(reactor, i, reactor->heap[child]);
+        i = child;
     }
-    if (iSelect==0 && timeout > 0)            /* timed out */
+    s7plcHeapSet(reactor, i, station);
+}
+
+/* Removes and returns the station due first. */
+STATIC s7plcStation* s7plcHeapPop(s7plcReactor* reactor)
+{
+    s7plcStation* station = reactor->heap[0];
+
+    if (--reactor->count)
     {
-        s7plcErrorLog(
-            "s7plcWaitForInput %s: timeout after %g seconds.\n",
-            station->name, timeout);
-        SET_TIMEOUT_ERROR;
-        return -1;
+        s7plcHeapSet(reactor, 0, reactor->heap[reactor->count]);
+        s7plcHeapDown(reactor, 0);
     }
-    return iSelect;
+    return station;
 }
 
-/**
- * Checks if the connection with the PLC is established, and establishes a new connection if
- * it isn't - in a thread-safe manner.
- *
- * Returns 0 if the existing connection is OK (or the connection was successfully established
- * after it not being valid).
- * Returns -1 if the connection was not OK, and a new one couldn't be established.
- */
-STATIC int s7plcCheckConnection(s7plcStation* station)
+STATIC void s7plcHeapPush(s7plcReactor* reactor, s7plcStation* station)
 {
-    /* 0 = connection is OK, -1 = connection could not be established */
-    int connectionOk = 0;
-    /*
-     * Use a critical section around the socket file descriptor to avoid potential race
-     * conditions between the sending and receiving thread, when checking the state of the
-     * connection and potential (re)establishing of the connection.
-     */
-    epicsMutexMustLock(station->mutex);
-    if (station->sock == INVALID_SOCKET)
+    s7plcHeapSet(reactor, reactor->count++, station);
+    s7plcHeapUp(reactor, station->heapIndex);
+}
+
+/* Moves a station in the heap of its shard to a new due time. */
+STATIC void s7plcReactorDue(s7plcStation* station, double due)
+{
+    s7plcReactor* reactor = station->reactor;
+    double old = station->reactorDue;
+
+    station->reactorDue = due;
+    if (due < old) s7plcHeapUp(reactor, station->heapIndex);
+    else s7plcHeapDown(reactor, station->heapIndex);
+}
+
+/* Makes the shard visit this station. */
+STATIC void s7plcReactorWake(s7plcStation* station)
+{
+    s7plcReactor* reactor = station->reactor;
+    eventfd_t one = 1;
+
+    epicsMutexMustLock(reactor->wakeLock);
+    if (!station->wakeQueued)
     {
-        /* not connected */
-        if (s7plcConnect(station) < 0)
-        {
-            connectionOk = -1;
-        }
+        station->wakeQueued = 1;
+        station->wakeNext = reactor->woken;
+        reactor->woken = station;
+    }
+    epicsMutexUnlock(reactor->wakeLock);
+    if (write(reactor->wakefd, &one, sizeof(one)) < 0)
+    {
+        s7plcErrorLog("s7plcReactorWake %s: wakeup failed\n",
+            station->name);
     }
-    epicsMutexUnlock(station->mutex);
-    return connectionOk;
 }
 
-STATIC int s7plcConnect(s7plcStation* station)
+/* Asks the shard to drop the connection, e.g. after the address changed. */
+STATIC void s7plcReactorReset(s7plcStation* station)
+{
+    station->reactorReset = 1;
+    s7plcReactorWake(station);
+}
+
+STATIC void s7plcReactorDisconnect(s7plcStation* station, double now, double delay)
+{
+    if (station->reactorState == S7PLC_CONNECTING)
+        epicsSocketDestroy(station->reactorSock);
+    if (station->reactorState == S7PLC_CONNECTED)
+        s7plcCloseConnection(station);
+    station->reactorSock = INVALID_SOCKET;
+    station->reactorState = S7PLC_IDLE;
+    station->reactorDeadline = now + delay;
+    station->input = 0;
+    station->sendLen = 0;
+    station->sendLate = 0;
+    if (station->blockedSince)
+        station->stats.blockedTime += now - station->blockedSince;
+    station->blockedSince = 0.0;
+    s7plcFramesLost(station);
+}
+
+STATIC void s7plcReactorConnected(s7plcStation* station, double now)
+{
+    if (station->transport == &s7plcTcpTransport)
+        s7plcErrorLog(
+            "s7plcConnect %s: connected to %s:%d\n",
+            station->name, station->server, station->serverPort);
+    epicsMutexMustLock(station->connLock);
+    station->sock = station->reactorSock;
+    station->stats.connects++;
+    epicsMutexUnlock(station->connLock);
+    s7plcTraceEvent(CONNECT, station, 0, 0);
+    S7PLC_PROBE2(connect, station->name, station->sock);
+    s7plcConnectDone(station);
+    station->reactorState = S7PLC_CONNECTED;
+    station->input = 0;
+    station->sendLen = 0;
+    station->recvDeadline = now + station->recvTimeout;
+    s7plcReactorWatch(station, station->inSize ? EPOLLIN : 0);
+}
+
+/*
+ * connectAsync of TCP. Waits in S7PLC_RESOLVING if the host name is not
+ * resolved yet.
+ */
+STATIC int s7plcTcpConnectAsync(s7plcStation* station, SOCKET* psock, double now)
 {
     SOCKET sock;
     struct sockaddr_in serverAddr = {0};
-    struct timeval to;
     int nonblocking;
     char errmsg[100];
+    char host[256];
+    int port;
 
+    if (s7plcGetServer(station, host, sizeof(host), &port) < 0)
+    {
+        /* no host: wait for s7plcSetAddr */
+        return -1;
+    }
     s7plcDebugLog(1, "s7plcConnect %s: IP=%s port=%d\n",
-        station->name, station->server, station->serverPort);
-
-    if (station->server[0] == '\0') return -1; /* empty host string */
-
+        station->name, host, port);
     serverAddr.sin_family = AF_INET;
-    serverAddr.sin_port = htons(station->serverPort);
-    if (hostToIPAddr(station->server, &serverAddr.sin_addr) < 0)
+    serverAddr.sin_port = htons(port);
+    switch (s7plcReactorResolve(station, host, &serverAddr.sin_addr, now))
     {
-        s7plcErrorLog(
-            "s7plcConnect %s: hostToIPAddr(%s) failed.\n",
-            station->name, station->server);
-        return -1;
+        case -1:
+            return -1;
+        case 1:
+            return S7PLC_RESOLVING;
     }
 
     if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0)
@@ -784,103 +5222,465 @@ STATIC int s7plcConnect(s7plcStation* station)
             station->name, errmsg);
         return -1;
     }
-
-    /* connect to server */
-    to.tv_sec=(int)(CONNECT_TIMEOUT);
-    to.tv_usec=(int)(CONNECT_TIMEOUT-to.tv_sec)*1000000;
-    /* connect in non-blocking mode to use select with timeout */
     nonblocking = 1;
     ioctl(sock, FIONBIO, &nonblocking);
-    if (connect(sock, (struct sockaddr *) &serverAddr, sizeof(serverAddr)) < 0)
+    if (connect(sock, (struct sockaddr *) &serverAddr, sizeof(serverAddr)) < 0
+        && SOCKERRNO != EINPROGRESS)
     {
-        if (SOCKERRNO == EINPROGRESS)
-        {
-            /* start timeout */
-            int status;
-            SOCKERRTYPE sockerr;
-            socklen_t len = sizeof(sockerr);
-            fd_set fdset;
+        epicsSocketConvertErrnoToString(errmsg, sizeof(errmsg));
+        s7plcConnectErrorLog(station,
+            "s7plcConnect %s: connect to %s:%d failed: %s\n",
+            station->name, host, port, errmsg);
+        epicsSocketDestroy(sock);
+        return -1;
+    }
+    *psock = sock;
+    return S7PLC_CONNECTING;
+}
 
-            FD_ZERO(&fdset);
-            FD_SET(sock, &fdset);
-            /* wait for connection */
-            while ((status = select(NFDS(sock), NULL, &fdset, NULL, &to)) < 0)
+/*
+ * Starts a connect with the connectAsync of the transport.
+ * Returns -1 if the connect failed at once.
+ */
+STATIC int s7plcReactorConnect(s7plcStation* station, double now)
+{
+    SOCKET sock = INVALID_SOCKET;
+    struct epoll_event ev;
+    char errmsg[100];
+    int state;
+
+    state = station->transport->connectAsync(station, &sock, now);
+    if (state < 0)
+        return -1;
+    if (state == S7PLC_RESOLVING)
+    {
+        station->reactorState = S7PLC_RESOLVING;
+        return 0;
+    }
+    ev.events = state == S7PLC_CONNECTING ? EPOLLOUT : 0;
+    ev.data.ptr = station;
+    if (epoll_ctl(station->reactor->epfd, EPOLL_CTL_ADD, sock, &ev) < 0)
+    {
+        epicsSocketConvertErrnoToString(errmsg, sizeof(errmsg));
+        s7plcErrorLog(
+            "s7plcConnect %s: epoll_ctl(%d) failed: %s\n",
+            station->name, sock, errmsg);
+        epicsSocketDestroy(sock);
+        return -1;
+    }
+    station->reactorSock = sock;
+    station->reactorEvents = ev.events;
+    station->reactorState = S7PLC_CONNECTING;
+    station->reactorDeadline = now + s7plcConnectTimeout(station);
+    if (state == S7PLC_CONNECTED)
+        s7plcReactorConnected(station, now);
+    return 0;
+}
+
+/* Writes as much of the pending frame as the socket accepts. */
+STATIC void s7plcReactorFlush(s7plcStation* station, double now)
+{
+    int written;
+    char errmsg[100];
+
+    while (station->sendPos < station->sendLen)
+    {
+        written = send(station->reactorSock, station->sendBuf + station->sendPos,
+            station->sendLen - station->sendPos, MSG_NOSIGNAL);
+        if (written < 0)
+        {
+            if (SOCKERRNO == EINTR) continue;
+            if (SOCKERRNO == EAGAIN || SOCKERRNO == EWOULDBLOCK)
             {
-                if (SOCKERRNO != EINTR) /* select may be interrupted by signal */
+                /* socket full, EPOLLOUT resumes */
+                if (!station->blockedSince)
                 {
-                    epicsSocketConvertErrnoToString(errmsg, sizeof(errmsg));
-                    s7plcErrorLog(
-                        "s7plcConnect %s: select(%d, %f sec) failed: %s\n",
-                        station->name, sock, CONNECT_TIMEOUT, errmsg);
-                    epicsSocketDestroy(sock);
-                    return -1;
+                    station->blockedSince = now;
+                    station->stats.sendBlocks++;
                 }
+                break;
             }
-            if (status == 0)
+            epicsSocketConvertErrnoToString(errmsg, sizeof(errmsg));
+            s7plcErrorLog(
+                "s7plcSendThread %s: send(%d, ..., %d, 0) failed: %s\n",
+                station->name,
+                station->reactorSock, station->sendLen - station->sendPos, errmsg);
+            s7plcReactorDisconnect(station, now, station->reconnectMin);
+            return;
+        }
+        s7plcTraceEvent(SEND, station, station->sendPos, written);
+        if (station->blockedSince)
+        {
+            station->stats.blockedTime += now - station->blockedSince;
+            station->blockedSince = 0.0;
+        }
+        station->stats.sendCalls++;
+        if (station->sendPos + written < station->sendLen)
+            station->stats.partialSends++;
+        station->sendPos += written;
+        station->stats.bytesOut += written;
+    }
+    if (station->sendLen && station->sendPos >= station->sendLen)
+    {
+        S7PLC_PROBE2(send_end, station->name, station->sendPos);
+        s7plcRecordFrame(station, S7PLC_RECORD_OUT, station->sendBuf, station->sendLen);
+        station->sendLen = 0;
+        station->sendLate = 0;
+        station->stats.framesOut++;
+        s7plcSendDone(station, s7plcMonotonic());
+    }
+    s7plcSampleQueue(station, station->reactorSock);
+    s7plcReactorWatch(station,
+        (station->inSize ? EPOLLIN : 0) | (station->sendLen ? EPOLLOUT : 0));
+}
+
+STATIC void s7plcReactorReceive(s7plcStation* station, double now)
+{
+    int received;
+    char errmsg[100];
+
+    while (station->reactorState == S7PLC_CONNECTED)
+    {
+        if (!station->input)
+            station->recvBuf = s7plcInputFrame(station);
+        received = station->transport->recv(station, station->reactorSock,
+            (void*)(station->recvBuf+station->input), station->inSize-station->input);
+        if (received == 0)
+        {
+            s7plcErrorLog(
+                "s7plcReceiveThread %s: connection closed by %s\n",
+                station->name, station->server);
+            s7plcReactorDisconnect(station, now, s7plcPeerClosed(station, now));
+            return;
+        }
+        if (received < 0)
+        {
+            if (SOCKERRNO == EINTR) continue;
+            if (SOCKERRNO == EAGAIN || SOCKERRNO == EWOULDBLOCK) return;
+            epicsSocketConvertErrnoToString(errmsg, sizeof(errmsg));
+            s7plcErrorLog(
+                "s7plcReceiveThread %s: recv(%d, ..., %d, 0) failed: %s\n",
+                station->name,
+                station->reactorSock, station->inSize-station->input, errmsg);
+            s7plcReactorDisconnect(station, now, station->reconnectMin);
+            return;
+        }
+        s7plcTraceEvent(RECV, station, station->input, received);
+        station->stats.recvCalls++;
+        station->stats.bytesIn += received;
+        if ((unsigned int)received < station->inSize-station->input)
+            station->stats.partialRecvs++;
+        s7plcDebugLog(1,
+            "s7plcReceiveThread %s: received %4d of %4d bytes\n",
+            station->name, received, station->inSize-station->input);
+        if (s7plcDebug >= 4)
+            hexdump(station->recvBuf+station->input, received, 1);
+        station->input += received;
+        station->recvDeadline = now + station->recvTimeout;
+        if (station->input == station->inSize)
+        {
+            S7PLC_PROBE2(frame_received, station->name, station->input);
+            station->input = 0;
+            if (station->latestFrame
+                && s7plcSkipStale(station, station->reactorSock, station->recvBuf) < 0)
             {
-                s7plcErrorLog(
-                    "s7plcConnect %s: connect to %s:%d timeout after %g seconds\n",
-                    station->name, station->server, station->serverPort, CONNECT_TIMEOUT);
-                epicsSocketDestroy(sock);
-                return -1;
+                s7plcReactorDisconnect(station, now, station->reconnectMin);
+                return;
             }
+            s7plcPublishInput(station);
+        }
+    }
+}
+
+STATIC void s7plcReactorEvent(s7plcStation* station, unsigned int events, double now)
+{
+    SOCKERRTYPE sockerr = 0;
+    socklen_t len = sizeof(sockerr);
+    char errmsg[100];
+
+    switch (station->reactorState)
+    {
+        case S7PLC_CONNECTING:
             /* get background error status */
-            getsockopt(sock, SOL_SOCKET, SO_ERROR, (void*)&sockerr, &len);
+            getsockopt(station->reactorSock, SOL_SOCKET, SO_ERROR, (void*)&sockerr, &len);
             if (sockerr)
             {
                 epicsSocketConvertErrorToString(errmsg, sizeof(errmsg), sockerr);
-                s7plcErrorLog(
+                s7plcConnectErrorLog(station,
                     "s7plcConnect %s: background connect to %s:%d failed: %s\n",
                     station->name, station->server, station->serverPort, errmsg);
-                epicsSocketDestroy(sock);
-                return -1;
+                s7plcReactorDisconnect(station, now, s7plcConnectFailed(station, now));
+                return;
+            }
+            s7plcReactorConnected(station, now);
+            return;
+        case S7PLC_CONNECTED:
+            if (events & EPOLLIN)
+                s7plcReactorReceive(station, now);
+            if (station->reactorState == S7PLC_CONNECTED && events & EPOLLOUT)
+                s7plcReactorFlush(station, now);
+            if (station->reactorState == S7PLC_CONNECTED && !station->inSize
+                && events & (EPOLLERR|EPOLLHUP))
+            {
+                s7plcErrorLog(
+                    "s7plcSendThread %s: connection closed by %s\n",
+                    station->name, station->server);
+                s7plcReactorDisconnect(station, now, s7plcPeerClosed(station, now));
             }
+            return;
+    }
+}
+
+/*
+ * Starts sending the output image. Returns 1 if a frame was started, 0 if
+ * there was nothing to send and -1 if the connection broke.
+ */
+STATIC int s7plcReactorSend(s7plcStation* station, double now, int force)
+{
+    station->sendRequest = 0;
+    /* a frame still pending from the last cycle goes first */
+    if (station->sendLen)
+    {
+        station->stats.droppedFrames++;
+        return 0;
+    }
+    if (s7plcFetchOutput(station, station->sendBuf, force))
+    {
+        s7plcDebugLog(2,
+            "s7plcSendThread %s: sending %d bytes\n",
+            station->name, station->outSize);
+        station->sendPos = 0;
+        station->sendLen = station->outSize;
+        station->lastSendTime = now;
+        station->stats.sendStart = now;
+        station->sendExpire = now + station->sendTimeout;
+        S7PLC_PROBE2(send_start, station->name, station->outSize);
+        s7plcReactorFlush(station, now);
+        if (station->reactorState != S7PLC_CONNECTED)
+            return -1;
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Handles all time driven transitions of a station and returns the
+ * time when it needs attention next.
+ */
+STATIC double s7plcReactorTimers(s7plcStation* station, double now)
+{
+    double next;
+
+    if (station->reactorReset)
+    {
+        station->reactorReset = 0;
+        /* the new address is tried at once */
+        s7plcReactorDisconnect(station, now, 0.0);
+    }
+    if (station->reactorState == S7PLC_CONNECTED
+        && station->sock == INVALID_SOCKET)
+    {
+        /* closed behind our back */
+        s7plcReactorDisconnect(station, now, station->reconnectMin);
+    }
+    switch (station->reactorState)
+    {
+        case S7PLC_RESOLVING:
+        {
+            int resolving;
+
+            epicsMutexMustLock(station->connLock);
+            resolving = station->resolving;
+            epicsMutexUnlock(station->connLock);
+            /* the resolver thread wakes us up */
+            if (resolving)
+                return now + RECONNECT_DELAY;
+            station->reactorState = S7PLC_IDLE;
+            station->reactorDeadline = now;
         }
-        else
+            /* fall through */
+        case S7PLC_IDLE:
+            if (now >= station->reactorDeadline
+                && s7plcReactorConnect(station, now) < 0)
+            {
+                station->reactorDeadline = now + s7plcConnectFailed(station, now);
+            }
+            /* the pair transport connects at once, start sending now */
+            if (station->reactorState != S7PLC_CONNECTED)
+                return station->reactorDeadline;
+            break;
+        case S7PLC_CONNECTING:
+            if (now >= station->reactorDeadline)
+            {
+                s7plcConnectErrorLog(station,
+                    "s7plcConnect %s: connect to %s:%d timeout after %g seconds\n",
+                    station->name, station->server, station->serverPort,
+                    s7plcConnectTimeout(station));
+                s7plcReactorDisconnect(station, now, s7plcConnectFailed(station, now));
+            }
+            return station->reactorDeadline;
+    }
+
+    /* connected */
+    next = now + RECONNECT_DELAY;
+    if (station->inSize)
+    {
+        if (now >= station->recvDeadline)
         {
-            epicsSocketConvertErrnoToString(errmsg, sizeof(errmsg));
+            S7PLC_PROBE2(wait_timeout, station->name, (int)(station->recvTimeout * 1000));
             s7plcErrorLog(
-                "s7plcConnect %s: connect to %s:%d failed: %s\n",
-                station->name, station->server, station->serverPort, errmsg);
-            epicsSocketDestroy(sock);
-            return -1;
+                "s7plcReceiveThread %s: read error after %d of %d bytes: timeout after %g seconds\n",
+                station->name,
+                station->input, station->inSize, station->recvTimeout);
+            s7plcReactorDisconnect(station, now, station->reconnectMin);
+            return station->reactorDeadline;
         }
+        next = station->recvDeadline;
     }
-    /* connected */
-    nonblocking = 0;
-    ioctl(sock, FIONBIO, &nonblocking);
-    s7plcErrorLog(
-        "s7plcConnect %s: connected to %s:%d\n",
-        station->name, station->server, station->serverPort);
-
-    station->sock = sock;
-    return 0;
+    if (station->sendLen)
+    {
+        if (now >= station->sendExpire && s7plcSendTimeout(station, now) < 0)
+        {
+            s7plcReactorDisconnect(station, now, station->reconnectMin);
+            return station->reactorDeadline;
+        }
+        if (station->sendExpire < next)
+            next = station->sendExpire;
+    }
+    if (s7plcSends(station) && interruptAccept && station->sendOnWrite
+        && station->sendRequest && !station->sendLen)
+    {
+        /* written: send when sendGap after the last send has passed */
+        double due = station->lastSendTime + station->sendGap;
+        if (now >= due)
+        {
+            int status = s7plcReactorSend(station, now, 0);
+            if (status < 0)
+                return station->reactorDeadline;
+            if (status > 0)
+            {
+                /* notify all "I/O Intr" output records of the frame */
+                scanIoRequest(station->outScanPvt);
+                station->stats.outScans++;
+            }
+        }
+        else if (due < next)
+            next = due;
+    }
+    if (s7plcSends(station))
+    {
+        if (now >= station->sendDeadline)
+        {
+            s7plcSendCycle(station, now,
+                interruptAccept && station->reactorState == S7PLC_CONNECTED);
+            s7plcDebugLog(2, "s7plcSendThread %s: look for data to send\n",
+                station->name);
+            if (interruptAccept)
+            {
+                /* in sendOnWrite mode the periodic send is a keep-alive */
+                if (s7plcReactorSend(station, now, station->sendOnWrite) < 0)
+                    return station->reactorDeadline;
+                /* notify all "I/O Intr" output records */
+                s7plcDebugLog(2,
+                    "s7plcSendThread %s: send cycle done, notify all output records\n",
+                    station->name);
+                scanIoRequest(station->outScanPvt);
+                station->stats.outScans++;
+            }
+        }
+        if (station->sendDeadline < next)
+            next = station->sendDeadline;
+    }
+    return next;
 }
 
-STATIC void s7plcCloseConnection(s7plcStation* station)
+STATIC void s7plcReactorThread(s7plcReactor* reactor)
 {
+    struct epoll_event events[REACTOR_EVENTS];
+    s7plcStation* station;
+    s7plcStation* due;
+    double now, next;
+    int i, n, timeout;
+    eventfd_t count;
+    struct itimerspec its;
     char errmsg[100];
 
-    s7plcErrorLog(
-        "s7plcCloseConnection %s\n", station->name);
-    epicsMutexMustLock(station->mutex);
-    if (station->sock>0)
+    s7plcDebugLog(1, "s7plcReactorThread %u: started\n",
+            reactor->index);
+
+    while (1)
     {
-        if (shutdown(station->sock, SHUT_RDWR) && SOCKERRNO != ENOTCONN)
+        now = s7plcMonotonic();
+        /* take the due stations out first, so each is visited once */
+        due = NULL;
+        while (reactor->count && reactor->heap[0]->reactorDue <= now)
+        {
+            station = s7plcHeapPop(reactor);
+            station->dueNext = due;
+            due = station;
+        }
+        while ((station = due) != NULL)
         {
+            due = station->dueNext;
+            /* look at every station now and then, as without the heap */
+            station->reactorDue = s7plcReactorTimers(station, now);
+            if (station->reactorDue > now + RECONNECT_DELAY)
+                station->reactorDue = now + RECONNECT_DELAY;
+            s7plcHeapPush(reactor, station);
+        }
+        next = reactor->heap[0]->reactorDue;
+        /* the timer fd wakes up at the deadline, epoll_wait has milliseconds only */
+        timeout = 0;
+        if (next > now)
+        {
+            memset(&its, 0, sizeof(its));
+            its.it_value.tv_sec = (time_t)next;
+            its.it_value.tv_nsec = (long)((next - its.it_value.tv_sec) * 1e9);
+            timerfd_settime(reactor->timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+            timeout = -1;
+        }
+
+        n = epoll_wait(reactor->epfd, events, REACTOR_EVENTS, timeout);
+        if (n < 0)
+        {
+            if (SOCKERRNO == EINTR) continue;
             epicsSocketConvertErrnoToString(errmsg, sizeof(errmsg));
             s7plcErrorLog(
-                "s7plcCloseConnection %s: shutdown(%d, SHUT_RDWR) failed (ignored): %s\n",
-                station->name,
-                station->sock, errmsg);
+                "s7plcReactorThread %u: epoll_wait failed: %s\n",
+                reactor->index, errmsg);
+            epicsThreadSleep(CONNECT_TIMEOUT/4);
+            continue;
+        }
+        now = s7plcMonotonic();
+        for (i = 0; i < n; i++)
+        {
+            station = events[i].data.ptr;
+            if (!station)
+            {
+                /* wakeup, the woken stations are visited in the next round */
+                if (read(reactor->wakefd, &count, sizeof(count)) < 0) {}
+                epicsMutexMustLock(reactor->wakeLock);
+                while ((station = reactor->woken) != NULL)
+                {
+                    reactor->woken = station->wakeNext;
+                    station->wakeQueued = 0;
+                    s7plcReactorDue(station, now);
+                }
+                epicsMutexUnlock(reactor->wakeLock);
+                continue;
+            }
+            if ((void*)station == (void*)reactor)
+            {
+                /* deadline reached */
+                if (read(reactor->timerfd, &count, sizeof(count)) < 0) {}
+                continue;
+            }
+            s7plcReactorEvent(station, events[i].events, now);
+            s7plcReactorDue(station, now);
         }
-        epicsSocketDestroy(station->sock);
-        station->sock = INVALID_SOCKET;
     }
-    epicsMutexUnlock(station->mutex);
-    /* notify all "I/O Intr" input records */
-    scanIoRequest(station->inScanPvt);
 }
+#endif /* HAVE_EPOLL */
 
 int s7plcGetAddr(s7plcStation* station, char* addr)
 {
@@ -893,21 +5693,57 @@ int s7plcGetAddr(s7plcStation* station, char* addr)
     return -1;
 }
 
+/* Changes the PLC address and drops the connection to the old one. */
+STATIC void s7plcSetServer(s7plcStation* station, const char* host, int port)
+{
+    epicsMutexMustLock(station->connLock);
+#ifdef HAVE_EPOLL
+    if (station->reactor)
+        s7plcReactorReset(station);
+    else
+#endif
+    s7plcCloseConnection(station);
+    free(station->server);
+    station->server = epicsStrDup(host);
+    if (port)
+        station->serverPort = port;
+    /* the new address is tried at once */
+    station->reconnectTime = 0.0;
+    station->reconnectDelay = 0.0;
+    station->failedConnects = 0;
+    epicsMutexUnlock(station->connLock);
+    epicsEventSignal(station->connEvent);
+}
+
 int s7plcSetAddr(s7plcStation* station, const char* addr)
 {
+    s7plcStation* block;
+    char* host;
     char* c;
+    int port = 0;
 
     s7plcDebugLog(1, "s7plcSetAddr %s\n", addr);
-    epicsMutexMustLock(station->mutex);
-    s7plcCloseConnection(station);
-    free(station->server);
-    station->server = epicsStrDup(addr);
-    c = strchr(station->server, ':');
+    if (s7plcIsLocal(station))
+    {
+        s7plcErrorLog("s7plcSetAddr %s: %s has no address to set\n",
+            station->name, station->loopback ? "loopback" : "replay");
+        return -1;
+    }
+    host = epicsStrDup(addr);
+    c = strchr(host, ':');
     if (c)
     {
-        station->serverPort = strtol(c+1,NULL,10);
+        port = strtol(c+1,NULL,10);
         *c = 0;
     }
-    epicsMutexUnlock(station->mutex);
+    s7plcSetServer(station, host, port);
+    /*
+     * Blocks with their own connection move to the new host, same port.
+     * The sendAddr connection keeps its address, set it on "name:send".
+     */
+    for (block = station->blocks; block; block = block->blockNext)
+        if (!block->carrier && !block->outSource)
+            s7plcSetServer(block, host, 0);
+    free(host);
     return 0;
 }
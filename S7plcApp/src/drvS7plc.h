@@ -2,6 +2,8 @@
 #define drvS7plc_h
 
 #include <dbScan.h>
+#include <drvSup.h>
+#include <epicsTypes.h>
 
 #ifndef DEBUG
 #define STATIC static
@@ -14,13 +16,47 @@
 typedef struct s7plcStation s7plcStation;
 
 extern int s7plcDebug;
-
+extern int s7plcTrace;
+extern struct drvet s7plc;
+
+int s7plcConfigure(char *name, char* IPaddr, unsigned int port,
+    unsigned int inSize, unsigned int outSize, unsigned int bigEndian,
+    unsigned int recvTimeout, unsigned int sendIntervall);
+int s7plcConfigureBlock(char *name, char *block, unsigned int port,
+    unsigned int inSize, unsigned int outSize,
+    unsigned int recvTimeout, unsigned int period);
+int s7plcSetOption(char *name, char *option, char *value);
 s7plcStation *s7plcOpen(char *name);
 IOSCANPVT s7plcGetInScanPvt(s7plcStation *station);
 IOSCANPVT s7plcGetOutScanPvt(s7plcStation *station);
+IOSCANPVT s7plcGetInScanPvtRange(s7plcStation *station,
+    unsigned int offset, unsigned int size, int bit);
 int s7plcGetAddr(s7plcStation* station, char* addr);
+
+/* Scalar input values decoded once per received frame */
+#define S7PLC_INT8     0
+#define S7PLC_UINT8    1
+#define S7PLC_INT16    2
+#define S7PLC_UINT16   3
+#define S7PLC_INT32    4
+#define S7PLC_UINT32   5
+#define S7PLC_FLOAT32  6
+#define S7PLC_FLOAT64  7
+
+typedef union {
+    epicsInt32 i;         /* INT8 ... INT32 (UINT32 as bit pattern) */
+    epicsUInt32 u;        /* UINT8 ... UINT32 */
+    epicsFloat64 f;       /* FLOAT32, FLOAT64 */
+} s7plcValue;
+
+int s7plcAddChannel(s7plcStation *station, unsigned int offset, int kind);
+int s7plcReadValue(s7plcStation *station, int channel,
+    unsigned int offset, int kind, s7plcValue *value);
 int s7plcSetAddr(s7plcStation* station, const char* addr);
 
+/* PLC end of a "pair" transport connection, for tests */
+int s7plcGetPeer(s7plcStation* station);
+
 int s7plcReadArray(
     s7plcStation *station,
     unsigned int offset,
@@ -38,6 +74,37 @@ int s7plcWriteMaskedArray(
     void* pmask
 );
 
+/* Access to single values specialised for length, byte order and mask */
+typedef int (*s7plcReadFunc)(s7plcStation *station,
+    unsigned int offset, void* pdata);
+typedef int (*s7plcWriteFunc)(s7plcStation *station,
+    unsigned int offset, const void* pdata);
+typedef int (*s7plcWriteMaskedFunc)(s7plcStation *station,
+    unsigned int offset, const void* pdata, const void* pmask);
+
+s7plcReadFunc s7plcGetReadFunc(s7plcStation *station,
+    unsigned int offset, unsigned int dlen);
+s7plcWriteFunc s7plcGetWriteFunc(s7plcStation *station,
+    unsigned int offset, unsigned int dlen);
+s7plcWriteMaskedFunc s7plcGetWriteMaskedFunc(s7plcStation *station,
+    unsigned int offset, unsigned int dlen);
+
+/* Performance counters by name, see s7plcStats */
+int s7plcStatIndex(const char* name);
+int s7plcGetStat(s7plcStation *station, int index, double* value);
+int s7plcStats(const char* name);
+int s7plcLoadReport(double interval, int count);
+
+/* Latency histograms, see s7plcLatency */
+#define S7PLC_LATENCY_BUCKETS 200
+int s7plcGetLatency(s7plcStation *station, int output,
+    epicsInt32* counts, unsigned int n);
+double s7plcLatencyLimit(int index);
+int s7plcLatency(const char* name, int level);
+int s7plcLatencyReset(const char* name);
+
+int s7plcTraceDump(const char* filename);
+
 #define s7plcWriteArray(station, offset, dlen, nelem, pdata) \
     s7plcWriteMaskedArray((station), (offset), (dlen), (nelem), (pdata), NULL)
 
@@ -52,6 +119,19 @@ int s7plcWriteMaskedArray(
 
 char* s7plcCurrentTime();
 
+/*
+ * Static probes for SystemTap, perf and bpftrace (provider "s7plc").
+ * Built in with S7PLC_USDT=YES, see Makefile. No cost otherwise.
+ */
+#ifdef S7PLC_USDT
+#include <sys/sdt.h>
+#define S7PLC_PROBE1(name, a) DTRACE_PROBE1(s7plc, name, a)
+#define S7PLC_PROBE2(name, a, b) DTRACE_PROBE2(s7plc, name, a, b)
+#else
+#define S7PLC_PROBE1(name, a) do {} while (0)
+#define S7PLC_PROBE2(name, a, b) do {} while (0)
+#endif
+
 #if defined __GNUC__ && __GNUC__ < 3
 /* old GCC style */
 #define s7plcDebugLog(level, fmt, args...) do{if (level <= s7plcDebug) errlogPrintf("%s " fmt, s7plcCurrentTime() , ##args);}while(0)
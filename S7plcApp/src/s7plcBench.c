@@ -0,0 +1,520 @@
+/*
+ * s7plcBench - benchmark of the driver and device support hot paths
+ *
+ * usage: s7plcBench [loops [threads [seconds]]]
+ *
+ * Runs two stations (with and without byte swap) connected to a
+ * local dummy PLC inside this program over the "pair" transport
+ * and measures:
+ *  - s7plcReadArray and s7plcWriteMaskedArray for all dlen, some nelem
+ *  - the specialised single value accessors for all dlen
+ *  - s7plcIoParse over a corpus of INP strings
+ *  - the read and write functions of the device support per record type
+ *  - record reads of 1 ... threads scan threads while frames are
+ *    received and published at full speed
+ *  - system calls per received and per sent frame and the output bytes
+ *    copied per sent frame, with frames as fast as possible
+ *
+ * Each result is printed as one JSON object per line, e.g.
+ * {"bench":"readArray","swap":1,"dlen":2,"nelem":16,"threads":1,"ops":62500,"ns":12.3}
+ * where ns is the time per operation (per call) in nanoseconds.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#include <osiSock.h>
+#include <epicsThread.h>
+#include <epicsEvent.h>
+#include <epicsTime.h>
+#include <dbAccess.h>
+#include <epicsString.h>
+#include <aiRecord.h>
+#include <aoRecord.h>
+#include <biRecord.h>
+#include <boRecord.h>
+#include <mbbiRecord.h>
+#include <mbboRecord.h>
+#include <longinRecord.h>
+#include <longoutRecord.h>
+#include <waveformRecord.h>
+
+#include "drvS7plc.h"
+#include "devS7plc.h"
+
+#define IN_SIZE   4096
+#define OUT_SIZE  4096
+#define CORPUS    10000
+#define MAX_THREADS 64
+
+/* device support entry tables, see devS7plc.c */
+extern struct devsup s7plcAi, s7plcAo, s7plcBi, s7plcBo, s7plcMbbi,
+    s7plcMbbo, s7plcLongin, s7plcLongout, s7plcWaveform;
+
+static s7plcStation* stations[2];   /* [swap] */
+static SOCKET plcSock[2];
+static volatile int stop;
+static epicsEventId publishDone;
+
+static void report(const char* bench, const char* params,
+    unsigned long ops, double seconds)
+{
+    printf("{\"bench\":\"%s\"%s%s,\"ops\":%lu,\"ns\":%.2f}\n",
+        bench, *params ? "," : "", params, ops,
+        ops ? seconds * 1e9 / ops : 0.0);
+    fflush(stdout);
+}
+
+static double since(epicsTimeStamp* start)
+{
+    epicsTimeStamp now;
+    epicsTimeGetCurrent(&now);
+    return epicsTimeDiffInSeconds(&now, start);
+}
+
+/* dummy PLC ********************************************************/
+
+/* Discards the output frames of the IOC */
+static void drainThread(void* arg)
+{
+    SOCKET sock = *(SOCKET*)arg;
+    char buffer[OUT_SIZE];
+
+    while (recv(sock, buffer, sizeof(buffer), 0) > 0);
+}
+
+/* Sends input frames as fast as the driver takes them */
+static void publishThread(void* arg)
+{
+    static unsigned char frame[IN_SIZE];
+    unsigned int i = 0;
+
+    while (!stop)
+    {
+        memset(frame, i++, sizeof(frame));
+        send(plcSock[0], (void*)frame, sizeof(frame), 0);
+        send(plcSock[1], (void*)frame, sizeof(frame), 0);
+    }
+    epicsEventSignal(publishDone);
+}
+
+/* Configures and starts two stations like in an IOC startup script */
+static int configureStations(void)
+{
+    char name[20];
+    int swap;
+    union {short s; char c[sizeof(short)];} u;
+
+    u.s = 1;
+    for (swap = 0; swap < 2; swap++)
+    {
+        /* PLC byte order equal to host byte order means no swap */
+        sprintf(name, "bench%d", swap);
+        /* address and port are not used by the pair transport */
+        s7plcConfigure(name, "localhost", 2000,
+            IN_SIZE, OUT_SIZE, swap ? u.c[0] : !u.c[0], 1000, 1000);
+        if (s7plcSetOption(name, "transport", "pair") != 0)
+        {
+            fprintf(stderr, "s7plcBench: no pair transport\n");
+            return -1;
+        }
+        stations[swap] = s7plcOpen(name);
+        if (!stations[swap]) return -1;
+    }
+    return s7plc.init();
+}
+
+/* Takes the PLC ends of both stations and sends a first frame */
+static int acceptStations(void)
+{
+    static unsigned char frame[IN_SIZE];
+    double frames;
+    int i, j, peer;
+
+    interruptAccept = 1;
+    for (i = 0; i < 2; i++)
+    {
+        for (j = 0; (peer = s7plcGetPeer(stations[i])) < 0; j++)
+        {
+            if (j == 500)
+            {
+                fprintf(stderr, "s7plcBench: stations did not connect\n");
+                return -1;
+            }
+            epicsThreadSleep(0.01);
+        }
+        plcSock[i] = peer;
+        epicsThreadCreate("drain", epicsThreadPriorityLow,
+            epicsThreadGetStackSize(epicsThreadStackSmall),
+            drainThread, &plcSock[i]);
+        send(plcSock[i], (void*)frame, sizeof(frame), 0);
+    }
+    for (i = 0; i < 100; i++)
+    {
+        s7plcGetStat(stations[0], s7plcStatIndex("framesIn"), &frames);
+        if (frames > 0)
+        {
+            s7plcGetStat(stations[1], s7plcStatIndex("framesIn"), &frames);
+            if (frames > 0) return 0;
+        }
+        epicsThreadSleep(0.05);
+    }
+    fprintf(stderr, "s7plcBench: stations did not connect\n");
+    return -1;
+}
+
+/* driver functions *************************************************/
+
+static void benchArrays(unsigned long loops)
+{
+    static unsigned char data[8*256], mask[8*256];
+    static const unsigned int nelems[] = { 1, 16, 256 };
+    unsigned int swap, dlen, n;
+    unsigned long i, ops;
+    epicsTimeStamp start;
+    char params[100];
+
+    memset(mask, 0x5a, sizeof(mask));
+    for (swap = 0; swap < 2; swap++)
+    for (dlen = 1; dlen <= 8; dlen <<= 1)
+    for (n = 0; n < sizeof(nelems)/sizeof(nelems[0]); n++)
+    {
+        sprintf(params, "\"swap\":%u,\"dlen\":%u,\"nelem\":%u,\"threads\":1",
+            swap, dlen, nelems[n]);
+        ops = loops / nelems[n] + 1;
+
+        epicsTimeGetCurrent(&start);
+        for (i = 0; i < ops; i++)
+            s7plcReadArray(stations[swap], 0, dlen, nelems[n], data);
+        report("readArray", params, ops, since(&start));
+
+        epicsTimeGetCurrent(&start);
+        for (i = 0; i < ops; i++)
+            s7plcWriteMaskedArray(stations[swap], 0, dlen, nelems[n], data, NULL);
+        report("writeArray", params, ops, since(&start));
+
+        epicsTimeGetCurrent(&start);
+        for (i = 0; i < ops; i++)
+            s7plcWriteMaskedArray(stations[swap], 0, dlen, nelems[n], data, mask);
+        report("writeMaskedArray", params, ops, since(&start));
+    }
+}
+
+/* The accessors the device support selects at record init */
+static void benchAccessors(unsigned long loops)
+{
+    static unsigned char data[8], mask[8];
+    unsigned int swap, dlen;
+    unsigned long i;
+    epicsTimeStamp start;
+    char params[100];
+
+    memset(mask, 0x5a, sizeof(mask));
+    for (swap = 0; swap < 2; swap++)
+    for (dlen = 1; dlen <= 8; dlen <<= 1)
+    {
+        s7plcStation* station = stations[swap];
+        s7plcReadFunc read = s7plcGetReadFunc(station, 0, dlen);
+        s7plcWriteFunc write = s7plcGetWriteFunc(station, 0, dlen);
+        s7plcWriteMaskedFunc writeMasked = s7plcGetWriteMaskedFunc(station, 0, dlen);
+
+        sprintf(params, "\"swap\":%u,\"dlen\":%u,\"threads\":1", swap, dlen);
+
+        epicsTimeGetCurrent(&start);
+        for (i = 0; i < loops; i++)
+            read(station, 0, data);
+        report("readFunc", params, loops, since(&start));
+
+        epicsTimeGetCurrent(&start);
+        for (i = 0; i < loops; i++)
+            write(station, 0, data);
+        report("writeFunc", params, loops, since(&start));
+
+        epicsTimeGetCurrent(&start);
+        for (i = 0; i < loops; i++)
+            writeMasked(station, 0, data, mask);
+        report("writeMaskedFunc", params, loops, since(&start));
+    }
+}
+
+static void benchParse(unsigned long loops)
+{
+    static const char* types[] = { "INT8", "UINT16", "WORD", "INT32",
+        "DWORD", "FLOAT", "REAL64", "BCD", "TIME", "BYTE" };
+    char** corpus;
+    S7memPrivate_t priv;
+    unsigned long i, ops;
+    epicsTimeStamp start;
+
+    corpus = calloc(CORPUS, sizeof(char*));
+    for (i = 0; i < CORPUS; i++)
+    {
+        corpus[i] = malloc(80);
+        switch (i % 4)
+        {
+            case 0:
+                sprintf(corpus[i], "bench%lu/%lu T=%s", i & 1,
+                    (i * 7) % 2000, types[i % 10]);
+                break;
+            case 1:
+                sprintf(corpus[i], "bench%lu/%lu T=INT16 B=%lu", i & 1,
+                    (i * 2) % 2000, i % 16);
+                break;
+            case 2:
+                sprintf(corpus[i], "bench%lu/%lu T=INT16 L=-%lu H=%lu", i & 1,
+                    (i * 2) % 2000, i % 30000, i % 30000 + 1);
+                break;
+            default:
+                sprintf(corpus[i], " bench%lu/ %lu+%lu T=UINT32", i & 1,
+                    (i * 4) % 1000, i % 100);
+        }
+    }
+    ops = loops / 10 + CORPUS;
+    epicsTimeGetCurrent(&start);
+    for (i = 0; i < ops; i++)
+    {
+        memset(&priv, 0, sizeof(priv));
+        s7plcIoParse("bench", corpus[i % CORPUS], &priv);
+    }
+    report("ioParse", "\"threads\":1", ops, since(&start));
+    for (i = 0; i < CORPUS; i++)
+        free(corpus[i]);
+    free(corpus);
+}
+
+/* device support ***************************************************/
+
+typedef struct {
+    const char* bench;
+    struct devsup* dset;
+    size_t size;
+    size_t link;              /* offset of INP or OUT field */
+    const char* par;
+} benchRecord;
+
+#define REC(bench, dset, type, link, par) \
+    { bench, &dset, sizeof(type), offsetof(type, link), par }
+
+static const benchRecord benchRecords[] = {
+    REC("readAi",       s7plcAi,       aiRecord,       inp, "100 T=INT16"),
+    REC("readAiFloat",  s7plcAi,       aiRecord,       inp, "104 T=FLOAT"),
+    REC("readBi",       s7plcBi,       biRecord,       inp, "108 T=WORD B=3"),
+    REC("readMbbi",     s7plcMbbi,     mbbiRecord,     inp, "110 T=WORD"),
+    REC("readLongin",   s7plcLongin,   longinRecord,   inp, "112 T=INT32"),
+    REC("readWaveform", s7plcWaveform, waveformRecord, inp, "200 T=INT16"),
+    REC("writeAo",      s7plcAo,       aoRecord,       out, "100 T=INT16"),
+    REC("writeBo",      s7plcBo,       boRecord,       out, "108 T=WORD B=3"),
+    REC("writeMbbo",    s7plcMbbo,     mbboRecord,     out, "110 T=WORD"),
+    REC("writeLongout", s7plcLongout,  longoutRecord,  out, "112 T=INT32"),
+};
+#define NRECORDS (sizeof(benchRecords)/sizeof(benchRecords[0]))
+
+static dbCommon* records[2][NRECORDS];       /* [swap][benchRecords] */
+static dbCommon* readers[MAX_THREADS];
+
+/* Records must be initialized before interruptAccept like in an IOC */
+static dbCommon* makeRecord(const benchRecord* r, int swap)
+{
+    dbCommon* record = calloc(1, r->size);
+    struct link* plink = (struct link*)((char*)record + r->link);
+    char par[80];
+    long status;
+
+    sprintf(par, "bench%d/%s", swap, r->par);
+    strcpy(record->name, r->bench);
+    plink->type = INST_IO;
+    plink->value.instio.string = epicsStrDup(par);
+    if (r->dset == &s7plcWaveform)
+    {
+        waveformRecord* wf = (waveformRecord*)record;
+        wf->ftvl = menuFtypeSHORT;
+        wf->nelm = 100;
+        wf->bptr = calloc(wf->nelm, sizeof(epicsInt16));
+    }
+    if (r->dset == &s7plcMbbi)
+        ((mbbiRecord*)record)->mask = 0xf;
+    if (r->dset == &s7plcMbbo)
+        ((mbboRecord*)record)->mask = 0xf;
+    status = r->dset->init_record(record);
+    if (status != 0 && status != 2)
+    {
+        fprintf(stderr, "s7plcBench: init_record %s (%s) failed\n",
+            r->bench, par);
+        return NULL;
+    }
+    return record;
+}
+
+static void benchDevice(unsigned long loops)
+{
+    unsigned int r, swap;
+    unsigned long i;
+    dbCommon* record;
+    epicsTimeStamp start;
+    char params[100];
+
+    for (swap = 0; swap < 2; swap++)
+    for (r = 0; r < NRECORDS; r++)
+    {
+        record = records[swap][r];
+        if (!record) continue;
+        sprintf(params, "\"swap\":%u,\"threads\":1", swap);
+        epicsTimeGetCurrent(&start);
+        for (i = 0; i < loops; i++)
+            benchRecords[r].dset->io(record);
+        report(benchRecords[r].bench, params, loops, since(&start));
+    }
+}
+
+/* contention *******************************************************/
+
+typedef struct {
+    dbCommon* record;
+    unsigned long ops;
+    epicsEventId done;
+} readerArg;
+
+static void readerThread(void* arg)
+{
+    readerArg* a = arg;
+
+    while (!stop)
+    {
+        s7plcAi.io(a->record);
+        a->ops++;
+    }
+    epicsEventSignal(a->done);
+}
+
+static void benchContention(unsigned int maxThreads, double seconds)
+{
+    readerArg args[MAX_THREADS];
+    unsigned int n, i;
+    unsigned long ops;
+    double frames0, frames1;
+    epicsTimeStamp start;
+    double t;
+    char params[100];
+
+    publishDone = epicsEventMustCreate(epicsEventEmpty);
+    for (n = 1; n <= maxThreads; n *= 2)
+    {
+        stop = 0;
+        s7plcGetStat(stations[1], s7plcStatIndex("framesIn"), &frames0);
+        epicsThreadCreate("publish", epicsThreadPriorityHigh,
+            epicsThreadGetStackSize(epicsThreadStackSmall),
+            publishThread, NULL);
+        for (i = 0; i < n; i++)
+        {
+            args[i].record = readers[i];
+            args[i].ops = 0;
+            args[i].done = epicsEventMustCreate(epicsEventEmpty);
+            epicsThreadCreate("reader", epicsThreadPriorityMedium,
+                epicsThreadGetStackSize(epicsThreadStackSmall),
+                readerThread, &args[i]);
+        }
+        epicsTimeGetCurrent(&start);
+        epicsThreadSleep(seconds);
+        stop = 1;
+        for (i = 0; i < n; i++)
+            epicsEventMustWait(args[i].done);
+        epicsEventMustWait(publishDone);
+        t = since(&start);
+        s7plcGetStat(stations[1], s7plcStatIndex("framesIn"), &frames1);
+        for (ops = 0, i = 0; i < n; i++)
+        {
+            ops += args[i].ops;
+            epicsEventDestroy(args[i].done);
+        }
+        /* ns per read per thread, and published frames per second */
+        sprintf(params, "\"swap\":1,\"threads\":%u,\"frames_per_s\":%.0f",
+            n, (frames1 - frames0) / t);
+        report("contention", params, ops / n, t);
+    }
+}
+
+static double benchStat(s7plcStation* station, const char* name)
+{
+    double value = 0.0;
+    s7plcGetStat(station, s7plcStatIndex(name), &value);
+    return value;
+}
+
+static void benchFrameIO(double seconds)
+{
+    s7plcStation* station = stations[0];
+    double frames, calls, copied;
+    epicsTimeStamp start;
+    epicsUInt16 x = 0;
+    double t;
+    char params[150];
+
+    /* receive: the dummy PLC sends as fast as possible */
+    stop = 0;
+    frames = benchStat(station, "framesIn");
+    calls = benchStat(station, "recvCalls");
+    epicsTimeGetCurrent(&start);
+    epicsThreadCreate("publish", epicsThreadPriorityHigh,
+        epicsThreadGetStackSize(epicsThreadStackSmall),
+        publishThread, NULL);
+    epicsThreadSleep(seconds);
+    stop = 1;
+    epicsEventMustWait(publishDone);
+    t = since(&start);
+    frames = benchStat(station, "framesIn") - frames;
+    calls = benchStat(station, "recvCalls") - calls;
+    sprintf(params, "\"swap\":0,\"dir\":\"in\",\"size\":%d,"
+        "\"frames_per_s\":%.0f,\"calls_per_frame\":%.2f",
+        IN_SIZE, frames / t, frames ? calls / frames : 0.0);
+    report("frameIO", params, (unsigned long)frames, t);
+
+    /* send: every write of one word wakes up the sender */
+    s7plcSetOption("bench0", "sendGap", "0");
+    s7plcSetOption("bench0", "sendOnWrite", "1");
+    frames = benchStat(station, "framesOut");
+    calls = benchStat(station, "sendCalls");
+    copied = benchStat(station, "bytesCopied");
+    epicsTimeGetCurrent(&start);
+    do
+    {
+        x++;
+        s7plcWrite(station, 0, 2, &x);
+        epicsThreadSleep(0.0);
+    } while (since(&start) < seconds);
+    t = since(&start);
+    s7plcSetOption("bench0", "sendOnWrite", "0");
+    frames = benchStat(station, "framesOut") - frames;
+    calls = benchStat(station, "sendCalls") - calls;
+    copied = benchStat(station, "bytesCopied") - copied;
+    sprintf(params, "\"swap\":0,\"dir\":\"out\",\"size\":%d,"
+        "\"frames_per_s\":%.0f,\"calls_per_frame\":%.2f,\"copied_per_frame\":%.0f",
+        OUT_SIZE, frames / t, frames ? calls / frames : 0.0,
+        frames ? copied / frames : 0.0);
+    report("frameIO", params, (unsigned long)frames, t);
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned long loops = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000000;
+    unsigned int threads = argc > 2 ? strtoul(argv[2], NULL, 0) : 4;
+    double seconds = argc > 3 ? strtod(argv[3], NULL) : 1.0;
+    unsigned int i, swap;
+
+    if (threads > MAX_THREADS) threads = MAX_THREADS;
+    if (configureStations() != 0) return 1;
+    for (swap = 0; swap < 2; swap++)
+        for (i = 0; i < NRECORDS; i++)
+            records[swap][i] = makeRecord(&benchRecords[i], swap);
+    for (i = 0; i < threads; i++)
+        readers[i] = makeRecord(&benchRecords[0], 1);
+    if (acceptStations() != 0) return 1;
+    benchArrays(loops);
+    benchAccessors(loops);
+    benchParse(loops);
+    benchDevice(loops);
+    benchContention(threads, seconds);
+    benchFrameIO(seconds);
+    return 0;
+}
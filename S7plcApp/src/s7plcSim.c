@@ -0,0 +1,469 @@
+/*
+ * s7plcSim - PLC simulator for load and regression tests of the driver
+ *
+ * usage: s7plcSim [options] -p port[-lastport] [[options] -p ...]
+ *
+ * Each -p adds one or a range of PLC endpoints listening on localhost
+ * with the options given before it:
+ *  -a address  listen address (default 127.0.0.1)
+ *  -i size     size of the frames sent to the IOC (IOC inSize)
+ *  -o size     size of the frames received from the IOC (IOC outSize)
+ *  -r rate     frames per second sent to the IOC, 0 = none
+ *  -c pattern  how the sent frames change:
+ *              static  never
+ *              counter first 4 bytes are a big endian frame counter
+ *              random  -n random bytes get random values
+ *              all     all bytes change in every frame
+ *  -n bytes    number of bytes changed by the random pattern
+ * Global options:
+ *  -t seconds  report interval (default 1)
+ *  -d seconds  run time (default forever, or until SIGINT)
+ *  -v          report every endpoint, not only the total
+ *
+ * Each endpoint accepts one connection at a time. A new connection
+ * replaces the old one like on a real PLC. Received frames are counted
+ * and checksummed (FNV-1a). The report lines have the form
+ *  t=2.000 port=2000 conn=1 sent=1000 sent_rate=1000.0 recv=10
+ *    recv_rate=10.0 changes=3 checksum=0x811c9dc5 late=0
+ * where changes counts received frames with a different checksum than
+ * the frame before and late counts frames that could not be sent in
+ * time. The total line has port=all and the checksum of all checksums.
+ *
+ * The program is a single thread multiplexing all sockets with poll, so
+ * that it can run hundreds of endpoints with rates of tens of kHz.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define PATTERN_STATIC  0
+#define PATTERN_COUNTER 1
+#define PATTERN_RANDOM  2
+#define PATTERN_ALL     3
+
+static const char* patternNames[] = { "static", "counter", "random", "all" };
+
+typedef struct endpoint {
+    unsigned short port;
+    int listener;
+    int sock;
+    unsigned int inSize;        /* frames sent to the IOC */
+    unsigned int outSize;       /* frames received from the IOC */
+    double rate;
+    int pattern;
+    unsigned int nrandom;
+    unsigned int seed;
+    long long period;           /* ns */
+    long long next;             /* ns, time of the next frame */
+    unsigned int counter;
+    unsigned char* sendBuf;
+    int pending;                /* current frame not yet completely sent */
+    unsigned int sent;          /* bytes of the current frame already sent */
+    unsigned char* recvBuf;
+    unsigned int received;      /* bytes of the current frame received */
+    unsigned int checksum;
+    unsigned long long framesOut, framesIn, changes, late, connects;
+    unsigned long long lastOut, lastIn;
+} endpoint;
+
+static endpoint* endpoints;
+static unsigned int nendpoints;
+static volatile int stop;
+
+static long long now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void onSignal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+static unsigned int fnv1a(const unsigned char* data, unsigned int size)
+{
+    unsigned int hash = 0x811c9dc5;
+    unsigned int i;
+
+    for (i = 0; i < size; i++)
+    {
+        hash ^= data[i];
+        hash *= 0x01000193;
+    }
+    return hash;
+}
+
+static unsigned int xorshift(unsigned int* state)
+{
+    unsigned int x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static int setNonBlocking(int sock)
+{
+    int flags = fcntl(sock, F_GETFL, 0);
+    return fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+}
+
+static int addEndpoint(endpoint* proto, const char* address, unsigned short port)
+{
+    endpoint* ep;
+    struct sockaddr_in addr;
+    int one = 1;
+    unsigned int i;
+
+    endpoints = realloc(endpoints, (nendpoints + 1) * sizeof(endpoint));
+    if (!endpoints)
+    {
+        fprintf(stderr, "s7plcSim: out of memory\n");
+        return -1;
+    }
+    ep = &endpoints[nendpoints];
+    *ep = *proto;
+    ep->port = port;
+    ep->sock = -1;
+    ep->seed = port ? port : 1;
+    ep->period = ep->rate > 0 && ep->inSize ? (long long)(1e9 / ep->rate) : 0;
+    ep->sendBuf = calloc(1, ep->inSize + 1);
+    ep->recvBuf = calloc(1, ep->outSize + 1);
+    ep->checksum = fnv1a(NULL, 0);
+    if (!ep->sendBuf || !ep->recvBuf)
+    {
+        fprintf(stderr, "s7plcSim: out of memory\n");
+        return -1;
+    }
+    for (i = 0; i < ep->inSize; i++)
+        ep->sendBuf[i] = i;
+
+    ep->listener = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, address, &addr.sin_addr) != 1)
+    {
+        fprintf(stderr, "s7plcSim: invalid address %s\n", address);
+        return -1;
+    }
+    setsockopt(ep->listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (ep->listener < 0 ||
+        bind(ep->listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(ep->listener, 1) != 0 ||
+        setNonBlocking(ep->listener) != 0)
+    {
+        fprintf(stderr, "s7plcSim: cannot listen on %s:%u: %s\n",
+            address, port, strerror(errno));
+        return -1;
+    }
+    nendpoints++;
+    return 0;
+}
+
+static void closeConnection(endpoint* ep)
+{
+    if (ep->sock < 0) return;
+    close(ep->sock);
+    ep->sock = -1;
+    ep->pending = 0;
+    ep->sent = 0;
+    ep->received = 0;
+}
+
+static void acceptConnection(endpoint* ep, long long t)
+{
+    int sock, one = 1;
+
+    sock = accept(ep->listener, NULL, NULL);
+    if (sock < 0) return;
+    closeConnection(ep);
+    setNonBlocking(sock);
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    ep->sock = sock;
+    ep->next = t;
+    ep->connects++;
+}
+
+/* Changes the frame according to the pattern */
+static void nextFrame(endpoint* ep)
+{
+    unsigned char* p = ep->sendBuf;
+    unsigned int i, x;
+
+    ep->counter++;
+    switch (ep->pattern)
+    {
+        case PATTERN_COUNTER:
+            for (i = 0; i < 4 && i < ep->inSize; i++)
+                p[i] = ep->counter >> (24 - 8 * i);
+            break;
+        case PATTERN_RANDOM:
+            for (i = 0; i < ep->nrandom; i++)
+            {
+                x = xorshift(&ep->seed);
+                p[x % ep->inSize] = x >> 24;
+            }
+            break;
+        case PATTERN_ALL:
+            for (i = 0; i + 4 <= ep->inSize; i += 4)
+            {
+                x = xorshift(&ep->seed);
+                memcpy(p + i, &x, 4);
+            }
+            for (; i < ep->inSize; i++)
+                p[i] = xorshift(&ep->seed);
+            break;
+    }
+}
+
+/* Sends due frames, returns 1 if the socket would block */
+static int sendFrames(endpoint* ep, long long t)
+{
+    ssize_t n;
+    int burst = 0;
+
+    while (ep->pending || (ep->period && ep->next <= t))
+    {
+        if (!ep->pending)
+        {
+            nextFrame(ep);
+            ep->pending = 1;
+        }
+        n = send(ep->sock, ep->sendBuf + ep->sent, ep->inSize - ep->sent,
+            MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 1;
+            closeConnection(ep);
+            return 0;
+        }
+        ep->sent += n;
+        if (ep->sent < ep->inSize) return 1;
+        ep->sent = 0;
+        ep->pending = 0;
+        ep->framesOut++;
+        ep->next += ep->period;
+        if (++burst == 16 && ep->next <= t)
+        {
+            /* too far behind: skip frames instead of sending a burst */
+            ep->late += (t - ep->next) / ep->period + 1;
+            ep->next = t + ep->period;
+            break;
+        }
+    }
+    return 0;
+}
+
+static void receiveFrames(endpoint* ep)
+{
+    unsigned char buffer[65536];
+    ssize_t n, i;
+    unsigned int m, checksum;
+
+    while (ep->sock >= 0)
+    {
+        n = recv(ep->sock, buffer, sizeof(buffer), 0);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+        {
+            closeConnection(ep);
+            return;
+        }
+        if (n < 0) return;
+        if (!ep->outSize) continue;
+        for (i = 0; i < n; i += m)
+        {
+            m = ep->outSize - ep->received;
+            if (m > n - i) m = n - i;
+            memcpy(ep->recvBuf + ep->received, buffer + i, m);
+            ep->received += m;
+            if (ep->received == ep->outSize)
+            {
+                checksum = fnv1a(ep->recvBuf, ep->outSize);
+                if (ep->framesIn && checksum != ep->checksum)
+                    ep->changes++;
+                ep->checksum = checksum;
+                ep->framesIn++;
+                ep->received = 0;
+            }
+        }
+    }
+}
+
+static void report(double t, double interval, int verbose)
+{
+    endpoint* ep;
+    unsigned int i;
+    unsigned long long out = 0, in = 0, dout = 0, din = 0, changes = 0, late = 0;
+    unsigned int conn = 0, checksum = fnv1a(NULL, 0);
+
+    for (i = 0; i < nendpoints; i++)
+    {
+        ep = &endpoints[i];
+        if (verbose)
+            printf("t=%.3f port=%u conn=%d sent=%llu sent_rate=%.1f recv=%llu"
+                " recv_rate=%.1f changes=%llu checksum=0x%08x late=%llu\n",
+                t, ep->port, ep->sock >= 0, ep->framesOut,
+                (ep->framesOut - ep->lastOut) / interval, ep->framesIn,
+                (ep->framesIn - ep->lastIn) / interval, ep->changes,
+                ep->checksum, ep->late);
+        conn += ep->sock >= 0;
+        out += ep->framesOut;
+        in += ep->framesIn;
+        dout += ep->framesOut - ep->lastOut;
+        din += ep->framesIn - ep->lastIn;
+        changes += ep->changes;
+        late += ep->late;
+        checksum = (checksum ^ ep->checksum) * 0x01000193;
+        ep->lastOut = ep->framesOut;
+        ep->lastIn = ep->framesIn;
+    }
+    printf("t=%.3f port=all conn=%u sent=%llu sent_rate=%.1f recv=%llu"
+        " recv_rate=%.1f changes=%llu checksum=0x%08x late=%llu\n",
+        t, conn, out, dout / interval, in, din / interval, changes,
+        checksum, late);
+    fflush(stdout);
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+        "usage: s7plcSim [-t interval] [-d duration] [-v]\n"
+        "  [-a address] [-i inSize] [-o outSize] [-r rate]"
+        " [-c static|counter|random|all] [-n bytes] -p port[-lastport] ...\n");
+    exit(1);
+}
+
+int main(int argc, char* argv[])
+{
+    endpoint proto;
+    const char* address = "127.0.0.1";
+    double interval = 1.0, duration = 0;
+    int verbose = 0;
+    struct pollfd* fds = NULL;
+    long long start, t, lastReport, nextReport, wait;
+    struct timespec timeout;
+    unsigned int i, port, last;
+    int c;
+
+    memset(&proto, 0, sizeof(proto));
+    proto.inSize = 64;
+    proto.outSize = 64;
+    proto.rate = 10;
+    proto.pattern = PATTERN_COUNTER;
+    proto.nrandom = 8;
+
+    while ((c = getopt(argc, argv, "a:i:o:r:c:n:p:t:d:v")) != -1)
+    {
+        switch (c)
+        {
+            case 'a': address = optarg; break;
+            case 'i': proto.inSize = strtoul(optarg, NULL, 0); break;
+            case 'o': proto.outSize = strtoul(optarg, NULL, 0); break;
+            case 'r': proto.rate = strtod(optarg, NULL); break;
+            case 'n': proto.nrandom = strtoul(optarg, NULL, 0); break;
+            case 't': interval = strtod(optarg, NULL); break;
+            case 'd': duration = strtod(optarg, NULL); break;
+            case 'v': verbose = 1; break;
+            case 'c':
+                for (proto.pattern = 0; proto.pattern < 4; proto.pattern++)
+                    if (strcmp(optarg, patternNames[proto.pattern]) == 0) break;
+                if (proto.pattern == 4) usage();
+                break;
+            case 'p':
+                if (sscanf(optarg, "%u-%u", &port, &last) < 2) last = port;
+                if (port == 0 || port > 65535 || last < port || last > 65535)
+                    usage();
+                for (; port <= last; port++)
+                    if (addEndpoint(&proto, address, port) != 0) return 1;
+                break;
+            default:
+                usage();
+        }
+    }
+    if (!nendpoints || interval <= 0) usage();
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    signal(SIGPIPE, SIG_IGN);
+    fds = calloc(2 * nendpoints, sizeof(struct pollfd));
+    if (!fds)
+    {
+        fprintf(stderr, "s7plcSim: out of memory\n");
+        return 1;
+    }
+    for (i = 0; i < nendpoints; i++)
+        printf("port=%u in=%u out=%u rate=%g pattern=%s\n",
+            endpoints[i].port, endpoints[i].inSize, endpoints[i].outSize,
+            endpoints[i].rate, patternNames[endpoints[i].pattern]);
+
+    start = lastReport = now();
+    nextReport = start + (long long)(interval * 1e9);
+    while (!stop)
+    {
+        t = now();
+        if (duration > 0 && t - start >= duration * 1e9) break;
+        if (t >= nextReport)
+        {
+            report((t - start) * 1e-9, (t - lastReport) * 1e-9, verbose);
+            lastReport = t;
+            nextReport += (long long)(interval * 1e9);
+        }
+
+        /* find the earliest deadline and send what is due */
+        wait = nextReport - t;
+        for (i = 0; i < nendpoints; i++)
+        {
+            endpoint* ep = &endpoints[i];
+
+            fds[2*i].fd = ep->listener;
+            fds[2*i].events = POLLIN;
+            fds[2*i+1].fd = ep->sock;
+            fds[2*i+1].events = 0;
+            if (ep->sock < 0) continue;
+            fds[2*i+1].events = POLLIN;
+            if (sendFrames(ep, t))
+                fds[2*i+1].events |= POLLOUT;
+            else if (ep->sock >= 0 && ep->period && ep->next - t < wait)
+                wait = ep->next - t;
+            fds[2*i+1].fd = ep->sock;
+        }
+        if (wait < 0) wait = 0;
+        timeout.tv_sec = wait / 1000000000;
+        timeout.tv_nsec = wait % 1000000000;
+        if (ppoll(fds, 2 * nendpoints, &timeout, NULL) < 0)
+        {
+            if (errno == EINTR) continue;
+            perror("s7plcSim: poll");
+            return 1;
+        }
+        t = now();
+        for (i = 0; i < nendpoints; i++)
+        {
+            if (fds[2*i].revents & POLLIN)
+                acceptConnection(&endpoints[i], t);
+            if (fds[2*i+1].revents & (POLLIN | POLLHUP | POLLERR) &&
+                fds[2*i+1].fd == endpoints[i].sock)
+                receiveFrames(&endpoints[i]);
+        }
+    }
+    t = now();
+    report((t - start) * 1e-9, (t - lastReport) * 1e-9, verbose);
+    return 0;
+}
@@ -0,0 +1,185 @@
+/*
+ * s7plcTest - regression tests of driver and device support
+ *
+ * usage: s7plcTest
+ *
+ * Runs a station over the "pair" transport. The test program is the
+ * PLC: it sends input frames to the driver and checks the output
+ * frames the driver sends. Records are initialized and processed by
+ * calling their device support directly, like s7plcBench does.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <osiSock.h>
+#include <epicsThread.h>
+#include <dbAccess.h>
+#include <epicsString.h>
+#include <aaoRecord.h>
+#include <waveformRecord.h>
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "drvS7plc.h"
+#include "devS7plc.h"
+
+#define IN_SIZE   64
+#define OUT_SIZE  64
+
+/* device support entry tables, see devS7plc.c */
+extern struct devsup s7plcAao, s7plcWaveform;
+
+static s7plcStation* station;
+static s7plcStation* addrStation;
+static SOCKET peer = INVALID_SOCKET;
+
+/* PLC end ***********************************************************/
+
+/*
+ * Receives output frames until the driver stops sending
+ * and returns the last one.
+ */
+static int lastOutput(unsigned char* frame)
+{
+    unsigned char buffer[OUT_SIZE];
+    int frames = 0;
+
+    while (recv(peer, (void*)buffer, OUT_SIZE, MSG_WAITALL) == OUT_SIZE)
+    {
+        memcpy(frame, buffer, OUT_SIZE);
+        frames++;
+    }
+    return frames;
+}
+
+/* Sends an input frame and waits until the driver has received it */
+static int sendInput(const unsigned char* frame)
+{
+    double frames, received;
+    int i;
+
+    s7plcGetStat(station, s7plcStatIndex("framesIn"), &frames);
+    if (send(peer, (void*)frame, IN_SIZE, 0) != IN_SIZE) return -1;
+    for (i = 0; i < 100; i++)
+    {
+        s7plcGetStat(station, s7plcStatIndex("framesIn"), &received);
+        if (received > frames) return 0;
+        epicsThreadSleep(0.01);
+    }
+    return -1;
+}
+
+/* Configures and starts the station like in an IOC startup script */
+static void startStation(void)
+{
+    struct timeval timeout = { 0, 300000 };
+    int i;
+
+    /* address and port are not used by the pair transport */
+    s7plcConfigure("test", "localhost", 2000,
+        IN_SIZE, OUT_SIZE, 1, 60000, 20);
+    if (s7plcSetOption("test", "transport", "pair") != 0)
+        testAbort("no pair transport");
+    station = s7plcOpen("test");
+    /* for address changes, with a block and a separate output connection */
+    s7plcConfigure("addr", "localhost", 2000, IN_SIZE, OUT_SIZE, 1, 60000, 20);
+    s7plcSetOption("addr", "transport", "pair");
+    s7plcConfigureBlock("addr", "fast", 2001, IN_SIZE, 0, 60000, 20);
+    s7plcSetOption("addr", "sendAddr", "plc-out:2002");
+    addrStation = s7plcOpen("addr");
+    if (!station || !addrStation || s7plc.init() != 0)
+        testAbort("cannot start station");
+    for (i = 0; (peer = s7plcGetPeer(station)) < 0; i++)
+    {
+        if (i == 500) testAbort("station did not connect");
+        epicsThreadSleep(0.01);
+    }
+    setsockopt(peer, SOL_SOCKET, SO_RCVTIMEO, (void*)&timeout, sizeof(timeout));
+}
+
+/* Initializes a record like iocInit does */
+static dbCommon* initRecord(dbCommon* record, struct devsup* dset,
+    struct link* plink, const char* name, const char* par)
+{
+    strcpy(record->name, name);
+    plink->type = INST_IO;
+    plink->value.instio.string = epicsStrDup(par);
+    if (dset->init_record(record) != 0)
+        testAbort("init_record %s (%s) failed", name, par);
+    return record;
+}
+
+/* tests *************************************************************/
+
+/* aao with T=TIME writes element i to offset+i as BCD */
+static void testAaoTime(void)
+{
+    static const unsigned char values[8] = { 26, 10, 17, 12, 34, 56, 78, 90 };
+    static const unsigned char bcd[8] = {
+        0x26, 0x10, 0x17, 0x12, 0x34, 0x56, 0x78, 0x90 };
+    aaoRecord* record = calloc(1, sizeof(aaoRecord));
+    unsigned char frame[OUT_SIZE];
+
+    record->ftvl = menuFtypeUCHAR;
+    record->nelm = 8;
+    initRecord((dbCommon*)record, &s7plcAao, &record->out,
+        "aaoTime", "test/10 T=TIME");
+    memcpy(record->bptr, values, sizeof(values));
+    testOk(s7plcAao.io((dbCommon*)record) == 0, "aao T=TIME write");
+    testOk(lastOutput(frame) > 0, "output frame sent");
+    testOk(memcmp(frame + 10, bcd, sizeof(bcd)) == 0,
+        "aao T=TIME elements at offsets 10 to 17");
+}
+
+/* ULONG waveform elements are 4 bytes, not 8 */
+static void testWaveformUlong(void)
+{
+    waveformRecord* record = calloc(1, sizeof(waveformRecord));
+    unsigned char frame[IN_SIZE];
+    epicsUInt32* values;
+    int i;
+
+    record->ftvl = menuFtypeULONG;
+    record->nelm = 4;
+    /* one more element as guard */
+    record->bptr = values = calloc(record->nelm + 1, sizeof(epicsUInt32));
+    values[4] = 0xdeadbeef;
+    initRecord((dbCommon*)record, &s7plcWaveform, &record->inp,
+        "waveformUlong", "test/20");
+    memset(frame, 0, sizeof(frame));
+    for (i = 0; i < 4; i++)
+        frame[20 + 4*i + 3] = i + 1;    /* big endian 1, 2, 3, 4 */
+    testOk(sendInput(frame) == 0, "input frame received");
+    testOk(s7plcWaveform.io((dbCommon*)record) == 0, "ULONG waveform read");
+    testOk(values[0] == 1 && values[1] == 2 && values[2] == 3 && values[3] == 4,
+        "ULONG elements 1 2 3 4, got %u %u %u %u",
+        values[0], values[1], values[2], values[3]);
+    testOk(values[4] == 0xdeadbeef, "no write behind the last element");
+}
+
+/* s7plcSetAddr moves the blocks of a PLC, but not its sendAddr connection */
+static void testSetAddr(void)
+{
+    char addr[40];
+
+    testOk(s7plcSetAddr(addrStation, "plc-new") == 0, "set address");
+    testOk(s7plcGetAddr(addrStation, addr) == 0 && strcmp(addr, "plc-new:2000") == 0,
+        "PLC at %s", addr);
+    testOk(s7plcGetAddr(s7plcOpen("addr:fast"), addr) == 0
+        && strcmp(addr, "plc-new:2001") == 0, "block at %s", addr);
+    testOk(s7plcGetAddr(s7plcOpen("addr:send"), addr) == 0
+        && strcmp(addr, "plc-out:2002") == 0, "output connection at %s", addr);
+}
+
+MAIN(s7plcTest)
+{
+    testPlan(11);
+    startStation();
+    interruptAccept = 1;
+    testAaoTime();
+    testWaveformUlong();
+    testSetAddr();
+    return testDone();
+}
@@ -29,6 +29,11 @@ var s7plcDebug 0
 
 s7plcConfigure Testsystem0,localhost,2000,96,112,1,2000,100
 
+#s7plcConfigureReactor shards
+#handle all PLCs with <shards> epoll based I/O threads (Linux only)
+#instead of one send and one receive thread per PLC
+#s7plcConfigureReactor 2
+
 epicsEnvSet EPICS_DB_INCLUDE_PATH, ".:db:../../S7plcApp/Db"
 dbLoadRecords "example.db"
 
@@ -0,0 +1,102 @@
+#!/usr/bin/env perl
+#
+# Generates load.cmd and load.db for the load test IOC: N stations with
+# M records of every type supported by the S7plc device support, all
+# scanned "I/O Intr". Prints the s7plcSim command for the matching PLCs.
+#
+# usage: genLoad.pl [-n stations] [-m records] [-p firstport]
+#                   [-r rate] [-s sendIntervall] [-R shards] [-int64]
+
+use strict;
+use warnings;
+use Getopt::Long qw(:config no_ignore_case);
+
+my $stations = 10;
+my $records = 100;
+my $port = 2000;
+my $rate = 100;
+my $sendIntervall = 100;
+my $shards = 0;
+my $int64 = 0;
+
+GetOptions(
+    "n=i" => \$stations,
+    "m=i" => \$records,
+    "p=i" => \$port,
+    "r=f" => \$rate,
+    "s=i" => \$sendIntervall,
+    "R=i" => \$shards,
+    "int64" => \$int64,
+) or die "usage: $0 [-n stations] [-m records] [-p firstport] [-r rate] [-s sendIntervall] [-R shards] [-int64]\n";
+
+# type, link direction, bytes per record, link parameters, extra fields
+my @types = (
+    [ "ai",         "INP", 2,  "T=INT16", "" ],
+    [ "longin",     "INP", 4,  "T=INT32", "" ],
+    [ "mbbi",       "INP", 2,  "T=WORD",  "  field (NOBT, \"4\")\n" ],
+    [ "mbbiDirect", "INP", 2,  "T=WORD",  "  field (NOBT, \"16\")\n" ],
+    [ "stringin",   "INP", 8,  "L=8",     "" ],
+    [ "waveform",   "INP", 16, "",        "  field (FTVL, \"SHORT\")\n  field (NELM, \"8\")\n" ],
+    [ "aai",        "INP", 16, "",        "  field (FTVL, \"FLOAT\")\n  field (NELM, \"4\")\n" ],
+    [ "ao",         "OUT", 2,  "T=INT16", "" ],
+    [ "longout",    "OUT", 4,  "T=INT32", "" ],
+    [ "mbbo",       "OUT", 2,  "T=WORD",  "  field (NOBT, \"4\")\n" ],
+    [ "mbboDirect", "OUT", 2,  "T=WORD",  "  field (NOBT, \"16\")\n" ],
+    [ "stringout",  "OUT", 8,  "L=8",     "" ],
+    [ "aao",        "OUT", 16, "",        "  field (FTVL, \"FLOAT\")\n  field (NELM, \"4\")\n" ],
+);
+push @types,
+    [ "int64in",    "INP", 8,  "T=INT64", "" ],
+    [ "int64out",   "OUT", 8,  "T=INT64", "" ] if $int64;
+
+open my $db, ">", "load.db" or die "load.db: $!\n";
+open my $cmd, ">", "load.cmd" or die "load.cmd: $!\n";
+print $cmd "# generated by genLoad.pl: $stations stations, $records records per type\n";
+print $cmd "s7plcConfigureReactor $shards\n" if $shards;
+
+my ($inSize, $outSize);
+for my $s (0 .. $stations - 1) {
+    my $plc = "load$s";
+    my %offs = (INP => 0, OUT => 0);
+    for my $t (@types) {
+        my ($type, $link, $size, $par, $fields) = @$t;
+        for my $r (0 .. $records - 1) {
+            print $db "record ($type, \"$plc:$type$r\") {\n",
+                "  field (DTYP, \"S7plc\")\n",
+                "  field ($link,  \"\@$plc/$offs{$link}" . ($par ? " $par" : "") . "\")\n",
+                $fields,
+                "  field (SCAN, \"I/O Intr\")\n",
+                "}\n";
+            $offs{$link} += $size;
+        }
+    }
+    # 16 bi and bo records per word
+    for my $t ([ "bi", "INP" ], [ "bo", "OUT" ]) {
+        my ($type, $link) = @$t;
+        for my $r (0 .. $records - 1) {
+            my $offs = $offs{$link} + 2 * int($r / 16);
+            my $bit = $r % 16;
+            print $db "record ($type, \"$plc:$type$r\") {\n",
+                "  field (DTYP, \"S7plc\")\n",
+                "  field ($link,  \"\@$plc/$offs T=WORD B=$bit\")\n",
+                "  field (SCAN, \"I/O Intr\")\n",
+                "}\n";
+        }
+        $offs{$link} += 2 * int(($records + 15) / 16);
+    }
+    print $db "record (bi, \"$plc:connected\") {\n",
+        "  field (DTYP, \"S7plc stat\")\n",
+        "  field (INP,  \"\@$plc\")\n",
+        "  field (SCAN, \"I/O Intr\")\n",
+        "}\n";
+    ($inSize, $outSize) = ($offs{INP}, $offs{OUT});
+    printf $cmd "s7plcConfigure %s,localhost,%d,%d,%d,1,2000,%d\n",
+        $plc, $port + $s, $inSize, $outSize, $sendIntervall;
+}
+close $db;
+close $cmd;
+
+my $n = $stations * ($records * (@types + 2) + 1);
+print "load.db: $n records, load.cmd: $stations stations of $inSize/$outSize bytes\n";
+printf "start the PLCs with: s7plcSim -i %d -o %d -r %g -c random -p %d-%d\n",
+    $inSize, $outSize, $rate, $port, $port + $stations - 1;
@@ -0,0 +1,23 @@
+#!../../bin/linux-x86_64/S7plcApp
+
+< envPaths
+
+## Register all support components
+dbLoadDatabase "dbd/S7plcApp.dbd"
+S7plcApp_registerRecordDeviceDriver pdbbase
+
+var s7plcDebug 0
+
+# Large databases may need longer callback queues than the default 2000
+#callbackSetQueueSize 20000
+
+# Stations and records generated by genLoad.pl, see README
+< load.cmd
+dbLoadRecords "load.db"
+
+iocInit
+
+#s7plcLoadReport interval count
+#prints frames/s, CPU per frame, input scan completion time and
+#callback queue overflows of all PLCs every <interval> seconds
+s7plcLoadReport 10 6